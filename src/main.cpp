@@ -38,7 +38,13 @@
 #include <arpa/inet.h>
 #include <clocale>
 #include <optional>
+#include <memory>
+#include <bitset>
+#include <iterator>
+#include <string_view>
 #include <cerrno>
+#include <fnmatch.h>
+#include <spawn.h>
 #include <linux/input.h>
 
 #include "CRSDK/CameraRemote_SDK.h"
@@ -63,6 +69,7 @@ namespace SDK = SCRSDK;
 // Globals
 // ----------------------------
 static std::vector<std::thread> g_downloadThreads;
+static std::mutex g_downloadThreads_mtx;  // workers are spawned from SDK, input and executor threads
 static std::string g_download_dir;
 static std::atomic<bool> g_stop{false};
 static std::atomic<bool> g_shutting_down{false};
@@ -79,6 +86,7 @@ static std::atomic<bool> g_sync_all{false};
 static std::atomic<bool> g_sync_star{false};
 static std::atomic<bool> g_sync_abort{false};
 static std::atomic<bool> g_sync_running{false};
+static std::atomic<bool> g_sync_listing_failed{false};  // a manual sync could not list every day
 static std::atomic<bool> g_auto_sync_enabled{false};
 struct SyncTransferStatus {
   std::string label;
@@ -97,6 +105,34 @@ static std::atomic<bool> g_force_close_requested{false};
 static std::atomic<bool> g_force_close_logged{false};
 static std::atomic<int>  g_sigint_count{0};
 
+template <typename Fn>
+static void spawn_download_thread(Fn &&fn) {
+  std::lock_guard<std::mutex> lk(g_downloadThreads_mtx);
+  g_downloadThreads.emplace_back(std::forward<Fn>(fn));
+}
+
+// Joins every download worker (detaches on force-close). Workers may spawn
+// more while we wait, so keep taking batches until none are left; the lock
+// is never held across a join.
+static void join_download_threads() {
+  for (;;) {
+    std::vector<std::thread> batch;
+    {
+      std::lock_guard<std::mutex> lk(g_downloadThreads_mtx);
+      batch.swap(g_downloadThreads);
+    }
+    if (batch.empty()) return;
+    for (auto &t : batch) {
+      if (!t.joinable()) continue;
+      if (g_force_close_requested.load(std::memory_order_relaxed)) {
+        t.detach();
+      } else {
+        t.join();
+      }
+    }
+  }
+}
+
 static std::mutex        g_monitor_mtx;
 static std::thread       g_monitor_thread;
 static std::atomic<bool> g_monitor_running{false};
@@ -105,7 +141,27 @@ static constexpr const char* kMonitorWindowName = "sonshell-monitor";
 static std::atomic<std::uint64_t> g_last_contents_update_slot1{0};
 static std::atomic<std::uint64_t> g_last_contents_update_slot2{0};
 static std::mutex g_rating_mtx;
-static std::unordered_map<std::uint64_t, int> g_last_known_ratings;
+struct LedgerRating {
+  int rating = 0;
+  std::uint64_t captured = 0;  // pack_capture_date(); content IDs restart on every card
+};
+static std::unordered_map<std::uint64_t, LedgerRating> g_last_known_ratings;
+// Per-slot high-water marks used to reconcile captures missed while offline.
+struct ReconcileState {
+  std::atomic<std::uint64_t> update_time{0};    // last ContentsInfoListUpdateTime fully handled
+  std::atomic<std::uint64_t> newest_capture{0}; // pack_capture_date() of newest handled content
+};
+static ReconcileState g_reconcile_slot1;
+static ReconcileState g_reconcile_slot2;
+static constexpr std::size_t kReconcileMaxItems = 200;
+static std::mutex g_transfer_mtx;               // one remote file transfer at a time
+static std::atomic<int> g_live_transfers{0};    // live-capture workers currently downloading
+static std::atomic<bool> g_bg_sync_enabled{false};
+static std::atomic<bool> g_bg_sync_running{false};
+static std::atomic<bool> g_bg_sync_newest_first{false};
+static std::atomic<int>  g_bg_sync_duty{100};    // percent of wall time spent transferring
+static std::atomic<std::int64_t> g_last_capture_activity_ms{0}; // steady clock, see steady_now_ms()
+static constexpr std::int64_t kBackgroundSyncQuietMs = 3000;
 static std::atomic<bool> g_silent_no_connect{false};
 static std::atomic<bool> g_connected_for_logs{false};
 
@@ -115,9 +171,42 @@ struct InputMapDevice {
 };
 static std::vector<std::thread> g_input_device_threads;
 static std::mutex g_command_runner_mutex;
-static std::condition_variable g_command_runner_cv;
 static std::function<int(const std::vector<std::string>&)> g_command_runner;
-static std::mutex g_command_exec_mutex;
+
+// Command executor state (see "Command executor"); the worker pool runs
+// input-map commands, g_cmd_held tracks the resources of running commands.
+struct CommandJob {
+  std::vector<std::string> args;
+  unsigned resources = 0;
+  std::string origin;  // for log messages, e.g. "input-map"
+};
+
+static std::mutex g_cmd_mtx;
+static std::condition_variable g_cmd_cv;
+static unsigned g_cmd_held = 0;          // resources held by running commands
+static std::size_t g_cmd_running = 0;    // async jobs currently executing
+static std::deque<CommandJob> g_cmd_queue;
+static std::vector<std::thread> g_cmd_workers;
+static bool g_cmd_stop = false;
+static std::uint64_t g_cmd_async_done = 0, g_cmd_async_dropped = 0;
+
+static std::int64_t steady_now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void note_capture_activity() {
+  g_last_capture_activity_ms.store(steady_now_ms(), std::memory_order_relaxed);
+}
+
+// Background sync only transfers while nothing in the foreground needs the link.
+static bool background_sync_idle() {
+  if (g_sync_running.load(std::memory_order_acquire)) return false;
+  if (g_monitor_running.load(std::memory_order_relaxed)) return false;
+  if (g_live_transfers.load(std::memory_order_relaxed) > 0) return false;
+  return steady_now_ms() - g_last_capture_activity_ms.load(std::memory_order_relaxed) >=
+         kBackgroundSyncQuietMs;
+}
 
 static std::uint64_t register_sync_transfer(const std::string &label,
                                             SDK::CrSlotNumber slot) {
@@ -264,29 +353,16 @@ static std::string contents_rating_to_string(SDK::CrContentsInfo_Rating rating)
   }
 }
 
-static bool contents_info_has_still_image(const SDK::CrContentsInfo& info) {
-  for (CrInt32u i = 0; i < info.filesNum; ++i) {
-    if (info.files[i].isImageParamExsist) return true;
-  }
-  return false;
-}
-
-static bool capture_date_equal(const SDK::CrCaptureDate &a,
-                               const SDK::CrCaptureDate &b) {
-  return a.year == b.year && a.month == b.month && a.day == b.day &&
-         a.hour == b.hour && a.minute == b.minute && a.sec == b.sec &&
-         a.msec == b.msec;
-}
-
-static bool capture_date_newer(const SDK::CrCaptureDate &a,
-                               const SDK::CrCaptureDate &b) {
-  if (a.year != b.year) return a.year > b.year;
-  if (a.month != b.month) return a.month > b.month;
-  if (a.day != b.day) return a.day > b.day;
-  if (a.hour != b.hour) return a.hour > b.hour;
-  if (a.minute != b.minute) return a.minute > b.minute;
-  if (a.sec != b.sec) return a.sec > b.sec;
-  return a.msec > b.msec;
+// Packs a capture date into an integer that orders chronologically.
+static std::uint64_t pack_capture_date(const SDK::CrCaptureDate &d) {
+  std::uint64_t v = d.year;
+  v = (v << 4) | (d.month & 0xF);
+  v = (v << 5) | (d.day & 0x1F);
+  v = (v << 5) | (d.hour & 0x1F);
+  v = (v << 6) | (d.minute & 0x3F);
+  v = (v << 6) | (d.sec & 0x3F);
+  v = (v << 10) | (d.msec & 0x3FF);
+  return v;
 }
 
 static std::string camera_mode_to_string(int mode_value) {
@@ -725,6 +801,8 @@ static int exposure_shutter_handler(SDK::CrDeviceHandle handle, bool verbose,
                                     const std::vector<std::string>& args, size_t start_index);
 static int exposure_comp_handler(SDK::CrDeviceHandle handle, bool verbose,
                                  const std::vector<std::string>& args, size_t start_index);
+static int exposure_list_handler(SDK::CrDeviceHandle handle, bool verbose,
+                                 const std::vector<std::string>& args, size_t start_index);
 static void log_exposure_usage();
 
 static constexpr const char* kExposureUsageShow = "usage: exposure show";
@@ -734,8 +812,9 @@ static constexpr const char* kExposureUsageIso = "usage: exposure iso [value]";
 static constexpr const char* kExposureUsageAperture = "usage: exposure aperture [f-number]";
 static constexpr const char* kExposureUsageShutter = "usage: exposure shutter [value]";
 static constexpr const char* kExposureUsageComp = "usage: exposure comp [value]";
+static constexpr const char* kExposureUsageList = "usage: exposure list <shutter|iso|aperture|comp>";
 
-static const std::array<ExposureSubcommand, 12> kExposureSubcommands = {{
+static const std::array<ExposureSubcommand, 13> kExposureSubcommands = {{
   {"show", kExposureUsageShow, 0, 0, &exposure_show_handler},
   {"mode", kExposureUsageMode, 0, kExposureUnlimitedArgs, &exposure_mode_handler},
   {"iso", kExposureUsageIso, 0, kExposureUnlimitedArgs, &exposure_iso_handler},
@@ -747,7 +826,8 @@ static const std::array<ExposureSubcommand, 12> kExposureSubcommands = {{
   {"speed", kExposureUsageShutter, 0, kExposureUnlimitedArgs, &exposure_shutter_handler},
   {"comp", kExposureUsageComp, 0, kExposureUnlimitedArgs, &exposure_comp_handler},
   {"compensation", kExposureUsageComp, 0, kExposureUnlimitedArgs, &exposure_comp_handler},
-  {"ev", kExposureUsageComp, 0, kExposureUnlimitedArgs, &exposure_comp_handler}
+  {"ev", kExposureUsageComp, 0, kExposureUnlimitedArgs, &exposure_comp_handler},
+  {"list", kExposureUsageList, 1, 1, &exposure_list_handler}
 }};
 
 static const ExposureSubcommand* find_exposure_subcommand(const std::string& key) {
@@ -1026,6 +1106,19 @@ struct PropertyValue {
   std::string text;
 };
 
+static PropertyValue property_value_from(SDK::CrDeviceProperty &prop) {
+  PropertyValue out;
+  const auto flag = prop.GetPropertyEnableFlag();
+  if (flag != SDK::CrEnableValue_NotSupported && flag != SDK::CrEnableValue_False) {
+    out.supported = true;
+    out.value = prop.GetCurrentValue();
+    if (prop.GetValueType() == SDK::CrDataType::CrDataType_STR) {
+      out.text = decode_cr_string(prop.GetCurrentStr());
+    }
+  }
+  return out;
+}
+
 static PropertyValue fetch_property(SDK::CrDeviceHandle handle, CrInt32u code) {
   PropertyValue out;
   SDK::CrDeviceProperty* props = nullptr;
@@ -1034,15 +1127,337 @@ static PropertyValue fetch_property(SDK::CrDeviceHandle handle, CrInt32u code) {
   if (err != SDK::CrError_None || count <= 0 || !props) {
     return out;
   }
-  const auto flag = props[0].GetPropertyEnableFlag();
-  if (flag != SDK::CrEnableValue_NotSupported && flag != SDK::CrEnableValue_False) {
-    out.supported = true;
-    out.value = props[0].GetCurrentValue();
-    if (props[0].GetValueType() == SDK::CrDataType::CrDataType_STR) {
-      out.text = decode_cr_string(props[0].GetCurrentStr());
+  out = property_value_from(props[0]);
+  SDK::ReleaseDeviceProperties(handle, props);
+  return out;
+}
+
+// Values for several codes, requested in one GetSelectDeviceProperties call.
+struct PropertyBatch {
+  std::unordered_map<CrInt32u, PropertyValue> values;
+
+  const PropertyValue &get(CrInt32u code) const {
+    static const PropertyValue kMissing{};
+    auto it = values.find(code);
+    return it == values.end() ? kMissing : it->second;
+  }
+};
+
+static PropertyBatch fetch_properties(SDK::CrDeviceHandle handle,
+                                      const std::vector<CrInt32u> &codes) {
+  PropertyBatch out;
+  if (codes.empty()) return out;
+  std::vector<CrInt32u> request(codes);
+  SDK::CrDeviceProperty* props = nullptr;
+  CrInt32 count = 0;
+  auto err = SDK::GetSelectDeviceProperties(handle, static_cast<CrInt32u>(request.size()),
+                                            request.data(), &props, &count);
+  if (err != SDK::CrError_None || !props) {
+    // Some bodies reject large selections; degrade to one request per code.
+    for (CrInt32u code : codes) out.values[code] = fetch_property(handle, code);
+    return out;
+  }
+  out.values.reserve(static_cast<std::size_t>(std::max<CrInt32>(count, 0)));
+  for (CrInt32 i = 0; i < count; ++i) {
+    out.values[props[i].GetCode()] = property_value_from(props[i]);
+  }
+  SDK::ReleaseDeviceProperties(handle, props);
+  return out;
+}
+
+// ----------------------------
+// Supported value tables
+// ----------------------------
+// For the exposure properties the body lists the values it will accept
+// right now (GetSetValues, falling back to GetValues). Every property pull
+// refreshes these tables, so inputs can be checked and snapped to the
+// nearest legal value locally instead of finding out from a failed
+// SetDeviceProperty.
+struct ValueTable {
+  std::vector<CrInt8u> raw;      // descriptor bytes, to skip re-decoding unchanged lists
+  std::vector<CrInt64u> values;  // zero-extended to the element width
+};
+
+static std::mutex g_value_table_mtx;
+static std::unordered_map<CrInt32u, ValueTable> g_value_tables;
+
+// Position on a linear scale (stops, or EV for compensation); false for
+// values like auto or bulb that only match themselves.
+using ValueScaleFn = bool (*)(CrInt64u, double &);
+
+struct ExposureValueKind {
+  const char *name;
+  CrInt32u code;
+  CrInt64u mask;        // width of the reported value
+  CrInt64u group_mask;  // candidates must agree on these bits (ISO extension modes)
+  ValueScaleFn scale;
+  std::string (*format)(CrInt64u);
+};
+
+static bool shutter_scale(CrInt64u raw, double &out) {
+  const CrInt32u v = static_cast<CrInt32u>(raw);
+  const CrInt32u num = v >> 16, den = v & 0xFFFFu;
+  if (v == SDK::CrShutterSpeed_Bulb || num == 0 || den == 0) return false;
+  out = std::log2(static_cast<double>(num) / den);
+  return true;
+}
+
+static bool iso_scale(CrInt64u raw, double &out) {
+  const CrInt32u v = static_cast<CrInt32u>(raw) & 0x00FFFFFFu;
+  if (v == 0 || v == (static_cast<CrInt32u>(SDK::CrISO_AUTO) & 0x00FFFFFFu)) return false;
+  out = std::log2(static_cast<double>(v));
+  return true;
+}
+
+static bool fnumber_scale(CrInt64u raw, double &out) {
+  const CrInt32u v = static_cast<CrInt32u>(raw & 0xFFFFu);
+  if (v == 0 || v >= 0xFFFDu) return false;  // unknown / no lens
+  out = 2.0 * std::log2(v / 100.0);
+  return true;
+}
+
+static bool comp_scale(CrInt64u raw, double &out) {
+  out = static_cast<CrInt16>(static_cast<CrInt16u>(raw & 0xFFFFu)) / 1000.0;
+  return true;
+}
+
+static const ExposureValueKind kExposureValueKinds[] = {
+  {"shutter", SDK::CrDevicePropertyCode::CrDeviceProperty_ShutterSpeed, 0xFFFFFFFFull, 0, shutter_scale,
+   format_shutter_speed},
+  {"iso", SDK::CrDevicePropertyCode::CrDeviceProperty_IsoSensitivity, 0xFFFFFFFFull, 0xFF000000ull, iso_scale,
+   format_iso_value},
+  {"aperture", SDK::CrDevicePropertyCode::CrDeviceProperty_FNumber, 0xFFFFull, 0, fnumber_scale, format_f_number},
+  {"comp", SDK::CrDevicePropertyCode::CrDeviceProperty_ExposureBiasCompensation, 0xFFFFull, 0, comp_scale,
+   format_exposure_compensation},
+};
+
+static const ExposureValueKind *exposure_value_kind(CrInt32u code) {
+  for (auto const &k : kExposureValueKinds) {
+    if (k.code == code) return &k;
+  }
+  return nullptr;
+}
+
+// Accepts the same aliases as the exposure subcommands.
+static const ExposureValueKind *exposure_value_kind(const std::string &raw) {
+  std::string key = to_lower_ascii(raw);
+  if (key == "speed") key = "shutter";
+  else if (key == "sensitivity") key = "iso";
+  else if (key == "f" || key == "fnumber") key = "aperture";
+  else if (key == "ev" || key == "compensation") key = "comp";
+  for (auto const &k : kExposureValueKinds) {
+    if (key == k.name) return &k;
+  }
+  return nullptr;
+}
+
+static void decode_value_table(CrInt32u type, const std::vector<CrInt8u> &raw, std::vector<CrInt64u> &out) {
+  out.clear();
+  std::size_t width = 0;
+  switch (type & 0x0FFFu) {
+    case SDK::CrDataType_UInt8: width = 1; break;
+    case SDK::CrDataType_UInt16: width = 2; break;
+    case SDK::CrDataType_UInt32: width = 4; break;
+    case SDK::CrDataType_UInt64: width = 8; break;
+    default: return;
+  }
+  const bool is_signed = (type & SDK::CrDataType_SignBit) != 0;
+  const CrInt64u mask = width == 8 ? ~0ull : ((1ull << (8 * width)) - 1);
+  auto element = [&](std::size_t i) -> std::int64_t {
+    CrInt64u v = 0;
+    std::memcpy(&v, raw.data() + i * width, width);  // little-endian, like the SDK
+    if (is_signed && width < 8 && (v >> (8 * width - 1)) & 1u) v |= ~mask;
+    return static_cast<std::int64_t>(v);
+  };
+  const std::size_t n = raw.size() / width;
+  if ((type & SDK::CrDataType_RangeBit) != 0) {
+    // min, max, step
+    if (n < 3) return;
+    const std::int64_t lo = element(0), hi = element(1), step = element(2);
+    if (step <= 0 || hi < lo || (hi - lo) / step > 4096) return;
+    for (std::int64_t v = lo; v <= hi; v += step) out.push_back(static_cast<CrInt64u>(v) & mask);
+    return;
+  }
+  out.reserve(n);
+  for (std::size_t i = 0; i < n; ++i) out.push_back(static_cast<CrInt64u>(element(i)) & mask);
+}
+
+// Called for every property in a pull; cheap unless the list itself changed.
+static void note_value_table(SDK::CrDeviceProperty &prop) {
+  const CrInt32u code = prop.GetCode();
+  if (!exposure_value_kind(code)) return;
+  const CrInt8u *data = prop.GetSetValues();
+  CrInt32u size = prop.GetSetValueSize();
+  if (!data || size == 0) {
+    data = prop.GetValues();
+    size = prop.GetValueSize();
+  }
+  std::lock_guard<std::mutex> lk(g_value_table_mtx);
+  if (!data || size == 0) {
+    g_value_tables.erase(code);
+    return;
+  }
+  ValueTable &table = g_value_tables[code];
+  if (table.raw.size() == size && std::equal(table.raw.begin(), table.raw.end(), data)) return;
+  table.raw.assign(data, data + size);
+  decode_value_table(static_cast<CrInt32u>(prop.GetValueType()), table.raw, table.values);
+}
+
+static std::vector<CrInt64u> supported_values(CrInt32u code) {
+  std::lock_guard<std::mutex> lk(g_value_table_mtx);
+  auto it = g_value_tables.find(code);
+  return it == g_value_tables.end() ? std::vector<CrInt64u>() : it->second.values;
+}
+
+static void clear_value_tables() {
+  std::lock_guard<std::mutex> lk(g_value_table_mtx);
+  g_value_tables.clear();
+}
+
+// ----------------------------
+// Property cache
+// ----------------------------
+// Immutable snapshot of every property the body reported, rebuilt from the
+// full property pull that OnPropertyChanged/OnLvPropertyChanged already do
+// and published RCU-style: readers grab the current pointer and never block
+// or touch the camera. Values live in a flat array indexed by the generated
+// property slot; `changed` marks the slots that moved since the previous
+// snapshot so consumers can skip everything else.
+using PropertyBits = std::bitset<PROP_SLOT_COUNT>;
+
+struct PropertySnapshot {
+  std::vector<PropertyValue> slots = std::vector<PropertyValue>(PROP_SLOT_COUNT);
+  // Codes newer than the SDK header the slot table was generated from.
+  std::unordered_map<CrInt32u, PropertyValue> extra;
+  PropertyBits changed;
+  std::uint64_t generation = 0;
+  std::chrono::steady_clock::time_point taken_at{};
+
+  const PropertyValue &get(CrInt32u code) const {
+    static const PropertyValue kMissing{};
+    int slot = crsdk_util::prop_code_to_slot(code);
+    if (slot >= 0) return slots[static_cast<std::size_t>(slot)];
+    auto it = extra.find(code);
+    return it == extra.end() ? kMissing : it->second;
+  }
+
+  bool moved(CrInt32u code) const {
+    int slot = crsdk_util::prop_code_to_slot(code);
+    return slot >= 0 && changed.test(static_cast<std::size_t>(slot));
+  }
+};
+
+static std::shared_ptr<const PropertySnapshot> g_property_snapshot;
+static std::atomic<std::uint64_t> g_property_generation{0};
+// Signalled on every publish so callers can wait for the camera to report a state.
+static std::mutex g_property_publish_mtx;
+static std::condition_variable g_property_publish_cv;
+
+// Property callbacks only mark the cache dirty; one refresher thread pulls
+// the full set at most g_prop_rate_hz times a second (0 = no cap).
+static std::atomic<int> g_prop_rate_hz{20};
+
+struct PropertyRefreshMetrics {
+  std::atomic<std::uint64_t> callbacks{0};
+  std::atomic<std::uint64_t> refreshes{0};
+  std::atomic<std::uint64_t> total_us{0};
+  std::atomic<std::uint64_t> max_us{0};
+};
+static PropertyRefreshMetrics g_prop_refresh_metrics;
+
+static std::shared_ptr<const PropertySnapshot> property_snapshot() {
+  return std::atomic_load_explicit(&g_property_snapshot, std::memory_order_acquire);
+}
+
+static std::uint64_t property_generation() {
+  auto snap = property_snapshot();
+  return snap ? snap->generation : 0;
+}
+
+static void publish_property_snapshot(SDK::CrDeviceProperty *props, CrInt32 count,
+                                      const PropertyBits &changed) {
+  auto snap = std::make_shared<PropertySnapshot>();
+  for (CrInt32 i = 0; i < count; ++i) {
+    CrInt32u code = props[i].GetCode();
+    int slot = crsdk_util::prop_code_to_slot(code);
+    note_value_table(props[i]);
+    if (slot >= 0) {
+      snap->slots[static_cast<std::size_t>(slot)] = property_value_from(props[i]);
+    } else {
+      snap->extra[code] = property_value_from(props[i]);
+    }
+  }
+  snap->changed = changed;
+  snap->generation = g_property_generation.fetch_add(1, std::memory_order_relaxed) + 1;
+  snap->taken_at = std::chrono::steady_clock::now();
+  std::atomic_store_explicit(&g_property_snapshot,
+                             std::shared_ptr<const PropertySnapshot>(std::move(snap)),
+                             std::memory_order_release);
+  { std::lock_guard<std::mutex> lk(g_property_publish_mtx); }
+  g_property_publish_cv.notify_all();
+}
+
+// Waits for a snapshot published after `after_generation` that satisfies
+// `pred`; nullptr on timeout. Resolution is bounded by --prop-rate.
+static std::shared_ptr<const PropertySnapshot> wait_for_property_snapshot(
+    std::uint64_t after_generation, std::chrono::steady_clock::time_point deadline,
+    const std::function<bool(const PropertySnapshot &)> &pred) {
+  std::shared_ptr<const PropertySnapshot> hit;
+  auto done = [&] {
+    auto snap = property_snapshot();
+    if (snap && snap->generation > after_generation && pred(*snap)) {
+      hit = std::move(snap);
+      return true;
     }
+    return g_stop.load(std::memory_order_relaxed) || g_reconnect.load(std::memory_order_relaxed);
+  };
+  // Sliced: a disconnect stops the publishes that would otherwise wake us.
+  std::unique_lock<std::mutex> lk(g_property_publish_mtx);
+  while (!done()) {
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) break;
+    g_property_publish_cv.wait_until(lk, std::min(deadline, now + std::chrono::milliseconds(100)));
   }
+  return hit;
+}
+
+static void clear_property_snapshot() {
+  clear_value_tables();
+  std::atomic_store_explicit(&g_property_snapshot, std::shared_ptr<const PropertySnapshot>(),
+                             std::memory_order_release);
+}
+
+// Explicit refresh for callers that need strict freshness: one full pull.
+// Without a diff to go on, every slot counts as moved.
+static bool refresh_property_cache(SDK::CrDeviceHandle handle) {
+  if (!handle) return false;
+  SDK::CrDeviceProperty *props = nullptr;
+  CrInt32 count = 0;
+  auto err = SDK::GetDeviceProperties(handle, &props, &count);
+  if (err != SDK::CrError_None || count <= 0 || !props) return false;
+  publish_property_snapshot(props, count, PropertyBits().set());
   SDK::ReleaseDeviceProperties(handle, props);
+  return true;
+}
+
+// Cached read; only falls back to a camera round trip before the first
+// snapshot of the session exists.
+static PropertyValue cached_property(SDK::CrDeviceHandle handle, CrInt32u code) {
+  auto snap = property_snapshot();
+  if (!snap) return fetch_property(handle, code);
+  return snap->get(code);
+}
+
+// Everything hook mode resolution needs: from the cache when there is one,
+// otherwise in a single batched request.
+static PropertyBatch mode_properties(SDK::CrDeviceHandle handle) {
+  static const std::vector<CrInt32u> kCodes = {
+      SDK::CrDeviceProperty_CameraOperatingMode, SDK::CrDeviceProperty_MovieShootingMode,
+      SDK::CrDeviceProperty_SQModeSetting, SDK::CrDeviceProperty_ExposureProgramMode};
+  auto snap = property_snapshot();
+  if (!snap) return fetch_properties(handle, kCodes);
+  PropertyBatch out;
+  for (CrInt32u code : kCodes) out.values.emplace(code, snap->get(code));
   return out;
 }
 
@@ -1057,6 +1472,18 @@ static std::atomic<std::uint64_t>& last_contents_update_marker(SDK::CrSlotNumber
                                            : g_last_contents_update_slot1;
 }
 
+static ReconcileState& reconcile_state(SDK::CrSlotNumber slot) {
+  return (slot == SDK::CrSlotNumber_Slot2) ? g_reconcile_slot2 : g_reconcile_slot1;
+}
+
+static void note_newest_capture(SDK::CrSlotNumber slot, std::uint64_t packed) {
+  auto &newest = reconcile_state(slot).newest_capture;
+  std::uint64_t cur = newest.load(std::memory_order_relaxed);
+  while (packed > cur &&
+         !newest.compare_exchange_weak(cur, packed, std::memory_order_relaxed)) {
+  }
+}
+
 static std::uint64_t wait_for_contents_list_refresh(SDK::CrDeviceHandle handle,
                                                     SDK::CrSlotNumber slot,
                                                     bool verbose,
@@ -1093,26 +1520,24 @@ static std::uint64_t wait_for_contents_list_refresh(SDK::CrDeviceHandle handle,
   return update_time;
 }
 
-static std::string capture_mode_string(SDK::CrDeviceHandle handle,
-                                       const SDK::CrContentsInfo &info,
-                                       const SDK::CrContentsFile &file) {
-  (void)info;
-  auto mode_prop = fetch_property(handle, SDK::CrDeviceProperty_CameraOperatingMode);
+static std::string capture_mode_string(SDK::CrDeviceHandle handle, bool movie_file) {
+  const PropertyBatch props = mode_properties(handle);
+  const auto &mode_prop = props.get(SDK::CrDeviceProperty_CameraOperatingMode);
   int mode_value = mode_prop.supported
                        ? static_cast<int>(mode_prop.value & 0xFFFF)
                        : static_cast<int>(SDK::CrCameraOperatingMode_Record);
   std::string base = camera_mode_to_string(mode_value);
 
-  if (is_movie_file(file)) {
+  if (movie_file) {
     std::string detail = "movie";
-    auto movie_mode = fetch_property(handle, SDK::CrDeviceProperty_MovieShootingMode);
+    const auto &movie_mode = props.get(SDK::CrDeviceProperty_MovieShootingMode);
     if (movie_mode.supported) {
       std::string movie_token = movie_mode_to_string(movie_mode.value);
       if (!movie_token.empty() && movie_token != "photo") {
         detail += "/" + movie_token;
       }
     }
-    auto sq_mode = fetch_property(handle, SDK::CrDeviceProperty_SQModeSetting);
+    const auto &sq_mode = props.get(SDK::CrDeviceProperty_SQModeSetting);
     if (sq_mode.supported) {
       std::string sq = sq_mode_token(sq_mode.value);
       if (!sq.empty()) detail += "/" + sq;
@@ -1121,7 +1546,7 @@ static std::string capture_mode_string(SDK::CrDeviceHandle handle,
   }
 
   std::string detail = "still";
-  auto exposure_mode = fetch_property(handle, SDK::CrDeviceProperty_ExposureProgramMode);
+  const auto &exposure_mode = props.get(SDK::CrDeviceProperty_ExposureProgramMode);
   if (exposure_mode.supported) {
     std::string exp_code = exposure_program_code(exposure_mode.value);
     if (!exp_code.empty()) detail += "/" + exp_code;
@@ -1130,13 +1555,14 @@ static std::string capture_mode_string(SDK::CrDeviceHandle handle,
 }
 
 static std::string current_mode_string(SDK::CrDeviceHandle handle) {
-  auto mode_prop = fetch_property(handle, SDK::CrDeviceProperty_CameraOperatingMode);
+  const PropertyBatch props = mode_properties(handle);
+  const auto &mode_prop = props.get(SDK::CrDeviceProperty_CameraOperatingMode);
   int mode_value = mode_prop.supported ? static_cast<int>(mode_prop.value & 0xFFFF) : -1;
   std::string base = camera_mode_to_string(mode_value);
 
   if (mode_value == SDK::CrCameraOperatingMode_Record) {
     std::string detail;
-    auto movie_mode = fetch_property(handle, SDK::CrDeviceProperty_MovieShootingMode);
+    const auto &movie_mode = props.get(SDK::CrDeviceProperty_MovieShootingMode);
     if (movie_mode.supported) {
       std::string movie_token = movie_mode_to_string(movie_mode.value);
       if (!movie_token.empty() && movie_token != "photo") {
@@ -1144,7 +1570,7 @@ static std::string current_mode_string(SDK::CrDeviceHandle handle) {
       }
     }
 
-    auto sq_mode = fetch_property(handle, SDK::CrDeviceProperty_SQModeSetting);
+    const auto &sq_mode = props.get(SDK::CrDeviceProperty_SQModeSetting);
     if (sq_mode.supported) {
       std::string sq = sq_mode_token(sq_mode.value);
       if (!sq.empty()) {
@@ -1161,6 +1587,187 @@ static std::string current_mode_string(SDK::CrDeviceHandle handle) {
   return base;
 }
 
+// ----------------------------
+// Contents index
+// ----------------------------
+// Owned structure-of-arrays copy of one slot's contents list. The SDK array is
+// released as soon as it has been copied, so long syncs no longer pin it and
+// the immutable index can be shared between workers.
+struct ContentsIndex {
+  enum FileFlag : std::uint8_t { kFileHasImageParams = 1, kFileIsMovie = 2 };
+
+  SDK::CrSlotNumber slot = SDK::CrSlotNumber_Slot1;
+  std::vector<CrInt32u> content_ids;
+  std::vector<std::uint64_t> dates;       // pack_capture_date(modificationDatetimeUTC)
+  std::vector<std::int8_t> ratings;       // contents_rating_to_int()
+  std::vector<std::uint32_t> file_begin{0}; // item i owns files [file_begin[i], file_begin[i + 1])
+  std::vector<CrInt32u> file_ids;
+  std::vector<std::uint8_t> file_flags;
+  std::vector<std::uint32_t> file_dir;    // index into dirs
+  std::vector<std::uint32_t> file_name;   // offset of the NUL-terminated basename in names
+  std::vector<std::string> dirs;          // interned directory prefixes, separator included
+  std::string names;
+
+  std::size_t size() const { return content_ids.size(); }
+  std::size_t files_begin(std::size_t item) const { return file_begin[item]; }
+  std::size_t files_end(std::size_t item) const { return file_begin[item + 1]; }
+  const char *file_basename(std::size_t f) const { return names.c_str() + file_name[f]; }
+  std::string file_path(std::size_t f) const { return dirs[file_dir[f]] + file_basename(f); }
+  bool file_has_image_params(std::size_t f) const { return file_flags[f] & kFileHasImageParams; }
+  bool file_is_movie(std::size_t f) const { return file_flags[f] & kFileIsMovie; }
+
+  bool has_still_image(std::size_t item) const {
+    for (std::size_t f = files_begin(item); f < files_end(item); ++f) {
+      if (file_has_image_params(f)) return true;
+    }
+    return false;
+  }
+};
+
+static std::mutex g_contents_index_mtx;
+static std::shared_ptr<const ContentsIndex> g_contents_index_slot1;
+static std::shared_ptr<const ContentsIndex> g_contents_index_slot2;
+
+static std::shared_ptr<ContentsIndex> build_contents_index(SDK::CrSlotNumber slot,
+                                                           const SDK::CrContentsInfo *list,
+                                                           CrInt32u count) {
+  auto index = std::make_shared<ContentsIndex>();
+  index->slot = slot;
+  index->content_ids.reserve(count);
+  index->dates.reserve(count);
+  index->ratings.reserve(count);
+  index->file_begin.reserve(count + 1);
+
+  std::unordered_map<std::string, std::uint32_t> dir_ids;
+  for (CrInt32u i = 0; i < count; ++i) {
+    const SDK::CrContentsInfo &info = list[i];
+    index->content_ids.push_back(info.contentId);
+    index->dates.push_back(pack_capture_date(info.modificationDatetimeUTC));
+    index->ratings.push_back(static_cast<std::int8_t>(contents_rating_to_int(info.rating)));
+    for (CrInt32u fi = 0; fi < info.filesNum; ++fi) {
+      const SDK::CrContentsFile &file = info.files[fi];
+      std::uint8_t flags = 0;
+      if (file.isImageParamExsist) flags |= ContentsIndex::kFileHasImageParams;
+      if (is_movie_file(file)) flags |= ContentsIndex::kFileIsMovie;
+      index->file_ids.push_back(file.fileId);
+      index->file_flags.push_back(flags);
+
+      std::string path = file.filePath ? reinterpret_cast<const char *>(file.filePath) : "";
+      std::size_t cut = path.find_last_of("/\\");
+      cut = (cut == std::string::npos) ? 0 : cut + 1;
+      auto dir = dir_ids.emplace(path.substr(0, cut), static_cast<std::uint32_t>(index->dirs.size()));
+      if (dir.second) index->dirs.push_back(dir.first->first);
+      index->file_dir.push_back(dir.first->second);
+      index->file_name.push_back(static_cast<std::uint32_t>(index->names.size()));
+      index->names.append(path, cut, std::string::npos);
+      index->names.push_back('\0');
+    }
+    index->file_begin.push_back(static_cast<std::uint32_t>(index->file_ids.size()));
+  }
+  return index;
+}
+
+static std::shared_ptr<const ContentsIndex> cached_contents_index(SDK::CrSlotNumber slot) {
+  std::lock_guard<std::mutex> lk(g_contents_index_mtx);
+  return (slot == SDK::CrSlotNumber_Slot2) ? g_contents_index_slot2 : g_contents_index_slot1;
+}
+
+static std::shared_ptr<const ContentsIndex> list_contents(SDK::CrDeviceHandle handle,
+                                                          SDK::CrSlotNumber slot,
+                                                          SDK::CrGetContentsInfoListType type,
+                                                          SDK::CrCaptureDate date) {
+  SDK::CrContentsInfo *list = nullptr;
+  CrInt32u count = 0;
+  SDK::CrError err = SDK::GetRemoteTransferContentsInfoList(
+      handle, slot, type, &date, 0, &list, &count);
+  if (err != SDK::CrError_None || !list) {
+    if (list) SDK::ReleaseRemoteTransferContentsInfoList(handle, list);
+    return nullptr;
+  }
+  std::shared_ptr<const ContentsIndex> index = build_contents_index(slot, list, count);
+  SDK::ReleaseRemoteTransferContentsInfoList(handle, list);
+  return index;
+}
+
+// Fetches the full list for a slot, copies it into an index, releases the SDK
+// array immediately and publishes the index for other readers.
+static std::shared_ptr<const ContentsIndex> fetch_contents_index(SDK::CrDeviceHandle handle,
+                                                                 SDK::CrSlotNumber slot) {
+  auto index = list_contents(handle, slot, SDK::CrGetContentsInfoListType_All, SDK::CrCaptureDate{});
+  if (!index) return nullptr;
+
+  std::lock_guard<std::mutex> lk(g_contents_index_mtx);
+  (slot == SDK::CrSlotNumber_Slot2 ? g_contents_index_slot2 : g_contents_index_slot1) = index;
+  return index;
+}
+
+// Days that hold contents on a slot, oldest first. Returns false when the body
+// does not provide the captured-date index.
+static bool fetch_capture_days(SDK::CrDeviceHandle handle, SDK::CrSlotNumber slot,
+                               std::vector<SDK::CrCaptureDate> &days) {
+  SDK::CrCaptureDate *list = nullptr;
+  CrInt32u count = 0;
+  SDK::CrError err = SDK::GetRemoteTransferCapturedDateList(handle, slot, &list, &count);
+  if (err != SDK::CrError_None || !list) {
+    if (list) SDK::ReleaseRemoteTransferCapturedDateList(handle, list);
+    return false;
+  }
+  days.assign(list, list + count);
+  SDK::ReleaseRemoteTransferCapturedDateList(handle, list);
+  std::sort(days.begin(), days.end(), [](const SDK::CrCaptureDate &a, const SDK::CrCaptureDate &b) {
+    return pack_capture_date(a) < pack_capture_date(b);
+  });
+  return true;
+}
+
+constexpr int kContentsListAttempts = 3;
+
+// One day's listing, retried briefly: the SDK reports busy while a transfer
+// is finishing.
+static std::shared_ptr<const ContentsIndex> list_contents_day(SDK::CrDeviceHandle handle,
+                                                              SDK::CrSlotNumber slot,
+                                                              SDK::CrCaptureDate day) {
+  for (int attempt = 1;; ++attempt) {
+    auto index = list_contents(handle, slot, SDK::CrGetContentsInfoListType_Range_Day, day);
+    if (index || attempt == kContentsListAttempts || g_stop.load(std::memory_order_relaxed)) return index;
+    std::this_thread::sleep_for(std::chrono::milliseconds(250 * attempt));
+  }
+}
+
+// Streams a slot's contents one capture day at a time so planning and
+// transfers start as soon as the first day is listed. Days are listed on the
+// caller's thread between visits, never alongside a transfer on the same
+// handle. Visitors return false to stop. Bodies without a day index get a
+// single full listing instead. Returns false if a listing still failed after
+// retries; the walk stops there and callers must not treat it as complete.
+static bool for_each_contents_day(SDK::CrDeviceHandle handle,
+                                  SDK::CrSlotNumber slot,
+                                  bool newest_first,
+                                  const std::function<bool(const std::shared_ptr<const ContentsIndex> &)> &visit) {
+  auto visit_full_listing = [&]() {
+    auto index = fetch_contents_index(handle, slot);
+    if (!index) return false;
+    visit(index);
+    return true;
+  };
+
+  std::vector<SDK::CrCaptureDate> days;
+  if (!fetch_capture_days(handle, slot, days) || days.empty()) {
+    return visit_full_listing();
+  }
+  if (newest_first) std::reverse(days.begin(), days.end());
+
+  for (std::size_t d = 0; d < days.size(); ++d) {
+    auto index = list_contents_day(handle, slot, days[d]);
+    if (!index) {
+      if (d == 0) return visit_full_listing();
+      return false;  // never skip a day: later days would look complete without it
+    }
+    if (index->size() > 0 && !visit(index)) break;
+  }
+  return true;
+}
+
 struct StatusSnapshot {
   std::string model = "--";
   std::string lens = "--";
@@ -1184,38 +1791,68 @@ struct StatusSnapshot {
   std::string movie_setting = "--";
   std::string movie_media = "--";
   std::string recording_state = "--";
+  std::string exposure_comp = "--";
 };
 
 static bool collect_status_snapshot(SDK::CrDeviceHandle handle, StatusSnapshot& snap, bool verbose) {
+  (void)verbose;
   bool any = false;
 
+  static const std::vector<CrInt32u> kStatusCodes = {
+    SDK::CrDevicePropertyCode::CrDeviceProperty_ModelName,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_LensModelName,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_BodySerialNumber,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_FNumber,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_ShutterSpeed,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_IsoSensitivity,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_IsoCurrentSensitivity,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_ExposureProgramMode,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_DriveMode,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_FocusMode,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_FocusArea,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_WhiteBalance,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_ImageStabilizationSteadyShot,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_Movie_ImageStabilizationSteadyShot,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_SilentMode,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_ShutterType,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_MovieShootingMode,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_Movie_Recording_Setting,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_Movie_RecordingMedia,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_RecordingState,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_FocusBracketShotNumber,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_FocusBracketFocusRange,
+    SDK::CrDevicePropertyCode::CrDeviceProperty_ExposureBiasCompensation,
+  };
+  const PropertyBatch batch = fetch_properties(handle, kStatusCodes);
+
   auto assign_formatted = [&](CrInt32u code, auto formatter, std::string& target) {
-    PropertyValue p = fetch_property(handle, code);
+    const PropertyValue& p = batch.get(code);
     if (!p.supported) return;
     target = formatter(p.value);
     any = true;
   };
 
-  PropertyValue model = fetch_property(handle, SDK::CrDevicePropertyCode::CrDeviceProperty_ModelName);
+  const PropertyValue& model = batch.get(SDK::CrDevicePropertyCode::CrDeviceProperty_ModelName);
   if (model.supported && !model.text.empty()) { snap.model = model.text; any = true; }
 
-  PropertyValue lens = fetch_property(handle, SDK::CrDevicePropertyCode::CrDeviceProperty_LensModelName);
+  const PropertyValue& lens = batch.get(SDK::CrDevicePropertyCode::CrDeviceProperty_LensModelName);
   if (lens.supported && !lens.text.empty()) { snap.lens = lens.text; any = true; }
 
-  PropertyValue serial = fetch_property(handle, SDK::CrDevicePropertyCode::CrDeviceProperty_BodySerialNumber);
+  const PropertyValue& serial = batch.get(SDK::CrDevicePropertyCode::CrDeviceProperty_BodySerialNumber);
   if (serial.supported && !serial.text.empty()) { snap.serial = serial.text; any = true; }
 
   assign_formatted(SDK::CrDevicePropertyCode::CrDeviceProperty_FNumber, format_f_number, snap.f_number);
   assign_formatted(SDK::CrDevicePropertyCode::CrDeviceProperty_ShutterSpeed, format_shutter_speed, snap.shutter);
   assign_formatted(SDK::CrDevicePropertyCode::CrDeviceProperty_IsoSensitivity, format_iso_value, snap.iso);
 
-  PropertyValue iso_actual = fetch_property(handle, SDK::CrDevicePropertyCode::CrDeviceProperty_IsoCurrentSensitivity);
+  const PropertyValue& iso_actual = batch.get(SDK::CrDevicePropertyCode::CrDeviceProperty_IsoCurrentSensitivity);
   if (iso_actual.supported) {
     snap.iso_actual = format_iso_current(iso_actual.value);
     any = true;
   }
 
   assign_formatted(SDK::CrDevicePropertyCode::CrDeviceProperty_ExposureProgramMode, exposure_program_to_string, snap.exposure_program);
+  assign_formatted(SDK::CrDevicePropertyCode::CrDeviceProperty_ExposureBiasCompensation, format_exposure_compensation, snap.exposure_comp);
   assign_formatted(SDK::CrDevicePropertyCode::CrDeviceProperty_DriveMode, drive_mode_to_string, snap.drive_mode);
   assign_formatted(SDK::CrDevicePropertyCode::CrDeviceProperty_FocusMode, focus_mode_to_string, snap.focus_mode);
   assign_formatted(SDK::CrDevicePropertyCode::CrDeviceProperty_FocusArea, focus_area_to_string, snap.focus_area);
@@ -1228,18 +1865,18 @@ static bool collect_status_snapshot(SDK::CrDeviceHandle handle, StatusSnapshot&
   assign_formatted(SDK::CrDevicePropertyCode::CrDeviceProperty_Movie_Recording_Setting, movie_recording_setting_to_string, snap.movie_setting);
   assign_formatted(SDK::CrDevicePropertyCode::CrDeviceProperty_Movie_RecordingMedia, movie_media_to_string, snap.movie_media);
 
-  PropertyValue rec_state = fetch_property(handle, SDK::CrDevicePropertyCode::CrDeviceProperty_RecordingState);
+  const PropertyValue& rec_state = batch.get(SDK::CrDevicePropertyCode::CrDeviceProperty_RecordingState);
   if (rec_state.supported) {
     snap.recording_state = movie_recording_state_to_string(static_cast<SDK::CrMovie_Recording_State>(static_cast<CrInt16u>(rec_state.value)));
     any = true;
   }
 
-  PropertyValue bracket_shots = fetch_property(handle, SDK::CrDevicePropertyCode::CrDeviceProperty_FocusBracketShotNumber);
+  const PropertyValue& bracket_shots = batch.get(SDK::CrDevicePropertyCode::CrDeviceProperty_FocusBracketShotNumber);
   if (bracket_shots.supported) {
     snap.focus_bracket_shots = focus_bracket_shots_to_string(bracket_shots.value);
     any = true;
   }
-  PropertyValue bracket_range = fetch_property(handle, SDK::CrDevicePropertyCode::CrDeviceProperty_FocusBracketFocusRange);
+  const PropertyValue& bracket_range = batch.get(SDK::CrDevicePropertyCode::CrDeviceProperty_FocusBracketFocusRange);
   if (bracket_range.supported) {
     snap.focus_bracket_range = focus_bracket_range_to_string(bracket_range.value);
     any = true;
@@ -1323,10 +1960,6 @@ static unsigned char repl_trigger_shoot(EditLine* el, int) {
 // ----------------------------
 enum class LogLevel { Info, Warn, Error, Debug };
 
-struct LogItem {
-  LogLevel level;
-  std::string text;
-};
 static bool g_stdout_is_tty = isatty(STDOUT_FILENO);
 static bool g_stderr_is_tty = isatty(STDERR_FILENO);
 
@@ -1371,15 +2004,167 @@ static inline void write_log_line(LogLevel lvl, const std::string& text, std::os
   }
 }
 
-static std::mutex        g_log_mtx;
-static std::condition_variable g_log_cv;
-static std::deque<LogItem> g_log_q;
+// Optional structured fields attached to a message. Only the --log-file sink
+// records them; the console shows the formatted text as before. `event` must
+// be a string literal.
+struct LogFields {
+  const char *event = nullptr;
+  std::string_view file;
+  long long bytes = -1;
+  long long ms = -1;
+  long long code = -1;  // SDK error/warning/notify code
 
-// Enqueue a message from any thread.
-static inline void log_enqueue(LogLevel lvl, std::string msg) {
+  LogFields &ev(const char *e) { event = e; return *this; }
+  LogFields &with_file(std::string_view f) { file = f; return *this; }
+  LogFields &with_bytes(long long b) { bytes = b; return *this; }
+  LogFields &with_ms(long long m) { ms = m; return *this; }
+  LogFields &with_code(long long c) { code = c; return *this; }
+};
+
+// Log ring: a preallocated bounded MPSC queue (Vyukov-style sequence per slot).
+// Producers claim a slot with one CAS and never wait; when the ring is full the
+// message is counted in g_log_dropped and discarded, so SDK callback threads
+// can't stall behind a slow terminal. Each ring has exactly one consumer: the
+// input thread for the console, the writer thread for --log-file.
+constexpr std::size_t kLogRingSlots = 1024;   // power of two
+constexpr std::size_t kLogSlotText = 1000;    // message + file; longer messages are truncated
+constexpr std::size_t kLogFileFieldMax = 512;
+
+struct alignas(64) LogSlot {
+  // 2*lap: free for producers of that lap, 2*lap+1: holds a message of that lap.
+  std::atomic<std::size_t> seq{0};
+  LogLevel level = LogLevel::Info;
+  std::uint16_t len = 0;       // message bytes at the start of text
+  std::uint16_t file_len = 0;  // file field bytes following the message
+  const char *event = nullptr;
+  long long bytes = -1, ms = -1, code = -1;
+  std::int64_t ts_us = 0;      // wall clock, microseconds since the epoch
+  char text[kLogSlotText];
+};
+
+struct LogRecord {
+  LogLevel level = LogLevel::Info;
+  std::string text;
+  std::string file;
+  const char *event = nullptr;
+  long long bytes = -1, ms = -1, code = -1;
+  std::int64_t ts_us = 0;
+};
+
+static std::atomic<std::uint64_t> g_log_dropped{0};
+static std::atomic<std::uint64_t> g_log_truncated{0};
+
+struct LogRing {
+  LogSlot slots[kLogRingSlots];
+  alignas(64) std::atomic<std::size_t> head{0};  // next slot to claim
+  alignas(64) std::size_t tail = 0;              // consumer only
+
+  bool push(LogLevel lvl, std::string_view msg, const LogFields &f, std::int64_t ts_us) {
+    std::size_t pos = head.load(std::memory_order_relaxed);
+    LogSlot *slot;
+    std::size_t want;
+    for (;;) {
+      slot = &slots[pos & (kLogRingSlots - 1)];
+      want = (pos / kLogRingSlots) * 2;
+      const std::size_t seq = slot->seq.load(std::memory_order_acquire);
+      if (seq == want) {
+        if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (seq < want) {
+        return false;  // consumer hasn't freed this slot from the previous lap: full
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+    const std::size_t file_len = std::min(f.file.size(), kLogFileFieldMax);
+    const std::size_t room = kLogSlotText - file_len;
+    std::size_t n = msg.size();
+    if (n > room) {
+      static constexpr char kMark[] = " [...]";
+      n = room - (sizeof(kMark) - 1);
+      std::memcpy(slot->text, msg.data(), n);
+      std::memcpy(slot->text + n, kMark, sizeof(kMark) - 1);
+      n = room;
+      g_log_truncated.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      std::memcpy(slot->text, msg.data(), n);
+    }
+    if (file_len) std::memcpy(slot->text + n, f.file.data(), file_len);
+    slot->level = lvl;
+    slot->len = static_cast<std::uint16_t>(n);
+    slot->file_len = static_cast<std::uint16_t>(file_len);
+    slot->event = f.event;
+    slot->bytes = f.bytes;
+    slot->ms = f.ms;
+    slot->code = f.code;
+    slot->ts_us = ts_us;
+    slot->seq.store(want + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Pop one message; returns false when the ring is empty.
+  bool pop(LogRecord &out) {
+    LogSlot &slot = slots[tail & (kLogRingSlots - 1)];
+    const std::size_t lap = tail / kLogRingSlots;
+    if (slot.seq.load(std::memory_order_acquire) != lap * 2 + 1) return false;
+    out.level = slot.level;
+    out.text.assign(slot.text, slot.len);
+    out.file.assign(slot.text + slot.len, slot.file_len);
+    out.event = slot.event;
+    out.bytes = slot.bytes;
+    out.ms = slot.ms;
+    out.code = slot.code;
+    out.ts_us = slot.ts_us;
+    slot.seq.store((lap + 1) * 2, std::memory_order_release);
+    ++tail;
+    return true;
+  }
+};
+
+static std::uint64_t g_log_dropped_reported = 0;             // console consumer only
+static LogRing g_log_ring;                                   // console
+static LogRing g_log_file_ring;                              // --log-file writer
+static std::atomic<bool> g_log_file_active{false};
+static std::atomic<std::uint64_t> g_log_file_dropped{0};
+
+// Lowest level that gets formatted at all (Debug < Info < Warn < Error).
+static std::atomic<int> g_log_min_level{1};
+
+static inline int log_severity(LogLevel lvl) {
+  switch (lvl) {
+    case LogLevel::Debug: return 0;
+    case LogLevel::Info:  return 1;
+    case LogLevel::Warn:  return 2;
+    case LogLevel::Error: return 3;
+  }
+  return 1;
+}
+
+// Cheap pre-check done by the LOG macros before any formatting happens.
+static inline bool log_enabled(LogLevel lvl) {
   if (g_silent_no_connect.load(std::memory_order_relaxed) &&
       !g_connected_for_logs.load(std::memory_order_relaxed)) {
-    return;
+    return false;
+  }
+  return log_severity(lvl) >= g_log_min_level.load(std::memory_order_relaxed);
+}
+
+static bool parse_log_level(const std::string &s, int &out) {
+  if (s == "debug") out = 0;
+  else if (s == "info") out = 1;
+  else if (s == "warn" || s == "warning") out = 2;
+  else if (s == "error") out = 3;
+  else return false;
+  return true;
+}
+
+// Hand a message to the file ring and the console. No filtering.
+static inline void log_dispatch(LogLevel lvl, const std::string &msg, const LogFields &fields) {
+  if (g_log_file_active.load(std::memory_order_acquire)) {
+    const auto ts_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    if (!g_log_file_ring.push(lvl, msg, fields, ts_us)) {
+      g_log_file_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
   }
   if (!g_repl_active.load(std::memory_order_relaxed)) {
     std::ostream& os = (lvl == LogLevel::Error) ? std::cerr : std::cout;
@@ -1387,11 +2172,9 @@ static inline void log_enqueue(LogLevel lvl, std::string msg) {
     os.flush();
     return;
   }
-  {
-    std::lock_guard<std::mutex> lk(g_log_mtx);
-    g_log_q.push_back({lvl, std::move(msg)});
+  if (!g_log_ring.push(lvl, msg, LogFields{}, 0)) {
+    g_log_dropped.fetch_add(1, std::memory_order_relaxed);
   }
-  g_log_cv.notify_one();
 
   // Write exactly one wake byte while a wake is pending
   if (g_wake_pipe[1] != -1) {
@@ -1403,11 +2186,190 @@ static inline void log_enqueue(LogLevel lvl, std::string msg) {
   }
 }
 
+// Repeat suppression: the same message key (event + code when the call site
+// provides them, the text otherwise) is let through g_log_repeat_burst times
+// per window; further repeats are counted and summarised once the window has
+// passed, so a body that fires one warning 50x a second costs one prompt
+// repaint per window instead of 50. The table is guarded by try_lock only:
+// a producer that finds it busy logs unfiltered rather than waiting.
+constexpr auto kLogRepeatWindow = std::chrono::seconds(5);
+constexpr std::size_t kLogRepeatMaxKeys = 1024;
+
+struct LogRepeat {
+  std::chrono::steady_clock::time_point window_start;
+  unsigned hits = 0;
+  unsigned suppressed = 0;
+  LogLevel level = LogLevel::Info;
+  std::string text;  // first message seen for the key
+};
+
+static std::atomic<unsigned> g_log_repeat_burst{3};  // 0 = no suppression
+static std::mutex g_log_repeat_mtx;
+static std::unordered_map<std::uint64_t, LogRepeat> g_log_repeats;
+static std::atomic<unsigned> g_log_repeat_pending{0};  // keys with unreported repeats
+static std::atomic<std::uint64_t> g_log_suppressed{0};
+// Set on the main, input and command worker threads: command output is never
+// treated as a repeat, only background and callback chatter is.
+static thread_local bool t_log_unfiltered = false;
+
+static std::uint64_t log_repeat_key(const std::string &msg, const LogFields &f) {
+  std::uint64_t h = 1469598103934665603ull;  // FNV-1a
+  auto mix = [&](const char *p, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) { h ^= static_cast<unsigned char>(p[i]); h *= 1099511628211ull; }
+  };
+  if (f.event && f.code >= 0) {
+    mix(f.event, std::strlen(f.event));
+    mix(reinterpret_cast<const char *>(&f.code), sizeof(f.code));
+    // Per-file events (download_failed) stay distinct, so every missing file is named.
+    mix(f.file.data(), f.file.size());
+  } else {
+    mix(msg.data(), msg.size());
+  }
+  return h;
+}
+
+static std::string log_repeat_summary(const LogRepeat &r, unsigned n) {
+  return "[LOG] suppressed " + std::to_string(n) + " repeat" + (n == 1 ? "" : "s") + " of: " + r.text;
+}
+
+// Returns false when the message should be dropped as a repeat. A summary for
+// the previous window, if any, is returned in `summary`.
+static bool log_repeat_admit(LogLevel lvl, const std::string &msg, const LogFields &f,
+                             std::string &summary, LogLevel &summary_level) {
+  const unsigned burst = g_log_repeat_burst.load(std::memory_order_relaxed);
+  if (burst == 0 || t_log_unfiltered) return true;
+  std::unique_lock<std::mutex> lk(g_log_repeat_mtx, std::try_to_lock);
+  if (!lk.owns_lock()) return true;
+
+  const auto now = std::chrono::steady_clock::now();
+  if (g_log_repeats.size() >= kLogRepeatMaxKeys) {
+    for (auto it = g_log_repeats.begin(); it != g_log_repeats.end();) {
+      if (!it->second.suppressed && now - it->second.window_start >= kLogRepeatWindow) {
+        it = g_log_repeats.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    if (g_log_repeats.size() >= kLogRepeatMaxKeys) return true;
+  }
+
+  auto [it, fresh] = g_log_repeats.try_emplace(log_repeat_key(msg, f));
+  LogRepeat &r = it->second;
+  if (fresh) {
+    r.window_start = now;
+    r.level = lvl;
+    r.text = msg;
+  } else if (now - r.window_start >= kLogRepeatWindow) {
+    if (r.suppressed) {
+      summary = log_repeat_summary(r, r.suppressed);
+      summary_level = r.level;
+      r.suppressed = 0;
+      g_log_repeat_pending.fetch_sub(1, std::memory_order_relaxed);
+    }
+    r.window_start = now;
+    r.hits = 0;
+  }
+  if (++r.hits <= burst) return true;
+  if (r.suppressed++ == 0) g_log_repeat_pending.fetch_add(1, std::memory_order_relaxed);
+  g_log_suppressed.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+// Emit summaries for keys whose window has closed without another repeat.
+// Called from the input thread while it waits for a key, between script steps
+// and from the script/batch waits; `force` reports everything.
+static void flush_log_repeats(bool force) {
+  if (g_log_repeat_pending.load(std::memory_order_relaxed) == 0) return;
+  std::vector<std::pair<LogLevel, std::string>> out;
+  {
+    std::lock_guard<std::mutex> lk(g_log_repeat_mtx);
+    const auto now = std::chrono::steady_clock::now();
+    for (auto &[key, r] : g_log_repeats) {
+      if (!r.suppressed || (!force && now - r.window_start < kLogRepeatWindow)) continue;
+      out.emplace_back(r.level, log_repeat_summary(r, r.suppressed));
+      r.suppressed = 0;
+      g_log_repeat_pending.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+  for (auto &[lvl, text] : out) log_dispatch(lvl, text, LogFields().ev("log_suppressed"));
+}
+
+// Enqueue a message from any thread.
+static inline void log_enqueue(LogLevel lvl, const std::string &msg, const LogFields &fields = {}) {
+  std::string summary;
+  LogLevel summary_level = lvl;
+  const bool admit = log_repeat_admit(lvl, msg, fields, summary, summary_level);
+  if (!summary.empty()) log_dispatch(summary_level, summary, LogFields().ev("log_suppressed"));
+  if (admit) log_dispatch(lvl, msg, fields);
+}
+
+// Per-thread format buffer for the LOG macros. The string keeps its capacity
+// between messages, so steady-state logging doesn't allocate. A message that
+// is formatted while another one is being built on the same thread (a LOG
+// inside a function called from a LOG expression) gets a private stream.
+class LogStreamBuf : public std::streambuf {
+ public:
+  std::string buf;
+
+ protected:
+  int_type overflow(int_type ch) override {
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) buf.push_back(traits_type::to_char_type(ch));
+    return traits_type::not_eof(ch);
+  }
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    buf.append(s, static_cast<std::size_t>(n));
+    return n;
+  }
+};
+
+struct LogFormatter {
+  struct Tls {
+    LogStreamBuf sb;
+    std::ostream os{&sb};
+    std::ios_base::fmtflags flags = os.flags();
+    bool busy = false;
+    Tls() { sb.buf.reserve(256); }
+  };
+  static Tls &tls() {
+    thread_local Tls t;
+    return t;
+  }
+
+  LogStreamBuf *sb;
+  std::ostream *os;
+  std::unique_ptr<Tls> own;
+
+  LogFormatter() {
+    Tls *t = &tls();
+    if (t->busy) {
+      own = std::make_unique<Tls>();
+      t = own.get();
+    }
+    t->busy = true;
+    t->sb.buf.clear();
+    t->os.clear();
+    t->os.flags(t->flags);
+    t->os.precision(6);
+    t->os.fill(' ');
+    sb = &t->sb;
+    os = &t->os;
+  }
+  ~LogFormatter() {
+    if (!own) tls().busy = false;
+  }
+  LogFormatter(const LogFormatter &) = delete;
+  LogFormatter &operator=(const LogFormatter &) = delete;
+};
+
+#define LOG_AT(lvl, expr) do { if (log_enabled(lvl)) { LogFormatter _lf; *_lf.os << expr; log_enqueue(lvl, _lf.sb->buf); } } while(0)
+// Same, with structured fields for the log file: LOG_EV(LogLevel::Info, LogFields().ev("x").with_ms(ms), "...");
+#define LOG_EV(lvl, fields, expr) do { if (log_enabled(lvl)) { LogFormatter _lf; *_lf.os << expr; log_enqueue(lvl, _lf.sb->buf, fields); } } while(0)
+
 // Stream-friendly macros: use like LOGI("foo " << x << " bar");
-#define LOGI(expr) do { std::ostringstream _oss; _oss << expr; log_enqueue(LogLevel::Info,  _oss.str()); } while(0)
-#define LOGW(expr) do { std::ostringstream _oss; _oss << expr; log_enqueue(LogLevel::Warn,  _oss.str()); } while(0)
-#define LOGE(expr) do { std::ostringstream _oss; _oss << expr; log_enqueue(LogLevel::Error, _oss.str()); } while(0)
-#define LOGD(expr) do { std::ostringstream _oss; _oss << expr; log_enqueue(LogLevel::Debug, _oss.str()); } while(0)
+#define LOGI(expr) LOG_AT(LogLevel::Info,  expr)
+#define LOGW(expr) LOG_AT(LogLevel::Warn,  expr)
+#define LOGE(expr) LOG_AT(LogLevel::Error, expr)
+#define LOGD(expr) LOG_AT(LogLevel::Debug, expr)
 
 static inline void wake_repl_loop() {
   if (g_wake_pipe[1] != -1) {
@@ -1505,6 +2467,7 @@ static void log_command_overview() {
   LOGI("  shoot | trigger      Fire the shutter immediately (full press)");
   LOGI("  focus                Half-press + release to autofocus");
   LOGI("  sync [N|all|star|on|off]  Pull latest files, mirror all contents, or fetch starred stills; 'sync stop' aborts");
+  LOGI("  sync background on|off   Trickle-mirror the card while idle ([oldest|newest] [duty <pct>])");
 #ifdef SONSHELL_HEADLESS
   LOGI("  monitor start|stop   (disabled in headless builds)");
 #else
@@ -1517,6 +2480,18 @@ static void log_command_overview() {
   LOGI("  button delete        Tap the rear trash/delete button");
   LOGI("  button menu          Open the camera menu (rear Menu button)");
   LOGI("  button shutter|movie Tap the top shutter or movie buttons");
+  LOGI("  ratings export       Write star ratings to XMP sidecars next to downloaded files");
+  LOGI("  props record <file>  Append every property change to a compact binary log; 'props stop' ends it");
+  LOGI("  props decode <file> [out.csv]  Export a property recording as CSV");
+  LOGI("  metrics              Show property refresh, hook queue and recorder counters");
+  LOGI("  shutter [stats]      Show fast-capture state, per-drive-mode timing and release latency");
+  LOGI("  shutter fast on|off  Fire as soon as AF reports focus and let go of S1 on the camera's acknowledgement");
+  LOGI("  shutter timing <single|continuous|timer|other> [fast|fixed] [af=<ms>] [hold=<ms>] [ack=<ms>]");
+  LOGI("  burst <frames>|<duration>  Hold the release in continuous drive (e.g. 'burst 20', 'burst 2s'); downloads once at the end");
+  LOGI("  bracket <prop> <v1,v2,...>  Shoot one frame per value of shutter|iso|aperture|comp, then restore it");
+  LOGI("  interval <period> <count> [skip|queue]  Timelapse on fixed deadlines (e.g. 'interval 10s 360'); 'interval stop'");
+  LOGI("  wait <ms>            Pause, e.g. between chained commands");
+  LOGI("  repeat N { ... }     Run the commands in braces N times; chain commands with ';'");
   LOGI("  power off            Ask the camera to power down (half-pressing the shutter will wake it up)");
   LOGI("  quit | exit          Leave SonShell");
   LOGI("Shortcuts:");
@@ -1530,13 +2505,47 @@ static void log_command_overview() {
 }
 
 static void log_exposure_usage() {
-  LOGI("usage: exposure <show|mode|iso|aperture|shutter|comp>");
+  LOGI("usage: exposure <show|mode|iso|aperture|shutter|comp|list>");
   LOGI("  show                 Display current exposure metrics");
   LOGI("  mode [value]         Get or set exposure mode (manual, program, aperture, shutter, auto, ...)");
   LOGI("  iso [value]          Get or set ISO (e.g. auto, 100, 6400)");
   LOGI("  aperture [value]     Get or set aperture (e.g. f/2.8, 5.6)");
   LOGI("  shutter [value]      Get or set shutter speed (e.g. 1/125, 0.5s, bulb)");
   LOGI("  comp [value]         Get or set exposure compensation (e.g. +1.0, -0.3, reset)");
+  LOGI("  list <prop>          Values the camera accepts right now for shutter, iso, aperture or comp");
+}
+
+// Replaces `value` with the nearest value the body lists (within one stop,
+// or 1 EV for compensation). Without a table the value is left as is and
+// the camera decides. `label` prefixes the messages.
+static bool snap_to_supported(CrInt32u code, const char *label, CrInt64u &value) {
+  const ExposureValueKind *kind = exposure_value_kind(code);
+  const std::vector<CrInt64u> values = supported_values(code);
+  if (!kind || values.empty()) return true;
+  for (CrInt64u v : values) {
+    if (v == value) return true;
+  }
+  double want = 0;
+  const bool scalable = kind->scale(value, want);
+  CrInt64u best = 0;
+  double best_dist = std::numeric_limits<double>::infinity();
+  for (CrInt64u v : values) {
+    double pos = 0;
+    if (!scalable || (v & kind->group_mask) != (value & kind->group_mask) || !kind->scale(v, pos)) continue;
+    const double dist = std::fabs(pos - want);
+    if (dist < best_dist - 1e-9) {
+      best_dist = dist;
+      best = v;
+    }
+  }
+  if (best_dist > 1.0 + 1e-9) {
+    LOGE(label << ": " << kind->format(value) << " is not supported by the camera right now; see 'exposure list "
+         << kind->name << "'");
+    return false;
+  }
+  LOGI(label << ": " << kind->format(value) << " not supported; using nearest " << kind->format(best));
+  value = best;
+  return true;
 }
 
 static int exposure_show_handler(SDK::CrDeviceHandle handle, bool verbose,
@@ -1556,8 +2565,7 @@ static int exposure_show_handler(SDK::CrDeviceHandle handle, bool verbose,
       iso_display = snap.iso_actual;
     }
   }
-  PropertyValue comp = fetch_property(handle, SDK::CrDevicePropertyCode::CrDeviceProperty_ExposureBiasCompensation);
-  std::string comp_display = comp.supported ? format_exposure_compensation(comp.value) : "--";
+  const std::string &comp_display = snap.exposure_comp;
 
   LOGI("Exposure:");
   LOGI("  Mode: " << snap.exposure_program);
@@ -1651,6 +2659,11 @@ static int exposure_iso_handler(SDK::CrDeviceHandle handle, bool /*verbose*/,
     LOGI("Examples: exposure iso auto | exposure iso 100 | exposure iso 6400");
     return 2;
   }
+  CrInt64u snapped = encoded;
+  if (!snap_to_supported(SDK::CrDevicePropertyCode::CrDeviceProperty_IsoSensitivity, "exposure iso", snapped)) {
+    return 2;
+  }
+  encoded = static_cast<CrInt32u>(snapped);
 
   if (!current.supported) {
     log_exposure_mode_hint(handle, "iso",
@@ -1704,6 +2717,11 @@ static int exposure_aperture_handler(SDK::CrDeviceHandle handle, bool /*verbose*
     LOGI("Examples: exposure aperture f/4 | exposure aperture 2.8");
     return 2;
   }
+  CrInt64u snapped = encoded;
+  if (!snap_to_supported(SDK::CrDevicePropertyCode::CrDeviceProperty_FNumber, "exposure aperture", snapped)) {
+    return 2;
+  }
+  encoded = static_cast<CrInt16u>(snapped);
 
   if (!current.supported) {
     log_exposure_mode_hint(handle, "aperture",
@@ -1753,6 +2771,11 @@ static int exposure_shutter_handler(SDK::CrDeviceHandle handle, bool /*verbose*/
     LOGI("Examples: exposure shutter 1/125 | exposure shutter 0.5s | exposure shutter bulb");
     return 2;
   }
+  CrInt64u snapped = encoded;
+  if (!snap_to_supported(SDK::CrDevicePropertyCode::CrDeviceProperty_ShutterSpeed, "exposure shutter", snapped)) {
+    return 2;
+  }
+  encoded = static_cast<CrInt32u>(snapped);
 
   if (!current.supported) {
     log_exposure_mode_hint(handle, "shutter",
@@ -1803,6 +2826,12 @@ static int exposure_comp_handler(SDK::CrDeviceHandle handle, bool /*verbose*/,
     LOGI("Examples: exposure comp +1.0 | exposure comp -0.3 | exposure comp reset");
     return 2;
   }
+  CrInt64u snapped = static_cast<CrInt16u>(encoded);
+  if (!snap_to_supported(SDK::CrDevicePropertyCode::CrDeviceProperty_ExposureBiasCompensation, "exposure comp",
+                         snapped)) {
+    return 2;
+  }
+  encoded = static_cast<CrInt16>(static_cast<CrInt16u>(snapped));
 
   if (!current.supported) {
     log_exposure_mode_hint(handle, "comp",
@@ -1833,6 +2862,37 @@ static int exposure_comp_handler(SDK::CrDeviceHandle handle, bool /*verbose*/,
   return 0;
 }
 
+static int exposure_list_handler(SDK::CrDeviceHandle handle, bool /*verbose*/,
+                                 const std::vector<std::string>& args, size_t start_index) {
+  const ExposureValueKind *kind = exposure_value_kind(args[start_index]);
+  if (!kind) {
+    LOGE(kExposureUsageList);
+    return 2;
+  }
+  // The tables ride along with every property pull; take one if none has happened yet.
+  if (!property_snapshot()) refresh_property_cache(handle);
+  const std::vector<CrInt64u> values = supported_values(kind->code);
+  if (values.empty()) {
+    LOGW("exposure list: camera did not report supported " << kind->name << " values.");
+    return 2;
+  }
+  const PropertyValue current = cached_property(handle, kind->code);
+  std::ostringstream line;
+  std::size_t on_line = 0;
+  LOGI("Supported " << kind->name << " values (" << values.size() << "):");
+  for (CrInt64u v : values) {
+    const bool is_current = current.supported && v == (current.value & kind->mask);
+    line << "  " << (is_current ? "[" : "") << kind->format(v) << (is_current ? "]" : "");
+    if (++on_line == 10) {
+      LOGI(line.str());
+      line.str(std::string());
+      on_line = 0;
+    }
+  }
+  if (on_line) LOGI(line.str());
+  return 0;
+}
+
 static bool send_movie_record_button_press(SDK::CrDeviceHandle handle,
                                            std::chrono::milliseconds hold_duration,
                                            bool verbose_logs) {
@@ -1863,78 +2923,418 @@ static bool send_movie_record_button_press(SDK::CrDeviceHandle handle,
   return true;
 }
 
-static bool trigger_full_shutter_press(SDK::CrDeviceHandle handle,
-                                       bool verbose_logs,
-                                       const char* label) {
-  const char* tag = (label && *label) ? label : "shutter";
-  if (!handle) {
-    LOGE(tag << ": camera handle unavailable");
-    return false;
+// ----------------------------
+// Shutter timing
+// ----------------------------
+// The classic sequence holds S1 for 500 ms before the release and 1000 ms
+// after it. With fast capture on, those waits become state-driven: the
+// release fires as soon as FocusIndication changes to a result after S1 (at
+// once in MF/PF), and S1 is let go as soon as remaining shots or a contents
+// list changes after the release. Each drive-mode group carries its own limits.
+struct ShutterTiming {
+  bool fast = true;  // false: always use the classic fixed waits
+  int af_ms = 1000;  // longest wait for focus before releasing anyway
+  int hold_ms = 35;  // release button held down
+  int ack_ms = 300;  // longest wait for the camera to acknowledge before S1 up
+};
+
+enum ShutterGroup { kShutterSingle, kShutterContinuous, kShutterTimer, kShutterOther, kShutterGroupCount };
+static const char *const kShutterGroupNames[kShutterGroupCount] = {"single", "continuous", "timer", "other"};
+
+struct ShutterStats {
+  std::uint64_t shots = 0;
+  double latency_total_ms = 0, latency_max_ms = 0, latency_last_ms = 0;
+  std::uint64_t af_waits = 0, af_timeouts = 0, af_missed = 0;
+  double af_total_ms = 0;
+  std::uint64_t acks = 0, ack_timeouts = 0;
+};
+
+static std::atomic<bool> g_fast_shutter{false};
+static std::mutex g_shutter_mtx;
+static ShutterTiming g_shutter_timing[kShutterGroupCount] = {
+  {true, 1000, 35, 300},    // single
+  {true, 1000, 35, 300},    // continuous: a short hold still yields one frame
+  {false, 1000, 35, 1000},  // timer: the countdown runs after the release
+  {false, 1000, 35, 1000},  // other: bracketing, timelapse, unknown modes
+};
+static ShutterStats g_shutter_stats;
+
+static ShutterGroup shutter_group_for_drive(const PropertyValue &drive) {
+  if (!drive.supported) return kShutterOther;
+  switch (static_cast<SDK::CrDriveMode>(static_cast<CrInt32u>(drive.value))) {
+    case SDK::CrDrive_Single:
+      return kShutterSingle;
+    case SDK::CrDrive_Continuous_Hi:
+    case SDK::CrDrive_Continuous_Hi_Plus:
+    case SDK::CrDrive_Continuous_Lo:
+    case SDK::CrDrive_Continuous:
+    case SDK::CrDrive_Continuous_SpeedPriority:
+    case SDK::CrDrive_Continuous_Mid:
+    case SDK::CrDrive_Continuous_Lo_Live:
+    case SDK::CrDrive_SingleBurstShooting_lo:
+    case SDK::CrDrive_SingleBurstShooting_mid:
+    case SDK::CrDrive_SingleBurstShooting_hi:
+      return kShutterContinuous;
+    case SDK::CrDrive_Timer_2s:
+    case SDK::CrDrive_Timer_5s:
+    case SDK::CrDrive_Timer_10s:
+      return kShutterTimer;
+    default:
+      return kShutterOther;
   }
+}
 
-  if (verbose_logs) LOGI(tag << ": capture image...");
+enum class FocusResult { Focused, NotFocused, Pending };
+
+static FocusResult focus_result(const PropertySnapshot &snap) {
+  const PropertyValue &ind = snap.get(SDK::CrDeviceProperty_FocusIndication);
+  if (!ind.supported) return FocusResult::Pending;
+  switch (static_cast<CrInt32u>(ind.value)) {
+    case SDK::CrFocusIndicator_Focused_AF_S:
+    case SDK::CrFocusIndicator_Focused_AF_C:
+    case SDK::CrFocusIndicator_TrackingSubject_AF_C:
+      return FocusResult::Focused;
+    case SDK::CrFocusIndicator_NotFocused_AF_S:
+    case SDK::CrFocusIndicator_NotFocused_AF_C:
+      return FocusResult::NotFocused;
+    default:
+      return FocusResult::Pending;
+  }
+}
+
+static bool manual_focus_active(const PropertySnapshot *snap) {
+  if (!snap) return false;
+  const PropertyValue &fm = snap->get(SDK::CrDeviceProperty_FocusMode);
+  const auto mode = static_cast<SDK::CrFocusMode>(static_cast<CrInt16u>(fm.value));
+  return fm.supported && (mode == SDK::CrFocus_MF || mode == SDK::CrFocus_PF);
+}
+
+// Whether `code` differs from `base` (taken before the action) or moved in
+// `p` itself. State left over from before the action never counts; a change
+// that happened between two wakeups still does.
+static bool property_changed_since(const PropertySnapshot &p, const PropertySnapshot *base, CrInt32u code) {
+  if (p.moved(code)) return true;
+  if (!base) return false;
+  const PropertyValue &now = p.get(code), &then = base->get(code);
+  return now.supported != then.supported || now.value != then.value;
+}
+
+static bool continuous_focus_lock(const PropertySnapshot &p) {
+  const auto ind = static_cast<CrInt32u>(p.get(SDK::CrDeviceProperty_FocusIndication).value);
+  return ind == SDK::CrFocusIndicator_Focused_AF_C || ind == SDK::CrFocusIndicator_TrackingSubject_AF_C;
+}
+
+// After S1 is locked: the first snapshot published after `s1_generation`
+// whose FocusIndication changed relative to `base` (taken before S1) and
+// carries a result, or nullptr once `limit` passes. An AF-C lock that was
+// already held before S1 does not change, so in AF-C a focused reading in a
+// post-S1 snapshot counts as well.
+static std::shared_ptr<const PropertySnapshot> wait_for_focus_result(
+    const std::shared_ptr<const PropertySnapshot> &base, std::uint64_t s1_generation,
+    std::chrono::milliseconds limit) {
+  return wait_for_property_snapshot(s1_generation, std::chrono::steady_clock::now() + limit,
+                                    [&](const PropertySnapshot &p) {
+                                      if (focus_result(p) == FocusResult::Pending) return false;
+                                      return continuous_focus_lock(p) ||
+                                             property_changed_since(p, base.get(),
+                                                                    SDK::CrDeviceProperty_FocusIndication);
+                                    });
+}
+
+// Properties the body updates once a frame has been taken: remaining shots
+// and the contents list of either slot. S1 and focus changes do not count.
+static const CrInt32u kCaptureAckCodes[] = {
+  SDK::CrDeviceProperty_MediaSLOT1_RemainingNumber,
+  SDK::CrDeviceProperty_MediaSLOT2_RemainingNumber,
+  SDK::CrDeviceProperty_MediaSLOT1_ContentsInfoListUpdateTime,
+  SDK::CrDeviceProperty_MediaSLOT2_ContentsInfoListUpdateTime,
+};
 
+static std::shared_ptr<const PropertySnapshot> wait_for_capture_ack(
+    const std::shared_ptr<const PropertySnapshot> &base, std::chrono::milliseconds limit) {
+  return wait_for_property_snapshot(base ? base->generation : 0, std::chrono::steady_clock::now() + limit,
+                                    [&](const PropertySnapshot &p) {
+                                      for (CrInt32u code : kCaptureAckCodes) {
+                                        if (property_changed_since(p, base.get(), code)) return true;
+                                      }
+                                      return false;
+                                    });
+}
+
+static bool set_s1(SDK::CrDeviceHandle handle, bool locked, const char *tag, const char *what) {
   SDK::CrDeviceProperty s1;
   s1.SetCode(SDK::CrDevicePropertyCode::CrDeviceProperty_S1);
   s1.SetValueType(SDK::CrDataType::CrDataType_UInt16);
-  s1.SetCurrentValue(SDK::CrLockIndicator::CrLockIndicator_Locked);
-  auto s1_lock_err = SDK::SetDeviceProperty(handle, &s1);
-  if (s1_lock_err != SDK::CrError_None) {
-    unsigned code = static_cast<unsigned>(s1_lock_err);
-    LOGE(tag << ": failed to half-press shutter: " << crsdk_err::error_to_name(s1_lock_err)
+  s1.SetCurrentValue(locked ? SDK::CrLockIndicator::CrLockIndicator_Locked
+                            : SDK::CrLockIndicator::CrLockIndicator_Unlocked);
+  auto err = SDK::SetDeviceProperty(handle, &s1);
+  if (err != SDK::CrError_None) {
+    unsigned code = static_cast<unsigned>(err);
+    LOGE(tag << ": failed to " << what << ": " << crsdk_err::error_to_name(err)
          << " (0x" << std::hex << code << std::dec << ")");
     return false;
   }
+  return true;
+}
 
-  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+static void send_release(SDK::CrDeviceHandle handle, SDK::CrCommandParam param, const char *tag) {
+  auto err = SDK::SendCommand(handle, SDK::CrCommandId::CrCommandId_Release, param);
+  if (err != SDK::CrError_None) {
+    unsigned code = static_cast<unsigned>(err);
+    LOGE(tag << ": shutter " << (param == SDK::CrCommandParam_Down ? "down" : "up") << " failed: "
+         << crsdk_err::error_to_name(err) << " (0x" << std::hex << code << std::dec << ")");
+  }
+}
 
-  if (verbose_logs) LOGI(tag << ": shutter down");
-  auto down_err = SDK::SendCommand(handle, SDK::CrCommandId::CrCommandId_Release, SDK::CrCommandParam_Down);
-  if (down_err != SDK::CrError_None) {
-    unsigned code = static_cast<unsigned>(down_err);
-    LOGE(tag << ": shutter down failed: " << crsdk_err::error_to_name(down_err)
-         << " (0x" << std::hex << code << std::dec << ")");
+static bool trigger_full_shutter_press(SDK::CrDeviceHandle handle,
+                                       bool verbose_logs,
+                                       const char* label) {
+  const char* tag = (label && *label) ? label : "shutter";
+  if (!handle) {
+    LOGE(tag << ": camera handle unavailable");
+    return false;
+  }
+
+  using clock = std::chrono::steady_clock;
+  const auto t0 = clock::now();
+  note_capture_activity();
+  if (verbose_logs) LOGI(tag << ": capture image...");
+
+  auto snap = property_snapshot();
+  const ShutterGroup group =
+      snap ? shutter_group_for_drive(snap->get(SDK::CrDeviceProperty_DriveMode)) : kShutterOther;
+  ShutterTiming timing;
+  {
+    std::lock_guard<std::mutex> lk(g_shutter_mtx);
+    timing = g_shutter_timing[group];
+  }
+  const bool fast = g_fast_shutter.load(std::memory_order_relaxed) && timing.fast;
+  const bool manual_focus = manual_focus_active(snap.get());
+
+  const auto before_s1 = property_snapshot();
+  if (!set_s1(handle, true, tag, "half-press shutter")) return false;
+  const std::uint64_t s1_generation = property_generation();
+
+  bool af_waited = false, af_timeout = false, af_missed = false;
+  double af_ms = 0;
+  if (!fast) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  } else if (!manual_focus) {
+    af_waited = true;
+    const auto t_s1 = clock::now();
+    auto hit = wait_for_focus_result(before_s1, s1_generation, std::chrono::milliseconds(timing.af_ms));
+    af_ms = std::chrono::duration<double, std::milli>(clock::now() - t_s1).count();
+    af_timeout = !hit;
+    af_missed = hit && focus_result(*hit) == FocusResult::NotFocused;
+    if (af_timeout && verbose_logs) LOGI(tag << ": no focus report within " << timing.af_ms << " ms; releasing");
+    if (af_missed) LOGW(tag << ": camera reports focus not achieved; releasing anyway");
   }
-  std::this_thread::sleep_for(std::chrono::milliseconds(35));
+
+  if (verbose_logs) LOGI(tag << ": shutter down");
+  const auto before_release = property_snapshot();
+  send_release(handle, SDK::CrCommandParam_Down, tag);
+  const auto t_release = clock::now();
+  std::this_thread::sleep_for(std::chrono::milliseconds(fast ? timing.hold_ms : 35));
 
   if (verbose_logs) LOGI(tag << ": shutter up");
-  auto up_err = SDK::SendCommand(handle, SDK::CrCommandId::CrCommandId_Release, SDK::CrCommandParam_Up);
-  if (up_err != SDK::CrError_None) {
-    unsigned code = static_cast<unsigned>(up_err);
-    LOGE(tag << ": shutter up failed: " << crsdk_err::error_to_name(up_err)
-         << " (0x" << std::hex << code << std::dec << ")");
+  send_release(handle, SDK::CrCommandParam_Up, tag);
+
+  bool acked = false;
+  if (!fast) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  } else {
+    acked = static_cast<bool>(wait_for_capture_ack(before_release, std::chrono::milliseconds(timing.ack_ms)));
   }
+  set_s1(handle, false, tag, "release half-press");
 
-  std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-  s1.SetCurrentValue(SDK::CrLockIndicator::CrLockIndicator_Unlocked);
-  auto s1_unlock_err = SDK::SetDeviceProperty(handle, &s1);
-  if (s1_unlock_err != SDK::CrError_None) {
-    unsigned code = static_cast<unsigned>(s1_unlock_err);
-    LOGE(tag << ": failed to release half-press: " << crsdk_err::error_to_name(s1_unlock_err)
-         << " (0x" << std::hex << code << std::dec << ")");
+  const double latency_ms = std::chrono::duration<double, std::milli>(t_release - t0).count();
+  {
+    std::lock_guard<std::mutex> lk(g_shutter_mtx);
+    auto &st = g_shutter_stats;
+    ++st.shots;
+    st.latency_total_ms += latency_ms;
+    st.latency_max_ms = std::max(st.latency_max_ms, latency_ms);
+    st.latency_last_ms = latency_ms;
+    if (af_waited) {
+      ++st.af_waits;
+      st.af_total_ms += af_ms;
+      if (af_timeout) ++st.af_timeouts;
+      if (af_missed) ++st.af_missed;
+    }
+    if (fast) {
+      if (acked) ++st.acks;
+      else ++st.ack_timeouts;
+    }
+  }
+  if (verbose_logs) {
+    LOGI(tag << ": release " << std::fixed << std::setprecision(1) << latency_ms << " ms after command ("
+         << (fast ? "fast" : "classic") << ", " << kShutterGroupNames[group]
+         << (manual_focus ? ", MF" : "") << ")");
   }
 
   return true;
 }
 
+// ----------------------------
+// Burst capture
+// ----------------------------
+// `burst` holds the release down in continuous drive and counts frames from
+// the contents notifications the body sends as it writes them. While a burst
+// is running those notifications are only tallied. Once the card has gone
+// quiet, each slot gets one download request for everything it added,
+// instead of one worker per frame.
+struct BurstSession {
+  bool active = false;
+  CrInt32u frames[3] = {0, 0, 0};  // indexed by slot number (1, 2)
+  std::chrono::steady_clock::time_point first_frame{}, last_frame{};
+
+  // Simultaneous or sorted recording notifies once per slot for each shot,
+  // so shots are the larger per-slot count, not the sum.
+  CrInt32u shots() const { return std::max(frames[1], frames[2]); }
+};
+
+static std::mutex g_burst_mtx;
+static std::condition_variable g_burst_cv;
+static BurstSession g_burst;
+
+constexpr auto kBurstSettle = std::chrono::milliseconds(1500);  // quiet period that ends a burst
+constexpr auto kBurstSettleMax = std::chrono::seconds(20);      // buffer flush on slow cards
+constexpr auto kBurstPoll = std::chrono::milliseconds(100);     // Ctrl+C / disconnect check while holding
+
+// Neither SIGINT nor OnDisconnected touches g_burst_cv, so the waits poll these.
+static bool burst_interrupted() {
+  return g_stop.load(std::memory_order_relaxed) || g_reconnect.load(std::memory_order_relaxed);
+}
+
+// Called from OnNotifyRemoteTransferContentsListChanged; true if a burst took the update.
+static bool burst_note_contents(CrInt32u slot, CrInt32u added) {
+  std::lock_guard<std::mutex> lk(g_burst_mtx);
+  if (!g_burst.active) return false;
+  const auto now = std::chrono::steady_clock::now();
+  if (g_burst.shots() == 0) g_burst.first_frame = now;
+  g_burst.last_frame = now;
+  g_burst.frames[slot == SDK::CrSlotNumber_Slot2 ? 2 : 1] += added ? added : 1;
+  g_burst_cv.notify_all();
+  return true;
+}
+
+static void log_shutter_settings() {
+  std::lock_guard<std::mutex> lk(g_shutter_mtx);
+  LOGI("shutter: fast capture " << (g_fast_shutter.load() ? "on" : "off"));
+  for (int g = 0; g < kShutterGroupCount; ++g) {
+    const auto &t = g_shutter_timing[g];
+    LOGI("  " << std::left << std::setw(11) << kShutterGroupNames[g] << (t.fast ? "fast " : "fixed")
+         << "  af<=" << t.af_ms << " ms  hold " << t.hold_ms << " ms  ack<=" << t.ack_ms << " ms");
+  }
+  const auto &st = g_shutter_stats;
+  if (st.shots) {
+    LOGI("  latency    avg " << std::fixed << std::setprecision(1) << st.latency_total_ms / st.shots
+         << " ms, max " << st.latency_max_ms << " ms, last " << st.latency_last_ms << " ms ("
+         << st.shots << " shot(s))");
+  }
+  if (st.af_waits) {
+    LOGI("  focus      avg " << std::fixed << std::setprecision(1) << st.af_total_ms / st.af_waits
+         << " ms, " << st.af_timeouts << " timeout(s), " << st.af_missed << " not focused");
+  }
+  if (st.acks + st.ack_timeouts) {
+    LOGI("  ack        " << st.acks << " acknowledged, " << st.ack_timeouts << " timed out");
+  }
+}
+
+// shutter [fast on|off] | shutter timing <group> [fast|fixed] [af=<ms>] [hold=<ms>] [ack=<ms>]
+static int shutter_command(const std::vector<std::string> &args) {
+  const std::string sub = args.size() > 1 ? to_lower_ascii(args[1]) : std::string();
+  if (args.size() == 1 || (sub == "stats" && args.size() == 2)) {
+    log_shutter_settings();
+    return 0;
+  }
+  if (sub == "fast" && args.size() == 3) {
+    const std::string v = to_lower_ascii(args[2]);
+    if (v != "on" && v != "off") {
+      LOGE("usage: shutter fast on|off");
+      return 2;
+    }
+    g_fast_shutter.store(v == "on", std::memory_order_relaxed);
+    LOGI("shutter: fast capture " << v);
+    return 0;
+  }
+  if (sub == "timing" && args.size() >= 3) {
+    const std::string name = to_lower_ascii(args[2]);
+    int group = -1;
+    for (int g = 0; g < kShutterGroupCount; ++g) {
+      if (name == kShutterGroupNames[g]) group = g;
+    }
+    if (group < 0) {
+      LOGE("shutter timing: unknown drive group '" << args[2] << "' (single, continuous, timer, other)");
+      return 2;
+    }
+    ShutterTiming t;
+    {
+      std::lock_guard<std::mutex> lk(g_shutter_mtx);
+      t = g_shutter_timing[group];
+    }
+    for (std::size_t i = 3; i < args.size(); ++i) {
+      const std::string a = to_lower_ascii(args[i]);
+      auto eq = a.find('=');
+      if (a == "fast" || a == "fixed") {
+        t.fast = (a == "fast");
+        continue;
+      }
+      char *end = nullptr;
+      long v = eq == std::string::npos ? -1 : std::strtol(a.c_str() + eq + 1, &end, 10);
+      if (v < 0 || v > 60000 || !end || *end != '\0') {
+        LOGE("shutter timing: bad setting '" << args[i] << "' (use fast|fixed, af=<ms>, hold=<ms>, ack=<ms>)");
+        return 2;
+      }
+      const std::string key = a.substr(0, eq);
+      if (key == "af") t.af_ms = static_cast<int>(v);
+      else if (key == "hold") t.hold_ms = static_cast<int>(v);
+      else if (key == "ack") t.ack_ms = static_cast<int>(v);
+      else {
+        LOGE("shutter timing: unknown key '" << key << "'");
+        return 2;
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lk(g_shutter_mtx);
+      g_shutter_timing[group] = t;
+    }
+    log_shutter_settings();
+    return 0;
+  }
+  LOGE("usage: shutter [stats] | shutter fast on|off | shutter timing <single|continuous|timer|other> "
+       "[fast|fixed] [af=<ms>] [hold=<ms>] [ack=<ms>]");
+  return 2;
+}
+
 // Drain everything that's queued and repaint the prompt.
 // Call ONLY from the input thread that owns `el`.
 static inline bool drain_logs_and_refresh(EditLine* el_or_null) {
-  std::deque<LogItem> local;
-  {
-    std::lock_guard<std::mutex> lk(g_log_mtx);
-    local.swap(g_log_q);
+  flush_log_repeats(false);
+  LogRecord rec;
+  bool any = false;
+  while (g_log_ring.pop(rec)) {
+    if (!any) {
+      // clear current line once so the prompt vanishes while we print logs
+      std::fputs("\r\033[K", stdout);  // CR + clear-to-end-of-line
+      any = true;
+    }
+    std::ostream& os = (rec.level == LogLevel::Error) ? std::cerr : std::cout;
+    write_log_line(rec.level, rec.text, os);
   }
 
-  if (local.empty()) return false;
-
-  // clear current line once so the prompt vanishes while we print logs
-  std::fputs("\r\033[K", stdout);  // CR + clear-to-end-of-line
-
-  for (auto& it : local) {
-    std::ostream& os = (it.level == LogLevel::Error) ? std::cerr : std::cout;
-    write_log_line(it.level, it.text, os);
+  const std::uint64_t dropped = g_log_dropped.load(std::memory_order_relaxed);
+  if (dropped != g_log_dropped_reported) {
+    if (!any) std::fputs("\r\033[K", stdout);
+    any = true;
+    write_log_line(LogLevel::Warn,
+                   "[LOG] " + std::to_string(dropped - g_log_dropped_reported) +
+                       " message(s) dropped, log ring full",
+                   std::cout);
+    g_log_dropped_reported = dropped;
   }
+
+  if (!any) return false;
   std::cout.flush();
   std::cerr.flush();
 
@@ -1948,15 +3348,6 @@ static inline bool drain_logs_and_refresh(EditLine* el_or_null) {
   return true;
 }
 
-
-// Optional: blocking wait-with-timeout to reduce busy looping
-static inline void wait_for_logs_or_timeout(int ms) {
-  std::unique_lock<std::mutex> lk(g_log_mtx);
-  if (g_log_q.empty()) {
-    g_log_cv.wait_for(lk, std::chrono::milliseconds(ms));
-  }
-}
-
 #ifndef SONSHELL_HEADLESS
 // ----------------------------
 // Live-view monitor helpers
@@ -2232,7 +3623,13 @@ static int my_getc(EditLine* el, char* c) {
       return 1;
     }
 
-    int r = poll(fds, nfds, -1);
+    // Wake up once a second while repeat summaries are outstanding.
+    int r = poll(fds, nfds, g_log_repeat_pending.load(std::memory_order_relaxed) ? 1000 : -1);
+    if (r == 0) {
+      flush_log_repeats(false);
+      (void)drain_logs_and_refresh(el);
+      continue;
+    }
     if (r < 0) {
       if (errno == EINTR) {
 	if (g_stop.load(std::memory_order_relaxed) || g_reconnect.load(std::memory_order_relaxed)) return 0; // make el_gets() exit
@@ -2315,12 +3712,19 @@ static void install_signal_handlers() {
   sigaction(SIGINT, &sa, nullptr);
   sigaction(SIGTERM, &sa, nullptr);
 
-  // Avoid zombies from post-cmd children
+  // Hook children are reaped (and timed) by the hook runner, so SIGCHLD must
+  // not be inherited as ignored.
   struct sigaction sa_chld{};
-  sa_chld.sa_handler = SIG_IGN;
+  sa_chld.sa_handler = SIG_DFL;
   sigemptyset(&sa_chld.sa_mask);
   sa_chld.sa_flags = 0;
   sigaction(SIGCHLD, &sa_chld, nullptr);
+
+  // A hook-server worker that dies must surface as EPIPE, not kill the shell.
+  struct sigaction sa_pipe{};
+  sa_pipe.sa_handler = SIG_IGN;
+  sigemptyset(&sa_pipe.sa_mask);
+  sigaction(SIGPIPE, &sa_pipe, nullptr);
 }
 
 // call this early in main, before starting inputThread:
@@ -2626,1032 +4030,3374 @@ static inline void interruptible_sleep(std::chrono::milliseconds total) {
 }
 
 // ----------------------------
-// Post-download command
+// Rating ledger & XMP sidecars
 // ----------------------------
-static void run_post_cmd_args(const std::string &path,
-                              const std::vector<std::string> &args) {
-  if (path.empty()) return;
-
-  pid_t pid = fork();
-  if (pid == 0) {
-    std::vector<char *> argv;
-    argv.reserve(args.size() + 2);
-    argv.push_back(const_cast<char *>(path.c_str()));
-    for (const auto &arg : args) {
-      argv.push_back(const_cast<char *>(arg.c_str()));
+// Last known star rating per (slot, contentId), persisted as an append-only
+// "slot contentId rating captured" log under ~/.cache/sonshell and compacted
+// on load. Content IDs restart with every card and body, so an entry only
+// counts when its capture date matches the item on the card.
+static std::string rating_ledger_path() {
+  return join_path(get_cache_dir(), "ratings.ledger");
+}
+
+constexpr std::size_t kRatingLedgerMaxChanges = 8;  // ledger-driven diffs larger than this are skipped
+
+static std::uint64_t rating_key(SDK::CrSlotNumber slot, CrInt32u content_id) {
+  return (static_cast<std::uint64_t>(slot) << 32) | content_id;
+}
+
+static void load_rating_ledger() {
+  std::ifstream in(rating_ledger_path());
+  if (!in) return;
+  std::unordered_map<std::uint64_t, LedgerRating> ratings;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    unsigned slot = 0;
+    unsigned long content_id = 0;
+    LedgerRating entry;
+    // Lines without a capture date predate the fingerprint and can't be matched to an image.
+    if (!(fields >> slot >> content_id >> entry.rating >> entry.captured)) continue;
+    ratings[(static_cast<std::uint64_t>(slot) << 32) | (content_id & 0xFFFFFFFFul)] = entry;
+  }
+  in.close();
+
+  // Compact into a temp file and rename it over the log, so a crash or a full
+  // disk mid-write leaves the previous ledger intact.
+  const std::string path = rating_ledger_path();
+  const std::string tmp = path + ".tmp";
+  bool written = false;
+  {
+    std::ofstream out(tmp, std::ios::trunc);
+    for (const auto &entry : ratings) {
+      out << (entry.first >> 32) << ' ' << (entry.first & 0xFFFFFFFFu) << ' '
+          << entry.second.rating << ' ' << entry.second.captured << '\n';
     }
-    argv.push_back(nullptr);
-
-    execv(path.c_str(), argv.data());
-    _exit(127);
+    out.flush();
+    written = out.good();
   }
-  // parent: we don't wait (SIGCHLD is ignored)
-}
-
-static void run_post_cmd(const std::string &path,
-                         const std::string &file,
-                         const std::string &mode,
-                         const std::string &command,
-                         const std::string &old_value = {},
-                         const std::string &new_value = {}) {
-  std::vector<std::string> args{file, mode, command};
-  if (!old_value.empty() || !new_value.empty()) {
-    args.push_back(old_value);
-    if (!new_value.empty()) {
-      args.push_back(new_value);
-    }
+  std::error_code ec;
+  if (written) std::filesystem::rename(tmp, path, ec);
+  if (!written || ec) {
+    std::filesystem::remove(tmp, ec);
+    LOGW("[RATING] could not compact " << path << "; keeping it as is");
   }
-  run_post_cmd_args(path, args);
+  std::lock_guard<std::mutex> lk(g_rating_mtx);
+  g_last_known_ratings = std::move(ratings);
 }
 
-class QuietCallback : public SDK::IDeviceCallback {
-public:
-  SDK::CrDeviceHandle device_handle = 0;
-  bool verbose = false;
-
-  // handshake
-  std::mutex mtx;
-  std::condition_variable conn_cv;
-  bool connected = false;
-  bool conn_finished = false;
-  CrInt32u last_error_code = 0;
+static std::optional<int> ledger_rating(std::uint64_t key, std::uint64_t captured) {
+  std::lock_guard<std::mutex> lk(g_rating_mtx);
+  auto it = g_last_known_ratings.find(key);
+  if (it == g_last_known_ratings.end() || it->second.captured != captured) return std::nullopt;
+  return it->second.rating;
+}
 
-  // download sync
-  std::mutex dl_mtx;
-  std::condition_variable dl_cv;
-  bool dl_waiting = false;
-  CrInt32u dl_notify_code = 0;
-  CrInt32u dl_progress = 0;
-  std::string last_downloaded_file;
-  // inside class QuietCallback (near other dl_* fields)
-  CrInt32u dl_last_log_per = 101; // 0..100; 101 = "unset"
-  std::chrono::steady_clock::time_point dl_last_log_tp{};
-  std::string dl_current_label; // e.g., "PRIVATE/M4ROOT/CLIP/DSC01234.MP4"
-  std::chrono::steady_clock::time_point dl_start_tp{};
-  bool dl_any_progress = false;
-  std::string dl_current_mode;
-  std::string dl_current_operation;
-  
-  void OnConnected(SDK::DeviceConnectionVersioin v) override {
-    if (g_shutting_down.load()) return;
-    if (verbose) LOGI( "[CB] OnConnected v=" << v );
-    {
-      std::lock_guard<std::mutex> lk(mtx); connected = true; conn_finished = true;
+// Records ratings that differ from the ledger; one append for the whole batch.
+static void record_ratings(const std::vector<std::pair<std::uint64_t, LedgerRating>> &updates) {
+  std::ostringstream lines;
+  {
+    std::lock_guard<std::mutex> lk(g_rating_mtx);
+    for (const auto &u : updates) {
+      auto it = g_last_known_ratings.find(u.first);
+      if (it != g_last_known_ratings.end() && it->second.rating == u.second.rating &&
+          it->second.captured == u.second.captured) continue;
+      g_last_known_ratings[u.first] = u.second;
+      lines << (u.first >> 32) << ' ' << (u.first & 0xFFFFFFFFu) << ' '
+            << u.second.rating << ' ' << u.second.captured << '\n';
     }
-    conn_cv.notify_all();
   }
+  std::string text = lines.str();
+  if (text.empty()) return;
+  std::error_code ec;
+  std::filesystem::create_directories(get_cache_dir(), ec);
+  std::ofstream out(rating_ledger_path(), std::ios::app);
+  out << text;
+}
 
-  void OnDisconnected(CrInt32u error) override {
-    if (g_shutting_down.load()) return;
-    if (verbose) {
-      LOGI( "[CB] OnDisconnected: 0x" << std::hex << error << std::dec << " (" << crsdk_err::error_to_name(error) << ")" );
-    }
-    {
-      std::lock_guard<std::mutex> lk(mtx); last_error_code = error; conn_finished = true;
-    }
-    conn_cv.notify_all();
-    {
-      std::lock_guard<std::mutex> lk(dl_mtx); dl_waiting = false;
-    }
-    dl_cv.notify_all();
-    g_reconnect.store(true);
-  }
+static std::string xmp_sidecar_path(const std::string &media_path) {
+  std::filesystem::path p(media_path);
+  p.replace_extension(".xmp");
+  return p.string();
+}
 
-  void OnWarning(CrInt32u w) override {
-    if (g_shutting_down.load()) return;
-    if (verbose) {
-      LOGI( "[CB] OnWarning: " << crsdk_err::warning_to_name(w) << " (0x" << std::hex << w << std::dec << ")" );
+enum class SidecarResult { Created, Updated, Unchanged, Skipped, Failed };
+
+// Writes xmp:Rating into a sidecar, editing an existing packet in place when
+// one is present (attribute or element form) so other metadata survives.
+static SidecarResult write_xmp_rating(const std::string &sidecar, int rating) {
+  std::string xml;
+  {
+    std::ifstream in(sidecar, std::ios::binary);
+    if (in) xml.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+  const std::string value = std::to_string(rating);
+  std::string updated;
+  if (xml.empty()) {
+    if (rating <= 0) return SidecarResult::Skipped; // don't litter unrated files
+    updated =
+        "<?xpacket begin=\"\xEF\xBB\xBF\" id=\"W5M0MpCehiHzreSzNTczkc9d\"?>\n"
+        "<x:xmpmeta xmlns:x=\"adobe:ns:meta/\">\n"
+        " <rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\">\n"
+        "  <rdf:Description rdf:about=\"\"\n"
+        "    xmlns:xmp=\"http://ns.adobe.com/xap/1.0/\"\n"
+        "   xmp:Rating=\"" + value + "\"/>\n"
+        " </rdf:RDF>\n"
+        "</x:xmpmeta>\n"
+        "<?xpacket end=\"w\"?>\n";
+  } else {
+    updated = xml;
+    std::size_t pos;
+    if ((pos = updated.find("xmp:Rating=\"")) != std::string::npos) {
+      std::size_t begin = pos + 12;
+      std::size_t end = updated.find('"', begin);
+      if (end == std::string::npos) return SidecarResult::Failed;
+      updated.replace(begin, end - begin, value);
+    } else if ((pos = updated.find("<xmp:Rating>")) != std::string::npos) {
+      std::size_t begin = pos + 12;
+      std::size_t end = updated.find("</xmp:Rating>", begin);
+      if (end == std::string::npos) return SidecarResult::Failed;
+      updated.replace(begin, end - begin, value);
+    } else if ((pos = updated.find("<rdf:Description")) != std::string::npos) {
+      std::string attrs = " xmp:Rating=\"" + value + "\"";
+      if (updated.find("xmlns:xmp=") == std::string::npos) {
+        attrs = " xmlns:xmp=\"http://ns.adobe.com/xap/1.0/\"" + attrs;
+      }
+      updated.insert(pos + 16, attrs);
+    } else {
+      return SidecarResult::Failed;
     }
+    if (updated == xml) return SidecarResult::Unchanged;
   }
 
-  void OnWarningExt(CrInt32u warning, CrInt32 param1, CrInt32 param2, CrInt32 param3) override {
-    if (g_shutting_down.load()) return;
-    LOGI("[CB] OnWarningExt: " << crsdk_err::warning_to_name(warning)
-         << " (0x" << std::hex << warning << std::dec << ")"
-         << " p1=0x" << std::hex << param1
-         << " p2=0x" << param2
-         << " p3=0x" << param3 << std::dec
-         << " | p1=" << param1 << ", p2=" << param2 << ", p3=" << param3);
+  const std::string tmp = sidecar + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out) return SidecarResult::Failed;
+    out << updated;
+    if (!out.good()) return SidecarResult::Failed;
   }
+  std::error_code ec;
+  std::filesystem::rename(tmp, sidecar, ec);
+  if (ec) return SidecarResult::Failed;
+  return xml.empty() ? SidecarResult::Created : SidecarResult::Updated;
+}
 
-  void OnError(CrInt32u e) override {
-    if (g_shutting_down.load()) return;
-    LOGI( "[CB] OnError: " << crsdk_err::error_to_name(e) << " (0x" << std::hex << e << std::dec << ")" );
-    {
-      std::lock_guard<std::mutex> lk(mtx); last_error_code = e; conn_finished = true;
-    }
-    conn_cv.notify_all();
+// `ratings export`: one contents listing per slot, then sidecars for every
+// downloaded file written by a small worker pool.
+static int export_rating_sidecars(SDK::CrDeviceHandle handle, bool verbose) {
+  if (!ensure_sync_directory_configured("ratings export")) return 2;
+  if (!handle) {
+    LOGE("ratings export: camera handle unavailable");
+    return 2;
   }
 
-private:
-  void log_changed_properties_(const char *tag) {
-    if (!device_handle) return;
-    SDK::CrDeviceProperty *props = nullptr; CrInt32 nprop = 0;
-    auto er = SDK::GetDeviceProperties(device_handle, &props, &nprop);
-    if (er != SDK::CrError_None || nprop <= 0 || !props) return;
-    for (int i = 0; i < nprop; ++i) {
-      CrInt32u code = props[i].GetCode();
-      CrInt64u val = props[i].GetCurrentValue();
-      auto it = last_prop_vals.find(code);
-      bool had_prev = (it != last_prop_vals.end());
-      CrInt64u prev = had_prev ? it->second : 0;
-      if (!had_prev || prev != val) {
-      last_prop_vals[code] = val;
-        if (verbose) {
-          const char *name = crsdk_util::prop_code_to_name(code);
-          std::ostringstream msg;
-          msg << tag << ": " << name << " (0x" << std::hex << code << std::dec << ") -> "
-              << (long long)val;
-          if (had_prev) {
-            msg << " (prev=" << (long long)prev << ')';
-          }
-          LOGI(msg.str());
+  struct Job {
+    std::string sidecar;
+    int rating;
+  };
+  std::vector<Job> jobs;
+  std::unordered_map<std::string, std::size_t> seen; // RAW+JPEG pairs share one sidecar
+  std::size_t missing = 0;
+  for (auto slot : {SDK::CrSlotNumber_Slot1, SDK::CrSlotNumber_Slot2}) {
+    auto index = fetch_contents_index(handle, slot);
+    if (!index) continue;
+    for (std::size_t i = 0; i < index->size(); ++i) {
+      const int rating = index->ratings[i];
+      if (rating < 0) continue;
+      for (std::size_t f = index->files_begin(i); f < index->files_end(i); ++f) {
+        const std::string remote = index->file_path(f);
+        std::string local = join_path(g_download_dir, join_path(dirname_from_path(remote.c_str()),
+                                                                basename_from_path(remote.c_str())));
+        std::error_code ec;
+        if (!std::filesystem::exists(local, ec) || ec) {
+          ++missing;
+          continue;
         }
-        if (code == SDK::CrDeviceProperty_CameraButtonFunctionStatus) {
-          auto status = static_cast<CrInt16u>(val & 0xFFFF);
-          if (status == SDK::CrCameraButtonFunctionStatus_AnyKeyOn) {
-            schedule_playback_button_job();
-          }
+        std::string sidecar = xmp_sidecar_path(local);
+        auto ins = seen.emplace(sidecar, jobs.size());
+        if (ins.second) {
+          jobs.push_back(Job{sidecar, rating});
+        } else {
+          jobs[ins.first->second].rating = std::max(jobs[ins.first->second].rating, rating);
         }
       }
     }
-    SDK::ReleaseDeviceProperties(device_handle, props);
   }
 
-public:
-  
-  void OnPropertyChanged() override {
-    if (!g_shutting_down.load()) log_changed_properties_("[CB] OnPropertyChanged");
+  std::array<std::atomic<std::size_t>, 5> counts{};
+  std::atomic<std::size_t> next{0};
+  unsigned workers = std::max(1u, std::min(8u, std::thread::hardware_concurrency()));
+  workers = static_cast<unsigned>(std::min<std::size_t>(workers, std::max<std::size_t>(jobs.size(), 1)));
+  std::vector<std::thread> pool;
+  for (unsigned w = 0; w < workers; ++w) {
+    pool.emplace_back([&]() {
+      for (std::size_t j = next.fetch_add(1); j < jobs.size(); j = next.fetch_add(1)) {
+        SidecarResult r = write_xmp_rating(jobs[j].sidecar, jobs[j].rating);
+        counts[static_cast<std::size_t>(r)].fetch_add(1, std::memory_order_relaxed);
+        if (r == SidecarResult::Failed) {
+          LOGW("ratings export: could not update " << jobs[j].sidecar);
+        } else if (verbose && r != SidecarResult::Unchanged && r != SidecarResult::Skipped) {
+          LOGI("[XMP] " << jobs[j].sidecar << " rating=" << jobs[j].rating);
+        }
+      }
+    });
   }
-  
-  void OnLvPropertyChanged() override {
-    if (!g_shutting_down.load()) log_changed_properties_("[CB] OnLvPropertyChanged");
+  for (auto &t : pool) t.join();
+
+  LOGI("ratings export: " << counts[0] << " created, " << counts[1] << " updated, "
+       << counts[2] << " unchanged, " << counts[3] << " unrated, "
+       << missing << " not downloaded"
+       << (counts[4] ? ", " + std::to_string(counts[4].load()) + " failed" : std::string()));
+  return counts[4] ? 1 : 0;
+}
+
+// ----------------------------
+// Property recorder
+// ----------------------------
+// `props record <file>` appends every property change to a compact binary
+// log. The callback only queues the changed (code, value) pairs; a writer
+// thread encodes and flushes them, so callback latency does not move.
+//
+// Layout: "SNPR" magic once per file, then records:
+//   0xA5 session  u8 version, varint epoch_ms          (delta state resets)
+//   0x5A frame    varint dt_ms, varint n,
+//                 n x (varint code - previous code, zigzag varint value delta)
+// Codes within a frame are ascending; value deltas are against the last value
+// recorded for the same code in the session (0 before the first).
+static constexpr char kPropLogMagic[4] = {'S', 'N', 'P', 'R'};
+static constexpr std::uint8_t kPropLogSession = 0xA5;
+static constexpr std::uint8_t kPropLogFrame = 0x5A;
+static constexpr std::uint8_t kPropLogVersion = 1;
+static constexpr std::size_t kPropLogMaxPending = 4096;
+
+struct PropFrame {
+  std::uint64_t epoch_ms = 0;
+  std::vector<std::pair<CrInt32u, CrInt64u>> changes;
+};
+
+static std::atomic<bool> g_prop_rec_active{false};
+static std::mutex g_prop_rec_mtx;
+static std::condition_variable g_prop_rec_cv;
+static std::deque<PropFrame> g_prop_rec_q;
+static std::thread g_prop_rec_thread;
+static std::string g_prop_rec_path;
+static bool g_prop_rec_stop = false;
+static std::atomic<std::uint64_t> g_prop_rec_frames{0};
+static std::atomic<std::uint64_t> g_prop_rec_dropped{0};
+
+static std::uint64_t epoch_now_ms() {
+  return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+static void put_varint(std::string &out, std::uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+    v >>= 7;
   }
+  out.push_back(static_cast<char>(v));
+}
 
-  void schedule_playback_button_job() {
-    if (g_shutting_down.load()) return;
-    g_downloadThreads.emplace_back([this]() {
-      this->process_playback_button_job();
-    });
+static bool get_varint(const std::string &in, std::size_t &pos, std::uint64_t &v) {
+  v = 0;
+  for (unsigned shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+    auto b = static_cast<std::uint8_t>(in[pos++]);
+    v |= static_cast<std::uint64_t>(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
   }
+  return false;
+}
 
-  bool download_single_content_file(SDK::CrSlotNumber slot,
-                                    const SDK::CrContentsInfo &info,
-                                    const SDK::CrContentsFile &file,
-                                    std::string &local_path,
-                                    bool skip_existing) {
-    std::string orig = basename_from_path(file.filePath);
-    if (orig.empty()) {
-      std::ostringstream o;
-      o << "content_" << static_cast<unsigned long long>(info.contentId)
-        << "_file_" << file.fileId;
-      orig = o.str();
-    }
+static std::uint64_t zigzag(std::int64_t v) {
+  return (static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63);
+}
 
-    std::string relDir = dirname_from_path(file.filePath);
-    std::string destDir = g_download_dir;
-    if (!relDir.empty()) {
-      destDir = destDir.empty() ? relDir : join_path(destDir, relDir);
-    }
+static std::int64_t unzigzag(std::uint64_t v) {
+  return static_cast<std::int64_t>(v >> 1) ^ -static_cast<std::int64_t>(v & 1);
+}
 
-    std::error_code ec;
-    if (!destDir.empty()) {
-      std::filesystem::create_directories(destDir, ec);
+// Called from the property callback: a flag test when idle, one short
+// critical section otherwise. Frames are dropped (and counted) rather than
+// letting a stalled disk grow the queue without bound.
+static void prop_recorder_push(PropFrame frame) {
+  if (!g_prop_rec_active.load(std::memory_order_relaxed) || frame.changes.empty()) return;
+  {
+    std::lock_guard<std::mutex> lk(g_prop_rec_mtx);
+    if (g_prop_rec_q.size() >= kPropLogMaxPending) {
+      g_prop_rec_dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
     }
+    g_prop_rec_q.push_back(std::move(frame));
+  }
+  g_prop_rec_cv.notify_one();
+}
 
-    std::string finalName = orig;
-    std::string candidatePath = join_path(destDir, finalName);
-    local_path = candidatePath;
+// Full frame from the property snapshot so a recording (or a reconnect in
+// the middle of one) starts from absolute values.
+static void prop_recorder_push_baseline() {
+  if (!g_prop_rec_active.load(std::memory_order_relaxed)) return;
+  auto snap = property_snapshot();
+  if (!snap) return;
+  PropFrame frame;
+  frame.epoch_ms = epoch_now_ms();
+  for (std::size_t slot = 0; slot < snap->slots.size(); ++slot) {
+    if (snap->slots[slot].supported) {
+      frame.changes.emplace_back(crsdk_util::kPropSlotCodes[slot], snap->slots[slot].value);
+    }
+  }
+  for (const auto &entry : snap->extra) {
+    if (entry.second.supported) frame.changes.emplace_back(entry.first, entry.second.value);
+  }
+  prop_recorder_push(std::move(frame));
+}
 
-    if (skip_existing) {
-      std::error_code exists_ec;
-      if (std::filesystem::exists(candidatePath, exists_ec) && !exists_ec) {
-        return true;
+static void prop_recorder_main(std::ofstream out) {
+  std::unordered_map<CrInt32u, CrInt64u> last;
+  std::uint64_t last_ms = 0;
+  bool first = true;
+  std::string buf;
+  for (;;) {
+    std::deque<PropFrame> batch;
+    {
+      std::unique_lock<std::mutex> lk(g_prop_rec_mtx);
+      g_prop_rec_cv.wait(lk, [] { return g_prop_rec_stop || !g_prop_rec_q.empty(); });
+      batch.swap(g_prop_rec_q);
+      if (batch.empty() && g_prop_rec_stop) break;
+    }
+    buf.clear();
+    for (auto &frame : batch) {
+      if (first) {
+        buf.push_back(static_cast<char>(kPropLogSession));
+        buf.push_back(static_cast<char>(kPropLogVersion));
+        put_varint(buf, frame.epoch_ms);
+        last_ms = frame.epoch_ms;
+        first = false;
+      }
+      std::sort(frame.changes.begin(), frame.changes.end());
+      buf.push_back(static_cast<char>(kPropLogFrame));
+      put_varint(buf, frame.epoch_ms >= last_ms ? frame.epoch_ms - last_ms : 0);
+      last_ms = std::max(last_ms, frame.epoch_ms);
+      put_varint(buf, frame.changes.size());
+      CrInt32u prev_code = 0;
+      for (const auto &change : frame.changes) {
+        CrInt64u &prev = last[change.first];
+        put_varint(buf, change.first - prev_code);
+        put_varint(buf, zigzag(static_cast<std::int64_t>(change.second - prev)));
+        prev_code = change.first;
+        prev = change.second;
       }
     }
+    out.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+    out.flush();
+    if (!out) {
+      LOGE("props record: write to " << g_prop_rec_path << " failed; recording stopped");
+      g_prop_rec_active.store(false, std::memory_order_relaxed);
+      break;
+    }
+    g_prop_rec_frames.fetch_add(batch.size(), std::memory_order_relaxed);
+  }
+}
 
-    dl_waiting = true;
-    dl_current_label = join_path(relDir, finalName);
-    dl_last_log_per = 101;
-    dl_last_log_tp = std::chrono::steady_clock::now();
-    dl_start_tp = dl_last_log_tp;
-    dl_any_progress = false;
-
-    CrChar *saveDir = destDir.empty()
-                        ? nullptr
-                        : const_cast<CrChar *>(reinterpret_cast<const CrChar *>(destDir.c_str()));
-    CrChar *fileName = const_cast<CrChar *>(reinterpret_cast<const CrChar *>(finalName.c_str()));
+static void prop_recorder_stop() {
+  if (!g_prop_rec_thread.joinable()) return;
+  g_prop_rec_active.store(false, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lk(g_prop_rec_mtx);
+    g_prop_rec_stop = true;
+  }
+  g_prop_rec_cv.notify_one();
+  g_prop_rec_thread.join();
+  LOGI("props record: stopped; " << g_prop_rec_frames.load() << " frame(s) written to "
+       << g_prop_rec_path
+       << (g_prop_rec_dropped.load() ? " (" + std::to_string(g_prop_rec_dropped.load()) + " dropped)"
+                                     : std::string()));
+}
+
+static bool prop_recorder_start(const std::string &path) {
+  prop_recorder_stop();
+  std::error_code ec;
+  bool fresh = !std::filesystem::exists(path, ec) || std::filesystem::file_size(path, ec) == 0;
+  std::ofstream out(path, std::ios::binary | std::ios::app);
+  if (!out) {
+    LOGE("props record: cannot open " << path);
+    return false;
+  }
+  if (fresh) out.write(kPropLogMagic, sizeof(kPropLogMagic));
+  {
+    std::lock_guard<std::mutex> lk(g_prop_rec_mtx);
+    g_prop_rec_q.clear();
+    g_prop_rec_stop = false;
+  }
+  g_prop_rec_path = path;
+  g_prop_rec_frames.store(0, std::memory_order_relaxed);
+  g_prop_rec_dropped.store(0, std::memory_order_relaxed);
+  g_prop_rec_active.store(true, std::memory_order_relaxed);
+  g_prop_rec_thread = std::thread(prop_recorder_main, std::move(out));
+  prop_recorder_push_baseline();
+  LOGI("props record: " << (fresh ? "writing " : "appending to ") << path);
+  return true;
+}
 
-    SDK::CrError err = SDK::GetRemoteTransferContentsDataFile(
-        device_handle, slot, info.contentId, file.fileId, 0x1000000,
-        saveDir, fileName);
-    if (err != SDK::CrError_None) {
-      dl_waiting = false;
-      LOGE("GetRemoteTransferContentsDataFile failed: "
-           << crsdk_err::error_to_name(err) << " (0x" << std::hex << err << std::dec << ")");
-      return false;
+// Expands a recording into "epoch_ms,elapsed_ms,code,name,value" rows.
+static int prop_recorder_decode(const std::string &in_path, const std::string &csv_path) {
+  std::ifstream in(in_path, std::ios::binary);
+  if (!in) {
+    LOGE("props decode: cannot open " << in_path);
+    return 2;
+  }
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  if (data.size() < sizeof(kPropLogMagic) ||
+      std::memcmp(data.data(), kPropLogMagic, sizeof(kPropLogMagic)) != 0) {
+    LOGE("props decode: " << in_path << " is not a property recording");
+    return 2;
+  }
+  std::ofstream csv(csv_path, std::ios::trunc);
+  if (!csv) {
+    LOGE("props decode: cannot write " << csv_path);
+    return 2;
+  }
+  csv << "epoch_ms,elapsed_ms,code,name,value\n";
+
+  std::unordered_map<CrInt32u, CrInt64u> last;
+  std::uint64_t start_ms = 0, now_ms = 0, rows = 0, sessions = 0;
+  bool truncated = false;
+  std::size_t pos = sizeof(kPropLogMagic);
+  while (pos < data.size() && !truncated) {
+    auto tag = static_cast<std::uint8_t>(data[pos++]);
+    if (tag == kPropLogSession) {
+      std::uint64_t epoch = 0;
+      if (pos >= data.size() || static_cast<std::uint8_t>(data[pos++]) != kPropLogVersion ||
+          !get_varint(data, pos, epoch)) {
+        truncated = true;
+        break;
+      }
+      last.clear();
+      start_ms = now_ms = epoch;
+      ++sessions;
+      continue;
     }
-
-    {
-      std::unique_lock<std::mutex> lk(dl_mtx);
-      dl_cv.wait(lk, [&] { return !dl_waiting || g_stop.load(); });
+    std::uint64_t dt = 0, n = 0;
+    if (tag != kPropLogFrame || sessions == 0 || !get_varint(data, pos, dt) ||
+        !get_varint(data, pos, n)) {
+      truncated = true;
+      break;
     }
-
-    if (g_stop.load(std::memory_order_relaxed)) return false;
-
-    if (!last_downloaded_file.empty()) {
-      local_path = last_downloaded_file;
+    now_ms += dt;
+    CrInt32u code = 0;
+    for (std::uint64_t i = 0; i < n; ++i) {
+      std::uint64_t code_delta = 0, value_delta = 0;
+      if (!get_varint(data, pos, code_delta) || !get_varint(data, pos, value_delta)) {
+        truncated = true;
+        break;
+      }
+      code += static_cast<CrInt32u>(code_delta);
+      CrInt64u &value = last[code];
+      value += static_cast<CrInt64u>(unzigzag(value_delta));
+      csv << now_ms << ',' << (now_ms - start_ms) << ",0x" << std::hex << code << std::dec << ','
+          << crsdk_util::prop_code_to_name(code) << ',' << static_cast<long long>(value) << '\n';
+      ++rows;
     }
-    return true;
   }
+  if (truncated) {
+    LOGW("props decode: " << in_path << " ends in an incomplete record; decoded what precedes it");
+  }
+  LOGI("props decode: " << rows << " change(s) from " << sessions << " session(s) -> " << csv_path);
+  return truncated ? 1 : 0;
+}
 
-  void process_playback_button_job() {
-    if (g_shutting_down.load()) return;
-    std::this_thread::sleep_for(std::chrono::milliseconds(200));
-    if (g_shutting_down.load()) return;
-    if (!device_handle) return;
-
-    auto playback_mode = fetch_property(device_handle, SDK::CrDeviceProperty_CameraOperatingMode);
-    auto playback_media = fetch_property(device_handle, SDK::CrDeviceProperty_PlaybackMedia);
-    SDK::CrSlotNumber slot = SDK::CrSlotNumber_Slot1;
-    if (playback_media.supported &&
-        playback_media.value == SDK::CrPlaybackMedia_Slot2) {
-      slot = SDK::CrSlotNumber_Slot2;
-    }
-
-    CrInt32u update_code = (slot == SDK::CrSlotNumber_Slot2)
-                               ? SDK::CrDeviceProperty_MediaSLOT2_ContentsInfoListUpdateTime
-                               : SDK::CrDeviceProperty_MediaSLOT1_ContentsInfoListUpdateTime;
+// ----------------------------
+// Post-download command
+// ----------------------------
+// Hook processes are started with posix_spawn (no copy of the SDK/OpenCV
+// address space), at most g_hook_max_inflight at a time; the rest wait in a
+// FIFO. A reaper thread collects exit status and runtime for `metrics`.
+// Shared state a hook needs until it exits (e.g. a batch argument file);
+// released once the last process using it has been reaped.
+using HookAttachment = std::shared_ptr<const void>;
+
+struct HookJob {
+  std::string exe;
+  std::vector<std::string> args;  // excluding argv[0]
+  bool new_session = false;
+  HookAttachment attachment;
+};
 
-    auto &last_update = (slot == SDK::CrSlotNumber_Slot2) ? g_last_contents_update_slot2
-                                                         : g_last_contents_update_slot1;
-    const int kMaxAttempts = 8;
-    const std::chrono::milliseconds kRetryDelay(200);
-    bool have_initial = false;
-    int initial_rating = 0;
-    std::string local_path;
+struct HookRunning {
+  std::string name;
+  std::chrono::steady_clock::time_point started;
+  HookAttachment attachment;
+};
 
-    SDK::CrContentsInfo *list = nullptr;
+static constexpr std::size_t kHookDurationSamples = 512;
+
+static std::atomic<int> g_hook_max_inflight{
+    static_cast<int>(std::max(2u, std::thread::hardware_concurrency()))};
+static std::mutex g_hook_mtx;
+static std::condition_variable g_hook_cv;
+static std::deque<HookJob> g_hook_pending;
+static std::unordered_map<pid_t, HookRunning> g_hook_running;
+// Long-lived children (the hook server) that are reaped here too, so their
+// exit is not lost to waitpid(-1); not counted against the in-flight limit.
+static std::unordered_map<pid_t, std::function<void(int)>> g_hook_watched;
+static std::thread g_hook_reaper;
+static bool g_hook_stop = false;
+
+struct HookStats {
+  std::uint64_t launched = 0;
+  std::uint64_t spawn_failed = 0;
+  std::uint64_t failed = 0;        // non-zero exit or killed by a signal
+  std::size_t peak_pending = 0;
+  std::vector<double> durations_ms;  // ring of the latest runtimes
+  std::size_t next_sample = 0;
+};
+static HookStats g_hook_stats;
+
+// The shell threads keep SIGINT blocked; hooks start with a clean mask and
+// default dispositions. Caller destroys the attributes.
+static void init_hook_spawnattr(posix_spawnattr_t &attr, bool new_session) {
+  posix_spawnattr_init(&attr);
+  sigset_t none, defaults;
+  sigemptyset(&none);
+  sigemptyset(&defaults);
+  for (int sig : {SIGINT, SIGTERM, SIGCHLD, SIGPIPE}) sigaddset(&defaults, sig);
+  posix_spawnattr_setsigmask(&attr, &none);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+  if (new_session) {
+#ifdef POSIX_SPAWN_SETSID
+    flags |= POSIX_SPAWN_SETSID;
+#else
+    flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setpgroup(&attr, 0);
+#endif
+  }
+  posix_spawnattr_setflags(&attr, flags);
+}
+
+// Caller holds g_hook_mtx.
+static void start_hook_locked(HookJob job) {
+  std::vector<char *> argv;
+  argv.reserve(job.args.size() + 2);
+  argv.push_back(const_cast<char *>(job.exe.c_str()));
+  for (auto &arg : job.args) argv.push_back(const_cast<char *>(arg.c_str()));
+  argv.push_back(nullptr);
+
+  posix_spawnattr_t attr;
+  init_hook_spawnattr(attr, job.new_session);
+  pid_t pid = 0;
+  int rc = posix_spawn(&pid, job.exe.c_str(), nullptr, &attr, argv.data(), environ);
+  posix_spawnattr_destroy(&attr);
+  if (rc != 0) {
+    ++g_hook_stats.spawn_failed;
+    LOGE("hook: cannot start " << job.exe << ": " << std::strerror(rc));
+    return;
+  }
+  ++g_hook_stats.launched;
+  g_hook_running[pid] = {basename_from_path(job.exe.c_str()), std::chrono::steady_clock::now(),
+                         std::move(job.attachment)};
+}
 
-    auto release_list = [&](SDK::CrContentsInfo *&ptr) {
-      if (ptr) {
-        SDK::ReleaseRemoteTransferContentsInfoList(device_handle, ptr);
-        ptr = nullptr;
-      }
-    };
+// Caller holds g_hook_mtx.
+static void start_pending_hooks_locked() {
+  while (!g_hook_pending.empty() && !g_hook_stop &&
+         static_cast<int>(g_hook_running.size()) < g_hook_max_inflight.load()) {
+    HookJob next = std::move(g_hook_pending.front());
+    g_hook_pending.pop_front();
+    start_hook_locked(std::move(next));
+  }
+}
 
-    auto fetch_list = [&](SDK::CrContentsInfo *&out_list, CrInt32u &out_count) -> bool {
-      release_list(out_list);
-      SDK::CrCaptureDate dummy{};
-      SDK::CrError err = SDK::GetRemoteTransferContentsInfoList(
-          device_handle, slot, SDK::CrGetContentsInfoListType_All, &dummy, 0,
-          &out_list, &out_count);
-      if (err != SDK::CrError_None || !out_list || out_count == 0) return false;
-      return true;
-    };
+static void hook_reaper_main() {
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lk(g_hook_mtx);
+      g_hook_cv.wait(lk, [] {
+        return g_hook_stop || !g_hook_running.empty() || !g_hook_watched.empty();
+      });
+      if (g_hook_running.empty() && g_hook_watched.empty()) return;
+    }
+    int status = 0;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      if (errno == EINTR) continue;
+      // ECHILD: nothing left to wait for, whatever the table says.
+      std::lock_guard<std::mutex> lk(g_hook_mtx);
+      g_hook_running.clear();
+      g_hook_watched.clear();
+      start_pending_hooks_locked();
+      continue;
+    }
+    auto now = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lk(g_hook_mtx);
+    auto watched = g_hook_watched.find(pid);
+    if (watched != g_hook_watched.end()) {
+      auto on_exit = std::move(watched->second);
+      g_hook_watched.erase(watched);
+      lk.unlock();
+      on_exit(status);
+      continue;
+    }
+    auto it = g_hook_running.find(pid);
+    if (it == g_hook_running.end()) continue;
+    double ms = std::chrono::duration<double, std::milli>(now - it->second.started).count();
+    auto &stats = g_hook_stats;
+    if (stats.durations_ms.size() < kHookDurationSamples) {
+      stats.durations_ms.push_back(ms);
+    } else {
+      stats.durations_ms[stats.next_sample] = ms;
+    }
+    stats.next_sample = (stats.next_sample + 1) % kHookDurationSamples;
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+      ++stats.failed;
+      LOGW("hook: " << it->second.name << " exited with status " << WEXITSTATUS(status)
+           << " after " << static_cast<long long>(ms) << " ms");
+    } else if (WIFSIGNALED(status)) {
+      ++stats.failed;
+      LOGW("hook: " << it->second.name << " killed by signal " << WTERMSIG(status));
+    }
+    g_hook_running.erase(it);
+    start_pending_hooks_locked();
+  }
+}
 
-    auto match_file_by_path = [&](const SDK::CrContentsInfo *info,
-                                  const std::string &path) -> const SDK::CrContentsFile * {
-      if (!info) return nullptr;
-      if (path.empty()) return nullptr;
-      for (CrInt32u fi = 0; fi < info->filesNum; ++fi) {
-        const char *fp = reinterpret_cast<const char *>(info->files[fi].filePath);
-        if (!fp) continue;
-        if (path == fp) {
-          return &info->files[fi];
-        }
-      }
-      return nullptr;
-    };
+// Caller holds g_hook_mtx.
+static void ensure_hook_reaper_locked() {
+  if (!g_hook_reaper.joinable()) g_hook_reaper = std::thread(hook_reaper_main);
+}
 
-    bool handled = false;
-    for (int attempt = 0; attempt < kMaxAttempts && !g_shutting_down.load(); ++attempt) {
-      auto playback_name = fetch_property(device_handle, SDK::CrDeviceProperty_PlaybackContentsName);
-      std::string playback_path = playback_name.text;
+// Caller holds g_hook_mtx and spawned `pid` under it, so the reaper cannot
+// collect the child before it is registered.
+static void watch_hook_child_locked(pid_t pid, std::function<void(int)> on_exit) {
+  ensure_hook_reaper_locked();
+  g_hook_watched[pid] = std::move(on_exit);
+  g_hook_cv.notify_one();
+}
 
-      auto update_prop = fetch_property(device_handle, update_code);
-      if (!update_prop.supported || update_prop.value == 0) {
-        release_list(list);
-        if (attempt + 1 < kMaxAttempts) {
-          std::this_thread::sleep_for(kRetryDelay);
-          continue;
-        }
-        return;
-      }
+static void spawn_hook(HookJob job) {
+  if (job.exe.empty()) return;
+  std::lock_guard<std::mutex> lk(g_hook_mtx);
+  if (g_hook_stop) return;
+  ensure_hook_reaper_locked();
+  if (static_cast<int>(g_hook_running.size()) < g_hook_max_inflight.load() &&
+      g_hook_pending.empty()) {
+    start_hook_locked(std::move(job));
+  } else {
+    g_hook_pending.push_back(std::move(job));
+    g_hook_stats.peak_pending = std::max(g_hook_stats.peak_pending, g_hook_pending.size());
+  }
+  g_hook_cv.notify_one();
+}
 
-      std::uint64_t update_time = static_cast<std::uint64_t>(update_prop.value);
-      if (last_update.load(std::memory_order_relaxed) == update_time) {
-        release_list(list);
-        if (attempt + 1 < kMaxAttempts) {
-          std::this_thread::sleep_for(kRetryDelay);
-          continue;
-        }
-        return;
-      }
+// Queued hooks that never started are dropped; running ones are left to
+// finish on their own.
+static void stop_hook_runner() {
+  std::size_t dropped = 0, running = 0;
+  {
+    std::lock_guard<std::mutex> lk(g_hook_mtx);
+    if (g_hook_stop) return;
+    g_hook_stop = true;
+    dropped = g_hook_pending.size();
+    g_hook_pending.clear();
+    running = g_hook_running.size() + g_hook_watched.size();
+  }
+  g_hook_cv.notify_all();
+  if (dropped) LOGW("hook: dropping " << dropped << " queued hook(s) on exit");
+  if (!g_hook_reaper.joinable()) return;
+  if (running) g_hook_reaper.detach();
+  else g_hook_reaper.join();
+}
 
-      CrInt32u count = 0;
-      if (!fetch_list(list, count)) {
-        release_list(list);
-        if (attempt + 1 < kMaxAttempts) {
-          std::this_thread::sleep_for(kRetryDelay);
-          continue;
-        }
-        return;
-      }
+static void run_post_cmd_args(const std::string &path,
+                              const std::vector<std::string> &args,
+                              HookAttachment attachment = nullptr) {
+  if (path.empty()) return;
+  spawn_hook({path, args, false, std::move(attachment)});
+}
 
-      SDK::CrCaptureDate target_stamp(update_time);
-      const SDK::CrContentsInfo *update_info = nullptr;
-      const SDK::CrContentsFile *update_file = nullptr;
-      const SDK::CrContentsInfo *path_info = nullptr;
-      const SDK::CrContentsFile *path_file = nullptr;
-      const SDK::CrContentsInfo *latest_info = nullptr;
-
-      for (CrInt32u i = 0; i < count; ++i) {
-        const SDK::CrContentsInfo &info = list[i];
-        if (!latest_info || capture_date_newer(info.modificationDatetimeUTC,
-                                               latest_info->modificationDatetimeUTC)) {
-          latest_info = &info;
-        }
+// ----------------------------
+// Hook rules
+// ----------------------------
+// Native replacement for scripts/broadcast.sh: `--rules <broadcast.yml>` loads
+// the same nested glob tree (rules: path -> mode -> operation -> new -> old)
+// once, matches each hook event in-process and launches only the handlers.
+// The file is re-read whenever its mtime changes; a broken edit keeps the
+// previous rules. Only the YAML that broadcast.yml uses is understood: block
+// mappings, block and flow sequences, "- key: value" list items, quoted/plain
+// scalars and comments.
+struct HookRule {
+  std::vector<std::string> path;     // glob per event argument
+  std::vector<std::string> scripts;  // handler command lines
+  std::string name;
+  bool batch = false;                // takes "--batch sync ..." events (--sync-batch)
+};
 
-        const SDK::CrContentsFile *matched = match_file_by_path(&info, playback_path);
-        if (matched && !path_info) {
-          path_info = &info;
-          path_file = matched;
-        }
+struct RulesFile {
+  std::string path;
+  std::string dir;
+  std::filesystem::file_time_type mtime{};
+  bool loaded = false;
+  std::shared_ptr<const std::vector<HookRule>> rules;
+};
 
-        if (update_time != 0 && !update_info &&
-            capture_date_equal(info.modificationDatetimeUTC, target_stamp)) {
-          update_info = &info;
-          update_file = matched;
-          if (!update_file && info.filesNum > 0) {
-            update_file = &info.files[0];
-          }
-        }
-      }
+static std::mutex g_rules_mtx;
+static RulesFile g_rules;
 
-      const SDK::CrContentsInfo *target_info = nullptr;
-      const SDK::CrContentsFile *target_file = nullptr;
+struct YamlNode {
+  enum class Kind { Null, Scalar, List, Map } kind = Kind::Null;
+  std::string scalar;
+  std::vector<YamlNode> items;
+  std::vector<std::pair<std::string, YamlNode>> entries;
+};
 
-      if (path_info) {
-        target_info = path_info;
-        target_file = path_file;
-      }
-      if (update_info) {
-        target_info = update_info;
-        target_file = update_file;
-      }
-      if (!target_info && latest_info) {
-        target_info = latest_info;
-        if (latest_info->filesNum > 0) {
-          target_file = &latest_info->files[0];
-        }
-      }
+struct YamlLine {
+  int indent = 0;
+  int number = 0;
+  std::string text;
+};
 
-      if (!target_info || !target_file) {
-        if (attempt + 1 < kMaxAttempts) {
-          std::this_thread::sleep_for(kRetryDelay);
-          continue;
-        }
-        release_list(list);
-        return;
+// Cuts a trailing " # comment" that is not inside quotes.
+static std::string yaml_strip_comment(const std::string &line) {
+  char quote = 0;
+  for (std::size_t i = 0; i < line.size(); ++i) {
+    char c = line[i];
+    if (quote) {
+      if (c == '\\' && quote == '"' && i + 1 < line.size()) ++i;
+      else if (c == quote) quote = 0;
+    } else if (c == '"' || c == '\'') {
+      quote = c;
+    } else if (c == '#' && (i == 0 || std::isspace(static_cast<unsigned char>(line[i - 1])))) {
+      return line.substr(0, i);
+    }
+  }
+  return line;
+}
+
+static std::string yaml_unquote(std::string text) {
+  text = trim_copy(text);
+  if (text.size() >= 2 && text.front() == '"' && text.back() == '"') {
+    std::string out;
+    for (std::size_t i = 1; i + 1 < text.size(); ++i) {
+      char c = text[i];
+      if (c == '\\' && i + 2 < text.size()) {
+        char e = text[++i];
+        out.push_back(e == 'n' ? '\n' : e == 't' ? '\t' : e);
+      } else {
+        out.push_back(c);
       }
-
-      std::string match_reason;
-      if (target_info == path_info && path_info && target_info != update_info) {
-        match_reason = "Matched by playback path.";
-      } else if (target_info == update_info && update_info) {
-        match_reason = "Matched by update timestamp.";
-      } else if (target_info == latest_info && latest_info) {
-        match_reason = "Falling back to most recently modified content.";
+    }
+    return out;
+  }
+  if (text.size() >= 2 && text.front() == '\'' && text.back() == '\'') {
+    std::string out;
+    for (std::size_t i = 1; i + 1 < text.size(); ++i) {
+      out.push_back(text[i]);
+      if (text[i] == '\'' && text[i + 1] == '\'') ++i;
+    }
+    return out;
+  }
+  return text;
+}
+
+// Position of the ':' that ends a mapping key, or npos.
+static std::size_t yaml_key_colon(const std::string &text) {
+  char quote = 0;
+  for (std::size_t i = 0; i < text.size(); ++i) {
+    char c = text[i];
+    if (quote) {
+      if (c == '\\' && quote == '"' && i + 1 < text.size()) ++i;
+      else if (c == quote) quote = 0;
+    } else if (c == '"' || c == '\'') {
+      quote = c;
+    } else if (c == ':' && (i + 1 == text.size() || text[i + 1] == ' ')) {
+      return i;
+    }
+  }
+  return std::string::npos;
+}
+
+static bool yaml_is_item(const std::string &text) {
+  return text == "-" || text.rfind("- ", 0) == 0;
+}
+
+static YamlNode yaml_scalar_or_flow(const std::string &raw) {
+  YamlNode node;
+  std::string text = trim_copy(raw);
+  if (text.empty() || text == "~" || text == "null") return node;
+  if (text.front() == '[' && text.back() == ']') {
+    node.kind = YamlNode::Kind::List;
+    std::string inner = text.substr(1, text.size() - 2);
+    std::string cur;
+    char quote = 0;
+    for (std::size_t i = 0; i <= inner.size(); ++i) {
+      char c = i < inner.size() ? inner[i] : ',';
+      if (quote) {
+        if (c == '\\' && quote == '"' && i + 1 < inner.size()) { cur.push_back(c); c = inner[++i]; }
+        else if (c == quote) quote = 0;
+        cur.push_back(c);
+      } else if (c == '"' || c == '\'') {
+        quote = c;
+        cur.push_back(c);
+      } else if (c == ',') {
+        if (!trim_copy(cur).empty()) node.items.push_back(yaml_scalar_or_flow(cur));
+        cur.clear();
+      } else {
+        cur.push_back(c);
       }
+    }
+    return node;
+  }
+  node.kind = YamlNode::Kind::Scalar;
+  node.scalar = yaml_unquote(text);
+  return node;
+}
 
-      std::string candidate_remote_path;
-      if (target_file->filePath) {
-        candidate_remote_path = reinterpret_cast<const char *>(target_file->filePath);
-      }
+static YamlNode yaml_parse_block(const std::vector<YamlLine> &lines, std::size_t &i, int indent,
+                                 std::string &error);
 
-      if (!playback_path.empty() && !candidate_remote_path.empty() &&
-          candidate_remote_path != playback_path) {
-        release_list(list);
-        if (attempt + 1 < kMaxAttempts) {
-          std::this_thread::sleep_for(kRetryDelay);
-          continue;
-        }
-        return;
-      }
+static YamlNode yaml_parse_value(const std::vector<YamlLine> &lines, std::size_t &i, int indent,
+                                 const std::string &inline_text, std::string &error) {
+  if (!trim_copy(inline_text).empty()) return yaml_scalar_or_flow(inline_text);
+  if (i < lines.size() && (lines[i].indent > indent ||
+                           (lines[i].indent == indent && yaml_is_item(lines[i].text)))) {
+    return yaml_parse_block(lines, i, lines[i].indent, error);
+  }
+  return YamlNode{};
+}
 
-      int rating_value = contents_rating_to_int(target_info->rating);
-      if (!have_initial) {
-        initial_rating = rating_value;
-        have_initial = true;
+static YamlNode yaml_parse_block(const std::vector<YamlLine> &lines, std::size_t &i, int indent,
+                                 std::string &error) {
+  YamlNode node;
+  const bool sequence = yaml_is_item(lines[i].text);
+  node.kind = sequence ? YamlNode::Kind::List : YamlNode::Kind::Map;
+  while (i < lines.size() && error.empty()) {
+    const YamlLine &line = lines[i];
+    if (line.indent < indent) break;
+    if (line.indent > indent) {
+      error = "line " + std::to_string(line.number) + ": unexpected indentation";
+      break;
+    }
+    if (yaml_is_item(line.text) != sequence) {
+      if (sequence) break;  // "key:\n- a\nnext:" — the list ends at the next key
+      error = "line " + std::to_string(line.number) + ": list item inside a mapping";
+      break;
+    }
+    ++i;
+    if (sequence) {
+      std::string rest = line.text.size() > 1 ? line.text.substr(1) : std::string();
+      const int inner = indent + 1 + static_cast<int>(rest.find_first_not_of(' ') == std::string::npos
+                                                          ? 1 : rest.find_first_not_of(' '));
+      std::string item = trim_copy(rest);
+      std::size_t colon = (!item.empty() && item.front() != '"' && item.front() != '\'')
+                              ? yaml_key_colon(item) : std::string::npos;
+      if (colon == std::string::npos) {
+        node.items.push_back(yaml_parse_value(lines, i, indent, item, error));
+        continue;
       }
-
-      uint64_t rating_key = (static_cast<uint64_t>(slot) << 32) | target_info->contentId;
-      int prev_rating = 0;
-      bool prev_known = false;
-      {
-        std::lock_guard<std::mutex> lk(g_rating_mtx);
-        auto it = g_last_known_ratings.find(rating_key);
-        if (it != g_last_known_ratings.end()) {
-          prev_rating = it->second;
-          prev_known = true;
-        }
+      // "- key: value" starts a mapping whose further keys sit under "key".
+      YamlNode map;
+      map.kind = YamlNode::Kind::Map;
+      map.entries.emplace_back(yaml_unquote(item.substr(0, colon)),
+                               yaml_parse_value(lines, i, inner, item.substr(colon + 1), error));
+      if (error.empty() && i < lines.size() && lines[i].indent == inner && !yaml_is_item(lines[i].text)) {
+        YamlNode more = yaml_parse_block(lines, i, inner, error);
+        for (auto &entry : more.entries) map.entries.push_back(std::move(entry));
       }
+      node.items.push_back(std::move(map));
+      continue;
+    }
+    std::size_t colon = yaml_key_colon(line.text);
+    if (colon == std::string::npos) {
+      error = "line " + std::to_string(line.number) + ": expected 'key: value'";
+      break;
+    }
+    std::string key = yaml_unquote(line.text.substr(0, colon));
+    node.entries.emplace_back(key, yaml_parse_value(lines, i, indent,
+                                                    line.text.substr(colon + 1), error));
+  }
+  return node;
+}
 
-      bool rating_changed = false;
-      if (prev_known && rating_value != prev_rating) {
-        rating_changed = true;
-      }
-      if (!rating_changed && have_initial && rating_value != initial_rating) {
-        rating_changed = true;
+static bool yaml_parse_file(const std::string &path, YamlNode &root, std::string &error) {
+  std::ifstream in(path);
+  if (!in) {
+    error = "cannot read file";
+    return false;
+  }
+  std::vector<YamlLine> lines;
+  std::string raw;
+  int number = 0;
+  while (std::getline(in, raw)) {
+    ++number;
+    if (!raw.empty() && raw.back() == '\r') raw.pop_back();
+    if (raw.rfind("---", 0) == 0) continue;
+    std::string text = yaml_strip_comment(raw);
+    std::size_t first = text.find_first_not_of(' ');
+    if (first == std::string::npos) continue;
+    if (text[first] == '\t') {
+      error = "line " + std::to_string(number) + ": tabs are not allowed for indentation";
+      return false;
+    }
+    std::string body = trim_copy(text);
+    if (body.empty()) continue;
+    lines.push_back({static_cast<int>(first), number, body});
+  }
+  if (lines.empty()) {
+    root = YamlNode{};
+    return true;
+  }
+  std::size_t i = 0;
+  root = yaml_parse_block(lines, i, lines[0].indent, error);
+  if (error.empty() && i < lines.size()) {
+    error = "line " + std::to_string(lines[i].number) + ": unexpected dedent";
+  }
+  return error.empty();
+}
+
+static bool yaml_truthy(const YamlNode &node) {
+  if (node.kind != YamlNode::Kind::Scalar) return false;
+  const std::string v = to_lower_ascii(node.scalar);
+  return v == "true" || v == "yes" || v == "on" || v == "1";
+}
+
+// A subtree opts into batched sync events with `batch: true`; a branch
+// spelled out as "--batch" opts in by itself.
+static void collect_hook_rules(const YamlNode &node, std::vector<std::string> &path,
+                               std::vector<HookRule> &out, bool batch = false) {
+  if (path.size() == 1 && path[0] == "--batch") batch = true;
+  if (node.kind == YamlNode::Kind::Map) {
+    for (const auto &entry : node.entries) {
+      if (entry.first == "batch") batch = batch || yaml_truthy(entry.second);
+    }
+  }
+  auto add = [&](const YamlNode &value) {
+    HookRule rule;
+    rule.path = path;
+    rule.batch = batch;
+    for (const auto &seg : path) rule.name += (rule.name.empty() ? "" : " > ") + seg;
+    if (rule.name.empty()) rule.name = "(root)";
+    if (value.kind == YamlNode::Kind::Scalar) {
+      rule.scripts.push_back(value.scalar);
+    } else if (value.kind == YamlNode::Kind::List) {
+      for (const auto &item : value.items) {
+        if (item.kind == YamlNode::Kind::Scalar) rule.scripts.push_back(item.scalar);
+        else LOGW("rules: non-string handler under '" << rule.name << "' ignored");
       }
+    }
+    if (!rule.scripts.empty()) out.push_back(std::move(rule));
+  };
+  if (node.kind != YamlNode::Kind::Map) {
+    add(node);
+    return;
+  }
+  for (const auto &entry : node.entries) {
+    if (entry.first == "script") {
+      add(entry.second);
+      continue;
+    }
+    if (entry.first == "batch") continue;
+    path.push_back(entry.first);
+    collect_hook_rules(entry.second, path, out, batch);
+    path.pop_back();
+  }
+}
 
-      if (!rating_changed) {
-        release_list(list);
-        if (attempt + 1 < kMaxAttempts) {
-          std::this_thread::sleep_for(kRetryDelay);
-          continue;
-        }
-        {
-          std::lock_guard<std::mutex> lk(g_rating_mtx);
-          g_last_known_ratings[rating_key] = rating_value;
-        }
-        last_update.store(update_time, std::memory_order_relaxed);
-        return;
+static bool load_hook_rules(const std::string &path, std::vector<HookRule> &rules,
+                            std::string &error) {
+  YamlNode root;
+  if (!yaml_parse_file(path, root, error)) return false;
+  const YamlNode *top = &root;
+  if (root.kind == YamlNode::Kind::Map) {
+    for (const auto &entry : root.entries) {
+      if (entry.first == "rules") top = &entry.second;
+    }
+  }
+  std::vector<std::string> prefix;
+  if (top->kind != YamlNode::Kind::List) {
+    collect_hook_rules(*top, prefix, rules);
+    return true;
+  }
+  // List form, as broadcast.sh reads it: each item matches the first argument
+  // by its index, or by its `value` key with the subtree under `rule` (or the
+  // item's remaining keys).
+  for (std::size_t idx = 0; idx < top->items.size(); ++idx) {
+    const YamlNode &item = top->items[idx];
+    std::string key = std::to_string(idx);
+    YamlNode subtree;
+    const YamlNode *node = &item;
+    if (item.kind == YamlNode::Kind::Map) {
+      const YamlNode *value = nullptr;
+      const YamlNode *rule = nullptr;
+      for (const auto &entry : item.entries) {
+        if (entry.first == "value") value = &entry.second;
+        else if (entry.first == "rule") rule = &entry.second;
       }
-
-      bool have_local = download_single_content_file(slot, *target_info, *target_file,
-                                                     local_path, /*skip_existing=*/true);
-      if (!have_local) {
-        std::error_code exists_ec;
-        if (!local_path.empty() && std::filesystem::exists(local_path, exists_ec) && !exists_ec) {
-          have_local = true;
+      if (value) {
+        key = value->scalar;
+        if (rule) {
+          node = rule;
+        } else {
+          subtree.kind = YamlNode::Kind::Map;
+          for (const auto &entry : item.entries) {
+            if (entry.first != "value") subtree.entries.push_back(entry);
+          }
+          node = &subtree;
         }
       }
+    }
+    prefix.assign(1, key);
+    collect_hook_rules(*node, prefix, rules);
+  }
+  return true;
+}
 
-      if (!have_local) {
-        release_list(list);
-        return;
-      }
-
-      {
-        std::lock_guard<std::mutex> lk(g_rating_mtx);
-        g_last_known_ratings[rating_key] = rating_value;
-      }
+// Current rules, re-reading the file when it changed on disk.
+static std::shared_ptr<const std::vector<HookRule>> current_hook_rules() {
+  std::lock_guard<std::mutex> lk(g_rules_mtx);
+  if (g_rules.path.empty()) return nullptr;
+  std::error_code ec;
+  auto mtime = std::filesystem::last_write_time(g_rules.path, ec);
+  if (ec) {
+    if (g_rules.loaded || !g_rules.rules) {
+      LOGW("rules: cannot stat " << g_rules.path << ": " << ec.message());
+      g_rules.loaded = false;
+      g_rules.rules = std::make_shared<const std::vector<HookRule>>();
+    }
+    return g_rules.rules;
+  }
+  if (g_rules.loaded && mtime == g_rules.mtime) return g_rules.rules;
+
+  g_rules.mtime = mtime;
+  g_rules.loaded = true;
+  std::vector<HookRule> rules;
+  std::string error;
+  if (!load_hook_rules(g_rules.path, rules, error)) {
+    LOGE("rules: " << g_rules.path << ": " << error
+         << (g_rules.rules ? "; keeping previous rules" : ""));
+    if (!g_rules.rules) g_rules.rules = std::make_shared<const std::vector<HookRule>>();
+    return g_rules.rules;
+  }
+  LOGI("rules: loaded " << rules.size() << " rule(s) from " << g_rules.path);
+  g_rules.rules = std::make_shared<const std::vector<HookRule>>(std::move(rules));
+  return g_rules.rules;
+}
+
+static void set_hook_rules_path(const std::string &path) {
+  std::lock_guard<std::mutex> lk(g_rules_mtx);
+  g_rules = RulesFile{};
+  if (path.empty()) return;
+  std::error_code ec;
+  auto abs = std::filesystem::absolute(expand_user_path(path), ec);
+  g_rules.path = ec ? path : abs.string();
+  g_rules.dir = std::filesystem::path(g_rules.path).parent_path().string();
+}
+
+static bool hook_rules_configured() {
+  std::lock_guard<std::mutex> lk(g_rules_mtx);
+  return !g_rules.path.empty();
+}
+
+// POSIX shell-style word splitting (quotes and backslashes, no expansion).
+static bool split_command_line(const std::string &line, std::vector<std::string> &words) {
+  std::string cur;
+  bool in_word = false;
+  char quote = 0;
+  for (std::size_t i = 0; i < line.size(); ++i) {
+    char c = line[i];
+    if (quote == '\'') {
+      if (c == '\'') quote = 0; else cur.push_back(c);
+    } else if (quote == '"') {
+      if (c == '"') quote = 0;
+      else if (c == '\\' && i + 1 < line.size() && (line[i + 1] == '"' || line[i + 1] == '\\')) cur.push_back(line[++i]);
+      else cur.push_back(c);
+    } else if (c == '\'' || c == '"') {
+      quote = c;
+      in_word = true;
+    } else if (c == '\\' && i + 1 < line.size()) {
+      cur.push_back(line[++i]);
+      in_word = true;
+    } else if (std::isspace(static_cast<unsigned char>(c))) {
+      if (in_word) words.push_back(cur);
+      cur.clear();
+      in_word = false;
+    } else {
+      cur.push_back(c);
+      in_word = true;
+    }
+  }
+  if (quote) return false;
+  if (in_word) words.push_back(cur);
+  return true;
+}
 
-      if (update_time != 0) {
-        last_update.store(update_time, std::memory_order_relaxed);
+// Substitutes {N} with the Nth event argument (1-based).
+static std::string render_rule_token(const std::string &token, const std::vector<std::string> &args) {
+  std::string out;
+  for (std::size_t i = 0; i < token.size(); ++i) {
+    char c = token[i];
+    if (c == '{') {
+      std::size_t end = token.find('}', i + 1);
+      if (end == std::string::npos) {
+        out.push_back(c);
+        continue;
       }
+      std::string key = token.substr(i + 1, end - i - 1);
+      bool digits = !key.empty() && std::all_of(key.begin(), key.end(),
+                                                [](unsigned char d) { return std::isdigit(d); });
+      std::size_t idx = digits ? std::strtoul(key.c_str(), nullptr, 10) : 0;
+      if (!digits) LOGW("rules: unsupported placeholder '{" << key << "}' ignored");
+      else if (idx == 0 || idx > args.size()) LOGW("rules: placeholder {" << key << "} out of range");
+      else out += args[idx - 1];
+      i = end;
+    } else if (c == '\\' && i + 1 < token.size()) {
+      out.push_back(token[++i]);
+    } else {
+      out.push_back(c);
+    }
+  }
+  return out;
+}
 
-      int mode_value = playback_mode.supported ? static_cast<int>(playback_mode.value & 0xFFFF) : -1;
-      std::string mode_text = camera_mode_to_string(mode_value);
+// broadcast.sh also looks next to itself. The native equivalent is the
+// scripts/ directory shipped with SonShell: beside the executable, one level
+// up (build/ inside a checkout), or the executable's own directory.
+static const std::string &rules_script_dir() {
+  static const std::string dir = [] {
+    std::error_code ec;
+    auto exe = std::filesystem::read_symlink("/proc/self/exe", ec);
+    if (ec) return std::string();
+    const auto base = exe.parent_path();
+    for (const auto &candidate : {base / "scripts", base.parent_path() / "scripts", base}) {
+      if (std::filesystem::exists(candidate / "broadcast.sh", ec)) return candidate.string();
+    }
+    return std::string();
+  }();
+  return dir;
+}
+
+// Absolute handler path, in broadcast.sh's order: names with a '/' try the
+// rules file's directory, then the script directory; bare names the script
+// directory first. Both then fall back to a $PATH (or cwd-relative) lookup.
+static std::string resolve_rule_command(const std::string &command, const std::string &dir) {
+  std::error_code ec;
+  if (!command.empty() && command.front() == '/') {
+    return std::filesystem::exists(command, ec) ? command : std::string();
+  }
+  const std::string &script_dir = rules_script_dir();
+  const bool has_slash = command.find('/') != std::string::npos;
+  std::vector<std::string> bases;
+  if (has_slash) bases = {dir, script_dir};
+  else bases = {script_dir, dir};
+  for (const auto &base : bases) {
+    if (base.empty()) continue;
+    std::string local = join_path(base, command);
+    if (std::filesystem::exists(local, ec)) return std::filesystem::absolute(local, ec).string();
+  }
+  if (has_slash) {
+    return access(command.c_str(), X_OK) == 0 ? std::filesystem::absolute(command, ec).string() : std::string();
+  }
+  const char *env = std::getenv("PATH");
+  std::stringstream paths(env ? env : "");
+  std::string entry;
+  while (std::getline(paths, entry, ':')) {
+    if (entry.empty()) continue;
+    std::string candidate = join_path(entry, command);
+    if (access(candidate.c_str(), X_OK) == 0) return candidate;
+  }
+  return {};
+}
+
+static void launch_rule_handler(const std::string &script, const std::string &dir,
+                                const std::vector<std::string> &event,
+                                const HookAttachment &attachment) {
+  std::vector<std::string> words;
+  if (!split_command_line(script, words) || words.empty()) {
+    LOGW("rules: cannot parse handler '" << script << "'");
+    return;
+  }
+  const bool placeholders = std::any_of(words.begin(), words.end(), [](const std::string &w) {
+    return w.find('{') != std::string::npos && w.find('}') != std::string::npos;
+  });
+  for (auto &w : words) w = render_rule_token(w, event);
+  std::string resolved = resolve_rule_command(words[0], dir);
+  if (resolved.empty()) {
+    LOGE("rules: handler '" << words[0] << "' not found");
+    return;
+  }
+  std::vector<std::string> args(words.begin() + 1, words.end());
+  if (!placeholders) args.insert(args.end(), event.begin(), event.end());
+  // Non-executable scripts run through bash, as broadcast.sh did.
+  if (access(resolved.c_str(), X_OK) != 0) {
+    args.insert(args.begin(), resolved);
+    resolved = "/bin/bash";
+  }
+  spawn_hook({resolved, std::move(args), true, attachment});
+}
 
-      if (!g_post_cmd.empty() && !local_path.empty()) {
-        std::vector<std::string> args{local_path, mode_text, "rating",
-                                      std::to_string(rating_value), std::to_string(prev_rating)};
-        run_post_cmd_args(g_post_cmd, args);
-      }
+// Which rules an event goes to. Batched sync events only reach rules that
+// opt in; while batching, per-file sync events skip those rules so they do
+// not see each file twice.
+enum class RuleAudience { Any, PerFile, Batch };
 
-      release_list(list);
-      handled = true;
-      break;
-    }
+static bool hook_rules_want_batches() {
+  auto rules = current_hook_rules();
+  return rules && std::any_of(rules->begin(), rules->end(), [](const HookRule &r) { return r.batch; });
+}
 
-    if (!handled) {
-      release_list(list);
+static void dispatch_hook_rules(const std::vector<std::string> &event,
+                                const HookAttachment &attachment = nullptr,
+                                RuleAudience audience = RuleAudience::Any) {
+  auto rules = current_hook_rules();
+  if (!rules) return;
+  std::string dir;
+  {
+    std::lock_guard<std::mutex> lk(g_rules_mtx);
+    dir = g_rules.dir;
+  }
+  for (const auto &rule : *rules) {
+    if (audience == RuleAudience::Batch && !rule.batch) continue;
+    if (audience == RuleAudience::PerFile && rule.batch) continue;
+    if (event.size() < rule.path.size()) continue;
+    bool match = true;
+    for (std::size_t i = 0; i < rule.path.size() && match; ++i) {
+      const std::string &glob = rule.path[i];
+      match = glob == "*" || fnmatch(glob.c_str(), event[i].c_str(), 0) == 0;
     }
+    if (!match) continue;
+    for (const auto &script : rule.scripts) launch_rule_handler(script, dir, event, attachment);
   }
+}
 
-  void OnNotifyRemoteTransferContentsListChanged(CrInt32u notify, CrInt32u slotNumber, CrInt32u addSize) override {
-    if (g_shutting_down.load()) return;
-    if (g_stop.load(std::memory_order_relaxed)) return;
-    
-    if (verbose) {
-      LOGI( "[CB] ContentsListChanged: notify=0x" << std::hex << notify << std::dec << " slot=" << slotNumber << " add=" << addSize );
-    }
-    if (notify != SDK::CrNotify_RemoteTransfer_Changed_Add) return;
+// ----------------------------
+// Hook server
+// ----------------------------
+// `--hook-server <cmd>` starts one long-lived worker and writes every hook
+// event to its stdin as a JSON line. With `--hook-ack <n>` the worker must
+// answer each event with one line on stdout; at most n events are then
+// unacknowledged at a time and the rest wait in SonShell. A worker that exits
+// is restarted with backoff and unacknowledged events are sent again.
+struct HookEvent {
+  std::vector<std::string> argv;  // positional arguments for --cmd/--rules
+  std::string path, mode, operation, new_value, old_value;
+  int slot = 0;                   // 0 = unknown
+  std::optional<CrInt32u> content_id;
+  std::optional<std::uint64_t> size;
+};
 
-    // Was this invocation triggered by a manual sync?
-    bool is_sync = false;
-    for (int tok = g_sync_tokens.load(std::memory_order_relaxed); tok > 0; ) {
-      if (g_sync_tokens.compare_exchange_weak(tok, tok - 1, std::memory_order_relaxed)) {
-	is_sync = true;
-	break;
-      }
-    }
+static constexpr std::size_t kHookServerMaxQueue = 10000;
 
-    bool sync_all = is_sync && g_sync_all.load(std::memory_order_relaxed);
-    bool sync_star = is_sync && g_sync_star.load(std::memory_order_relaxed);
+struct HookServer {
+  std::vector<std::string> argv;
+  std::size_t ack_window = 0;  // 0 = no acknowledgements
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::deque<std::string> queue;    // encoded, not yet written
+  std::deque<std::string> unacked;  // written, waiting for an ack line
+  std::thread io;
+  pid_t pid = -1;
+  int in_fd = -1;
+  int out_fd = -1;
+  bool alive = false;
+  bool exited = false;
+  bool stop = false;
+  std::uint64_t seq = 0, sent = 0, acked = 0, dropped = 0, restarts = 0;
+};
+static HookServer g_hook_server;
 
-    if (!is_sync && !g_auto_sync_enabled.load(std::memory_order_acquire)) {
-      if (verbose) {
-        LOGI("[CB] Auto-sync disabled; ignoring contents update (slot=" << slotNumber << ")");
-      }
-      return;
+static std::string json_escape(const std::string &in) {
+  std::string out;
+  out.reserve(in.size() + 2);
+  for (unsigned char c : in) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (c < 0x20) {
+          char buf[8];
+          std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        } else {
+          out.push_back(static_cast<char>(c));
+        }
     }
+  }
+  return out;
+}
 
-    try {
-      g_downloadThreads.emplace_back([this, slotNumber, addSize, is_sync, sync_all, sync_star]() {
-	struct SyncActiveGuard {
-	  bool armed = false;
-	  ~SyncActiveGuard() {
-	    if (armed) g_sync_active.fetch_sub(1, std::memory_order_relaxed);
-	  }
-	} sync_active_guard;
-	if (is_sync) {
-	  g_sync_active.fetch_add(1, std::memory_order_relaxed);
-	  sync_active_guard.armed = true;
-	}
-	SDK::CrDeviceHandle handle = this->device_handle;
-	if (!handle) return;
-	SDK::CrSlotNumber slot = (slotNumber == SDK::CrSlotNumber_Slot2) ? SDK::CrSlotNumber_Slot2 : SDK::CrSlotNumber_Slot1;
+static std::string hook_event_json(const HookEvent &ev, std::uint64_t seq) {
+  std::ostringstream o;
+  o << "{\"seq\":" << seq << ",\"path\":\"" << json_escape(ev.path) << "\",\"mode\":\""
+    << json_escape(ev.mode) << "\",\"operation\":\"" << json_escape(ev.operation)
+    << "\",\"new\":\"" << json_escape(ev.new_value) << "\",\"old\":\"" << json_escape(ev.old_value)
+    << "\",\"slot\":";
+  if (ev.slot) o << ev.slot; else o << "null";
+  o << ",\"contentId\":";
+  if (ev.content_id) o << *ev.content_id; else o << "null";
+  o << ",\"size\":";
+  if (ev.size) o << *ev.size; else o << "null";
+  o << "}\n";
+  return o.str();
+}
 
-	auto process_list = [&](SDK::CrContentsInfo *list, CrInt32u count, CrInt32u want_hint) {
-	  if (!list || count == 0) return;
+static bool hook_server_configured() {
+  return !g_hook_server.argv.empty();
+}
 
-	  if (is_sync && g_sync_abort.load(std::memory_order_acquire)) {
-	    if (verbose) LOGI("Sync: stopped (slot " << (int)slot << ").");
-	    return; // bail out before planning/logging
-	  }
-	  
-	  std::vector<CrInt32u> idx;
-	  idx.reserve(count);
-	  for (CrInt32u i = 0; i < count; ++i) {
-	    if (sync_star) {
-	      int rating_value = contents_rating_to_int(list[i].rating);
-	      if (rating_value < 1) continue;
-	      if (!contents_info_has_still_image(list[i])) continue;
-	    }
-	    idx.push_back(i);
-	  }
+static void hook_server_enqueue(const HookEvent &ev) {
+  auto &hs = g_hook_server;
+  {
+    std::lock_guard<std::mutex> lk(hs.mtx);
+    if (hs.stop) return;
+    if (hs.queue.size() >= kHookServerMaxQueue) {
+      hs.queue.pop_front();
+      ++hs.dropped;
+    }
+    hs.queue.push_back(hook_event_json(ev, ++hs.seq));
+  }
+  hs.cv.notify_all();
+}
 
-	  if (verbose) LOGI("[SYNC] slot " << (int)slot << ": planning " << idx.size() << " matched item(s)"
-	       << (sync_star ? " (starred stills)" : (sync_all ? " (all contents)" : "")));
-	  
-	  // For full-library sync modes, we want everything; otherwise keep newest-first N logic.
-	  CrInt32u want = ((sync_all || sync_star) ? static_cast<CrInt32u>(idx.size())
-	                                           : (want_hint > 0 ? want_hint : 1));
+// Starts the worker with stdin (and, with acks, stdout) on pipes.
+static bool hook_server_spawn() {
+  auto &hs = g_hook_server;
+  int in_pipe[2] = {-1, -1}, out_pipe[2] = {-1, -1};
+  if (pipe2(in_pipe, O_CLOEXEC) != 0 || (hs.ack_window && pipe2(out_pipe, O_CLOEXEC) != 0)) {
+    LOGE("hook-server: pipe failed: " << std::strerror(errno));
+    for (int fd : {in_pipe[0], in_pipe[1], out_pipe[0], out_pipe[1]}) if (fd >= 0) close(fd);
+    return false;
+  }
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, in_pipe[0], STDIN_FILENO);
+  if (hs.ack_window) posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+  posix_spawnattr_t attr;
+  init_hook_spawnattr(attr, /*new_session=*/true);
+
+  std::vector<char *> argv;
+  for (auto &arg : hs.argv) argv.push_back(const_cast<char *>(arg.c_str()));
+  argv.push_back(nullptr);
+  pid_t pid = 0;
+  // Spawn and register under g_hook_mtx, like start_hook_locked: the reaper
+  // may already sit in waitpid(-1) for other hooks, and a worker that dies at
+  // once must still be routed to the callback below.
+  std::unique_lock<std::mutex> hook_lk(g_hook_mtx);
+  int rc = posix_spawnp(&pid, argv[0], &actions, &attr, argv.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  close(in_pipe[0]);
+  if (out_pipe[1] >= 0) close(out_pipe[1]);
+  if (rc != 0) {
+    hook_lk.unlock();
+    LOGE("hook-server: cannot start " << hs.argv[0] << ": " << std::strerror(rc));
+    close(in_pipe[1]);
+    if (out_pipe[0] >= 0) close(out_pipe[0]);
+    return false;
+  }
+  fcntl(in_pipe[1], F_SETFL, O_NONBLOCK);
+  if (out_pipe[0] >= 0) fcntl(out_pipe[0], F_SETFL, O_NONBLOCK);
+  {
+    std::lock_guard<std::mutex> lk(hs.mtx);
+    hs.pid = pid;
+    hs.in_fd = in_pipe[1];
+    hs.out_fd = out_pipe[0];
+    hs.alive = true;
+    hs.exited = false;
+  }
+  watch_hook_child_locked(pid, [pid](int status) {
+    auto &srv = g_hook_server;
+    {
+      std::lock_guard<std::mutex> lk(srv.mtx);
+      if (srv.stop) return;
+      if (srv.pid == pid) srv.exited = true;
+    }
+    srv.cv.notify_all();
+    if (WIFSIGNALED(status)) {
+      LOGW("hook-server: worker " << pid << " killed by signal " << WTERMSIG(status));
+    } else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+      LOGW("hook-server: worker " << pid << " exited with status " << WEXITSTATUS(status));
+    }
+  });
+  hook_lk.unlock();
+  LOGI("hook-server: started " << hs.argv[0] << " (pid " << pid << ")");
+  return true;
+}
 
-	  if (!sync_all) {
-	    std::sort(idx.begin(), idx.end(), [&](CrInt32u a, CrInt32u b) {
-	      const auto &A = list[a].modificationDatetimeUTC;
-	      const auto &B = list[b].modificationDatetimeUTC;
-	      if (A.year != B.year) return A.year > B.year;
-	      if (A.month != B.month) return A.month > B.month;
-	      if (A.day != B.day) return A.day > B.day;
-	      if (A.hour != B.hour) return A.hour > B.hour;
-	      if (A.minute != B.minute) return A.minute > B.minute;
-	      if (A.sec != B.sec) return A.sec > B.sec;
-	      return A.msec > B.msec;
-	    });
-	    if (want > idx.size()) want = static_cast<CrInt32u>(idx.size());
-	    idx.resize(want);
-	  } else {
-	    // "all": process in natural order
-	    idx.resize(count);
-	  }
+// Caller holds hs.mtx. Drops the pipes and queues what was not confirmed.
+static void hook_server_lost_locked(std::string &pending) {
+  auto &hs = g_hook_server;
+  if (hs.in_fd >= 0) close(hs.in_fd);
+  if (hs.out_fd >= 0) close(hs.out_fd);
+  hs.in_fd = hs.out_fd = -1;
+  if (hs.ack_window) {
+    hs.queue.insert(hs.queue.begin(), hs.unacked.begin(), hs.unacked.end());
+    hs.unacked.clear();
+  } else if (!pending.empty()) {
+    hs.queue.push_front(pending);
+  }
+  pending.clear();
+  hs.alive = false;
+  hs.pid = -1;
+  if (!hs.stop) ++hs.restarts;
+}
+
+static void hook_server_main() {
+  auto &hs = g_hook_server;
+  auto backoff = std::chrono::seconds(1);
+  auto started = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point drain_deadline{};
+  std::string pending;
+  std::size_t pending_off = 0;
+  char buf[4096];
+  for (;;) {
+    int in_fd = -1, out_fd = -1;
+    {
+      std::unique_lock<std::mutex> lk(hs.mtx);
+      if (hs.alive && hs.exited) {
+        hook_server_lost_locked(pending);
+        if (!hs.stop) {
+          LOGW("hook-server: worker stopped; restarting in " << backoff.count() << " s");
+          hs.cv.wait_for(lk, backoff, [&] { return hs.stop; });
+          backoff = std::chrono::steady_clock::now() - started > std::chrono::minutes(1)
+                        ? std::chrono::seconds(1)
+                        : std::min(backoff * 2, std::chrono::seconds(30));
+        }
+      }
+      if (hs.stop && drain_deadline == std::chrono::steady_clock::time_point{}) {
+        drain_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+      }
+      const bool drained = pending.empty() && hs.queue.empty() && hs.unacked.empty();
+      if (hs.stop && (!hs.alive || drained || std::chrono::steady_clock::now() > drain_deadline)) {
+        break;
+      }
+      if (!hs.alive) {
+        lk.unlock();
+        bool ok = hook_server_spawn();
+        lk.lock();
+        if (!ok) {
+          hs.cv.wait_for(lk, backoff, [&] { return hs.stop; });
+          backoff = std::min(backoff * 2, std::chrono::seconds(30));
+          continue;
+        }
+        started = std::chrono::steady_clock::now();
+      }
+      if (pending.empty() && !hs.queue.empty() &&
+          (!hs.ack_window || hs.unacked.size() < hs.ack_window)) {
+        pending = std::move(hs.queue.front());
+        hs.queue.pop_front();
+        pending_off = 0;
+        if (hs.ack_window) hs.unacked.push_back(pending);
+      }
+      if (pending.empty() && !hs.ack_window) {
+        hs.cv.wait_for(lk, std::chrono::milliseconds(200),
+                       [&] { return hs.stop || hs.exited || !hs.queue.empty(); });
+        continue;
+      }
+      in_fd = pending.empty() ? -1 : hs.in_fd;
+      out_fd = hs.out_fd;
+    }
+
+    pollfd fds[2];
+    nfds_t n = 0;
+    if (in_fd >= 0) fds[n++] = {in_fd, POLLOUT, 0};
+    if (out_fd >= 0) fds[n++] = {out_fd, POLLIN, 0};
+    if (poll(fds, n, 100) <= 0) continue;
+
+    bool lost = false;
+    for (nfds_t i = 0; i < n; ++i) {
+      if (fds[i].fd == in_fd && (fds[i].revents & (POLLOUT | POLLERR | POLLHUP))) {
+        ssize_t w = write(in_fd, pending.data() + pending_off, pending.size() - pending_off);
+        if (w < 0 && errno != EAGAIN && errno != EINTR) {
+          lost = true;
+        } else if (w > 0) {
+          pending_off += static_cast<std::size_t>(w);
+          if (pending_off == pending.size()) {
+            pending.clear();
+            std::lock_guard<std::mutex> lk(hs.mtx);
+            ++hs.sent;
+          }
+        }
+      } else if (fds[i].fd == out_fd && (fds[i].revents & (POLLIN | POLLERR | POLLHUP))) {
+        ssize_t r = read(out_fd, buf, sizeof(buf));
+        if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) {
+          lost = true;
+        } else if (r > 0) {
+          std::lock_guard<std::mutex> lk(hs.mtx);
+          for (ssize_t k = 0; k < r; ++k) {
+            if (buf[k] != '\n' || hs.unacked.empty()) continue;
+            hs.unacked.pop_front();
+            ++hs.acked;
+          }
+        }
+      }
+    }
+    if (lost) {
+      std::lock_guard<std::mutex> lk(hs.mtx);
+      hs.exited = true;  // handled (and restarted) at the top of the loop
+    }
+  }
 
-	  for (CrInt32u k = 0; k < idx.size(); ++k) {
+  std::lock_guard<std::mutex> lk(hs.mtx);
+  if (hs.alive) hook_server_lost_locked(pending);  // closing stdin asks the worker to exit
+  if (!hs.queue.empty()) LOGW("hook-server: " << hs.queue.size() << " event(s) not delivered");
+}
 
-	    if (is_sync && g_sync_abort.load(std::memory_order_acquire)) {
-	      dl_waiting = false;             // nothing in-flight yet for this file
-	      break;
-	    }
-	    
-	    if (g_stop.load(std::memory_order_relaxed)) break;
-	    const SDK::CrContentsInfo &target = list[idx[k]];
-	    if (target.contentId == 0) continue;
+static void start_hook_server(const std::string &command, std::size_t ack_window) {
+  auto &hs = g_hook_server;
+  std::vector<std::string> words;
+  if (!split_command_line(command, words) || words.empty()) {
+    LOGE("hook-server: cannot parse command '" << command << "'");
+    return;
+  }
+  hs.argv = std::move(words);
+  hs.ack_window = ack_window;
+  hs.io = std::thread(hook_server_main);
+}
 
-	    for (CrInt32u fi = 0; fi < target.filesNum; ++fi) {
-	      if (sync_star && !target.files[fi].isImageParamExsist) continue;
+static void stop_hook_server() {
+  auto &hs = g_hook_server;
+  if (!hs.io.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lk(hs.mtx);
+    hs.stop = true;
+  }
+  hs.cv.notify_all();
+  hs.io.join();
+}
 
-	      if (is_sync && g_sync_abort.load(std::memory_order_acquire)) {
-		dl_waiting = false;             // nothing in-flight yet for this file
-		break;
-	      }
-	      
-	      if (g_stop.load(std::memory_order_relaxed)) break;
-      dl_waiting = true;
-      CrInt32u fileId = target.files[fi].fileId;
+// ----------------------------
+// Log file
+// ----------------------------
+// --log-file: a writer thread drains g_log_file_ring every 100 ms, renders the
+// batch as text or JSON lines and hands it to a single write(). The console
+// output is unaffected. The file is rotated to path.1 … path.N by size and age.
+constexpr int kLogFileKeep = 5;
+constexpr auto kLogFileFlushEvery = std::chrono::milliseconds(100);
 
-      // determine original filename
-      std::string orig = basename_from_path(target.files[fi].filePath);
-	      if (orig.empty()) {
-		std::ostringstream o; o << "content_" << (unsigned long long)target.contentId << "_file_" << fileId;
-		orig = o.str();
-	      }
+struct LogFileSink {
+  std::string path;
+  bool json = false;
+  std::uint64_t max_bytes = 10ull << 20;  // 0 = no size rotation
+  std::chrono::hours max_age{24};         // 0 = no time rotation
+  int fd = -1;
+  std::uint64_t size = 0;
+  std::chrono::steady_clock::time_point opened;
+  bool write_failed = false;
+  std::uint64_t dropped_reported = 0;
+  std::thread thread;
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool stop = false;
+  std::atomic<std::uint64_t> records{0};
+  std::atomic<std::uint64_t> rotations{0};
+};
+static LogFileSink g_log_file;
 
-	      // derive relative directory from remote file path (e.g. "PRIVATE/M4ROOT/CLIP")
-	      std::string relDir = dirname_from_path(target.files[fi].filePath);
+static bool parse_log_format(const std::string &s, bool &json) {
+  if (s == "json") json = true;
+  else if (s == "text") json = false;
+  else return false;
+  return true;
+}
 
-	      // compute full local directory and ensure it exists
-	      std::string destDir = g_download_dir;
-	      if (!relDir.empty()) destDir = join_path(destDir, relDir);
-	      std::error_code ec;
-	      std::filesystem::create_directories(destDir, ec);
+// "[SYNC] …" -> "sync", "hook-server: …" -> "hook-server"; empty if neither.
+static std::string log_subsystem(std::string_view msg) {
+  std::string_view tag;
+  if (msg.size() > 2 && msg[0] == '[') {
+    auto end = msg.find(']');
+    if (end != std::string_view::npos && end > 1 && end <= 24) tag = msg.substr(1, end - 1);
+  } else {
+    auto colon = msg.find(':');
+    if (colon != std::string_view::npos && colon > 0 && colon <= 24 &&
+        msg.substr(0, colon).find(' ') == std::string_view::npos) {
+      tag = msg.substr(0, colon);
+    }
+  }
+  std::string out(tag);
+  for (auto &c : out) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  return out;
+}
 
-	      // choose final filename (sync/boot: keep name & skip existing; else: uniquify)
-	      std::string finalName;
-	      std::string candidatePath = join_path(destDir, orig);
-	      if (is_sync) {
-		if (std::filesystem::exists(candidatePath)) {
-		  if (verbose) LOGI("[SKIP] already present: " << join_path(relDir, orig));
-		  dl_waiting = false;
-		  continue;
-		}
-		finalName = orig;
-	      } else {
-		finalName = unique_name(destDir, orig);
-	      }
+static void append_log_timestamp(std::string &out, std::int64_t ts_us) {
+  const std::time_t secs = static_cast<std::time_t>(ts_us / 1000000);
+  std::tm tm{};
+  gmtime_r(&secs, &tm);
+  char buf[40];
+  std::snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ", tm.tm_year + 1900,
+                tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                static_cast<int>((ts_us / 1000) % 1000));
+  out += buf;
+}
+
+static void append_log_record(std::string &out, const LogRecord &rec, bool json) {
+  if (!json) {
+    append_log_timestamp(out, rec.ts_us);
+    char label[8];
+    std::snprintf(label, sizeof(label), " %-5s", log_label(rec.level));
+    out += label;
+    out += " | ";
+    out += rec.text;
+    out += '\n';
+    return;
+  }
+  std::string level = log_label(rec.level);
+  for (auto &c : level) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  out += "{\"ts\":\"";
+  append_log_timestamp(out, rec.ts_us);
+  out += "\",\"level\":\"" + level + "\"";
+  std::string subsystem = log_subsystem(rec.text);
+  if (!subsystem.empty()) out += ",\"subsystem\":\"" + json_escape(subsystem) + "\"";
+  if (rec.event) out += ",\"event\":\"" + json_escape(rec.event) + "\"";
+  out += ",\"msg\":\"" + json_escape(rec.text) + "\"";
+  if (!rec.file.empty()) out += ",\"file\":\"" + json_escape(rec.file) + "\"";
+  if (rec.bytes >= 0) out += ",\"bytes\":" + std::to_string(rec.bytes);
+  if (rec.ms >= 0) out += ",\"ms\":" + std::to_string(rec.ms);
+  if (rec.code >= 0) out += ",\"code\":" + std::to_string(rec.code);
+  out += "}\n";
+}
+
+static bool open_log_file_locked(LogFileSink &lf) {
+  lf.fd = ::open(lf.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (lf.fd < 0) return false;
+  struct stat st{};
+  lf.size = (fstat(lf.fd, &st) == 0) ? static_cast<std::uint64_t>(st.st_size) : 0;
+  lf.opened = std::chrono::steady_clock::now();
+  return true;
+}
 
-	      CrChar *saveDir = destDir.empty() ? nullptr
-		: const_cast<CrChar *>(reinterpret_cast<const CrChar *>(destDir.c_str()));
-	      if (g_stop.load(std::memory_order_relaxed)) { dl_waiting = false; break; }
-	      
-	      // progress label before SDK gives us the final path
-	      dl_current_label = join_path(relDir, finalName);
-      dl_last_log_per = 101; // reset throttling so we log 0% immediately
-      dl_last_log_tp = std::chrono::steady_clock::now();
-      dl_start_tp = dl_last_log_tp;
-      dl_any_progress = false;
-      dl_current_operation = is_sync ? "sync" : "new";
-      dl_current_mode = capture_mode_string(device_handle, target, target.files[fi]);
-      std::uint64_t sync_transfer_id = 0;
-      if (is_sync) {
-        sync_transfer_id = register_sync_transfer(dl_current_label, slot);
-      }
+static void rotate_log_file(LogFileSink &lf) {
+  if (lf.fd >= 0) { ::close(lf.fd); lf.fd = -1; }
+  for (int k = kLogFileKeep - 1; k >= 1; --k) {
+    std::string from = lf.path + "." + std::to_string(k);
+    std::string to = lf.path + "." + std::to_string(k + 1);
+    (void)::rename(from.c_str(), to.c_str());
+  }
+  (void)::rename(lf.path.c_str(), (lf.path + ".1").c_str());
+  lf.rotations.fetch_add(1, std::memory_order_relaxed);
+  open_log_file_locked(lf);
+}
 
-      // kick off download
-      SDK::CrError dres = SDK::GetRemoteTransferContentsDataFile(
-								 handle, slot, target.contentId, fileId, 0x1000000,
-								 saveDir, const_cast<CrChar *>(finalName.c_str()));
-	      if (dres != SDK::CrError_None) {
-		dl_waiting = false;
-		if (sync_transfer_id != 0) unregister_sync_transfer(sync_transfer_id);
-		LOGE("GetRemoteTransferContentsDataFile failed: "
-		     << crsdk_err::error_to_name(dres) << " (0x" << std::hex << dres << std::dec << ")");
-		continue;
-	      }
+static void write_log_batch(LogFileSink &lf, const std::string &batch) {
+  const auto now = std::chrono::steady_clock::now();
+  if (lf.fd >= 0 && lf.size > 0 &&
+      ((lf.max_bytes && lf.size + batch.size() > lf.max_bytes) ||
+       (lf.max_age.count() && now - lf.opened >= lf.max_age))) {
+    rotate_log_file(lf);
+  }
+  if (lf.fd < 0 && !open_log_file_locked(lf)) {
+    if (!lf.write_failed) LOGW("log-file: cannot open " << lf.path << ": " << std::strerror(errno));
+    lf.write_failed = true;
+    return;
+  }
+  std::size_t off = 0;
+  while (off < batch.size()) {
+    ssize_t w = ::write(lf.fd, batch.data() + off, batch.size() - off);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) {
+      if (!lf.write_failed) LOGW("log-file: write to " << lf.path << " failed: " << std::strerror(errno));
+      lf.write_failed = true;
+      ::close(lf.fd);
+      lf.fd = -1;  // reopen on the next batch
+      return;
+    }
+    off += static_cast<std::size_t>(w);
+  }
+  lf.size += batch.size();
+  lf.write_failed = false;
+}
 
-	      {
-		std::unique_lock<std::mutex> lk(dl_mtx);
-		dl_cv.wait(lk, [&] { return !dl_waiting || g_stop.load(); });
+static void log_file_main() {
+  auto &lf = g_log_file;
+  std::string batch;
+  LogRecord rec;
+  for (;;) {
+    bool stopping;
+    {
+      std::unique_lock<std::mutex> lk(lf.mtx);
+      lf.cv.wait_for(lk, kLogFileFlushEvery, [&] { return lf.stop; });
+      stopping = lf.stop;
+    }
+    batch.clear();
+    std::uint64_t n = 0;
+    while (g_log_file_ring.pop(rec)) {
+      append_log_record(batch, rec, lf.json);
+      ++n;
+    }
+    const std::uint64_t dropped = g_log_file_dropped.load(std::memory_order_relaxed);
+    if (dropped != lf.dropped_reported) {
+      LogRecord note;
+      note.level = LogLevel::Warn;
+      note.event = "log_dropped";
+      note.text = "[LOG] " + std::to_string(dropped - lf.dropped_reported) +
+                  " message(s) dropped, log ring full";
+      note.ts_us = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count();
+      append_log_record(batch, note, lf.json);
+      lf.dropped_reported = dropped;
+    }
+    if (!batch.empty()) write_log_batch(lf, batch);
+    lf.records.fetch_add(n, std::memory_order_relaxed);
+    if (stopping) break;
+  }
+  if (lf.fd >= 0) { ::close(lf.fd); lf.fd = -1; }
+}
+
+// Flushes what is queued and closes the file. Registered with atexit so every
+// exit path drains the ring; must not log.
+static void stop_log_file() {
+  auto &lf = g_log_file;
+  if (!lf.thread.joinable()) return;
+  g_log_file_active.store(false, std::memory_order_release);
+  {
+    std::lock_guard<std::mutex> lk(lf.mtx);
+    lf.stop = true;
+  }
+  lf.cv.notify_one();
+  lf.thread.join();
+}
+
+static bool start_log_file(const std::string &path, bool json, long rotate_mb, long rotate_hours) {
+  auto &lf = g_log_file;
+  lf.path = expand_user_path(path);
+  lf.json = json;
+  lf.max_bytes = rotate_mb > 0 ? static_cast<std::uint64_t>(rotate_mb) << 20 : 0;
+  lf.max_age = std::chrono::hours(rotate_hours > 0 ? rotate_hours : 0);
+  std::error_code ec;
+  auto parent = std::filesystem::path(lf.path).parent_path();
+  if (!parent.empty()) std::filesystem::create_directories(parent, ec);
+  if (!open_log_file_locked(lf)) {
+    LOGE("log-file: cannot open " << lf.path << ": " << std::strerror(errno));
+    return false;
+  }
+  g_log_file_active.store(true, std::memory_order_release);
+  lf.thread = std::thread(log_file_main);
+  std::atexit(stop_log_file);
+  return true;
+}
 
-	      }
-	      if (sync_transfer_id != 0) unregister_sync_transfer(sync_transfer_id);
+// ----------------------------
+// Sync hook batching
+// ----------------------------
+// With `--sync-batch <n>`, `sync` events for --cmd/--rules are collected and
+// delivered once per n files or `--sync-batch-secs` seconds, whichever comes
+// first, as `--batch sync <count> <path>...`. Batches too large for the
+// command line pass `@<file>` instead, one path per line; the file is removed
+// once every handler that received it has exited. `new` and `rating` events
+// (and the hook server) stay per file.
+static constexpr std::size_t kHookBatchInlineBytes = 32 * 1024;
+
+static std::atomic<std::size_t> g_sync_batch_max{0};  // 0 = per-file hooks
+static std::atomic<int> g_sync_batch_secs{10};
+
+struct SyncBatcher {
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::vector<std::string> paths;
+  std::chrono::steady_clock::time_point first_at{};
+  std::thread timer;
+  bool stop = false;
+  std::uint64_t batches = 0, files = 0;
+};
+static SyncBatcher g_sync_batcher;
+
+static HookAttachment write_batch_argfile(const std::vector<std::string> &paths,
+                                          std::string &file_path) {
+  std::string dir = join_path(get_cache_dir(), "batches");
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  std::string templ = join_path(dir, "sync-XXXXXX");
+  std::vector<char> name(templ.begin(), templ.end());
+  name.push_back('\0');
+  int fd = mkstemp(name.data());
+  if (fd < 0) {
+    LOGE("sync batch: cannot create argument file in " << dir << ": " << std::strerror(errno));
+    return nullptr;
+  }
+  std::string body;
+  for (const auto &p : paths) body += p + '\n';
+  bool ok = true;
+  for (std::size_t off = 0; off < body.size() && ok;) {
+    ssize_t w = write(fd, body.data() + off, body.size() - off);
+    if (w < 0 && errno == EINTR) continue;
+    ok = w > 0;
+    if (ok) off += static_cast<std::size_t>(w);
+  }
+  close(fd);
+  file_path = name.data();
+  if (!ok) {
+    LOGE("sync batch: cannot write " << file_path);
+    ::unlink(file_path.c_str());
+    return nullptr;
+  }
+  return std::shared_ptr<const std::string>(new std::string(file_path), [](const std::string *p) {
+    ::unlink(p->c_str());
+    delete p;
+  });
+}
 
-	if (is_sync && g_sync_abort.load(std::memory_order_acquire)) {
-	  // We just finished a file; exit early.
-	  break;
-	}
+static void deliver_sync_batch(std::vector<std::string> paths) {
+  if (paths.empty()) return;
+  std::vector<std::string> args{"--batch", "sync", std::to_string(paths.size())};
+  std::size_t bytes = 0;
+  for (const auto &p : paths) bytes += p.size() + 1;
+  HookAttachment argfile;
+  if (bytes <= kHookBatchInlineBytes) {
+    args.insert(args.end(), paths.begin(), paths.end());
+  } else {
+    std::string file_path;
+    argfile = write_batch_argfile(paths, file_path);
+    if (!argfile) return;
+    args.push_back("@" + file_path);
+  }
+  if (!g_post_cmd.empty()) run_post_cmd_args(g_post_cmd, args, argfile);
+  dispatch_hook_rules(args, argfile, RuleAudience::Batch);
+}
 
-	      if (g_stop.load(std::memory_order_relaxed)) break;
-	    }
-	  }
-	};
+static void sync_batcher_main() {
+  auto &b = g_sync_batcher;
+  std::unique_lock<std::mutex> lk(b.mtx);
+  for (;;) {
+    if (b.paths.empty()) {
+      b.cv.wait(lk, [&] { return b.stop || !b.paths.empty(); });
+    } else {
+      auto deadline = b.first_at + std::chrono::seconds(g_sync_batch_secs.load());
+      b.cv.wait_until(lk, deadline, [&] { return b.stop; });
+    }
+    const bool due = !b.paths.empty() &&
+                     std::chrono::steady_clock::now() >=
+                         b.first_at + std::chrono::seconds(g_sync_batch_secs.load());
+    if (due || (b.stop && !b.paths.empty())) {
+      std::vector<std::string> batch;
+      batch.swap(b.paths);
+      ++b.batches;
+      lk.unlock();
+      deliver_sync_batch(std::move(batch));
+      lk.lock();
+    }
+    if (b.stop) return;
+  }
+}
 
-	// -------- fetch & process --------
-	std::uint64_t observed_update_time = 0;
-	if (sync_star) {
-	  observed_update_time = wait_for_contents_list_refresh(handle, slot, verbose);
-	}
+static void add_to_sync_batch(const std::string &path) {
+  auto &b = g_sync_batcher;
+  std::vector<std::string> full;
+  {
+    std::lock_guard<std::mutex> lk(b.mtx);
+    if (b.stop) return;
+    if (!b.timer.joinable()) b.timer = std::thread(sync_batcher_main);
+    if (b.paths.empty()) b.first_at = std::chrono::steady_clock::now();
+    b.paths.push_back(path);
+    ++b.files;
+    if (b.paths.size() >= g_sync_batch_max.load()) {
+      full.swap(b.paths);
+      ++b.batches;
+    }
+  }
+  if (!full.empty()) deliver_sync_batch(std::move(full));
+  else b.cv.notify_one();
+}
 
-	SDK::CrCaptureDate dummy_day{};
-	SDK::CrContentsInfo *list = nullptr; CrInt32u count = 0;
-	SDK::CrError resList = SDK::GetRemoteTransferContentsInfoList(handle, slot,
-							     SDK::CrGetContentsInfoListType_All,
-							     &dummy_day, 0, &list, &count);
-	if (resList != SDK::CrError_None || !list || count == 0) {
-	  if (list) SDK::ReleaseRemoteTransferContentsInfoList(handle, list);
-	  if (verbose) {
-	    LOGI("[INFO] No " << (sync_star ? "starred " : "")
-		 << "contents found (slot=" << (int)slot << ")");
-	  }
-	  return;
-	}
+// Delivers whatever is still collected; called before the hook runner stops.
+static void stop_sync_batcher() {
+  auto &b = g_sync_batcher;
+  {
+    std::lock_guard<std::mutex> lk(b.mtx);
+    b.stop = true;
+  }
+  b.cv.notify_one();
+  if (b.timer.joinable()) b.timer.join();
+}
 
-	if (sync_star && observed_update_time != 0) {
-	  last_contents_update_marker(slot).store(observed_update_time, std::memory_order_relaxed);
-	}
+static bool hooks_configured() {
+  return !g_post_cmd.empty() || hook_rules_configured() || hook_server_configured();
+}
 
-	if (verbose) LOGI("[SYNC] slot " << (int)slot << ": processing contents list...");
-	process_list(list, count, sync_all ? 0 : (addSize > 0 ? addSize : 1));
-	if (verbose) LOGI("[SYNC] slot " << (int)slot << ": releasing contents list...");
-	SDK::ReleaseRemoteTransferContentsInfoList(handle, list);
-	if (verbose) LOGI("[SYNC] slot " << (int)slot << ": contents list released.");
-	if (verbose) LOGI("[SYNC] slot " << (int)slot << ": worker complete.");
-      });
-    } catch (...) {
-      LOGE("[ERROR] Failed to create download thread");
+// Every hook event: the --cmd executable, the --rules handlers (batched for
+// sync when requested) and the --hook-server worker, whichever are configured.
+static void dispatch_hook_event(HookEvent ev) {
+  if (ev.operation == "sync" && g_sync_batch_max.load() > 0) {
+    if (!g_post_cmd.empty() || hook_rules_want_batches()) add_to_sync_batch(ev.path);
+    dispatch_hook_rules(ev.argv, nullptr, RuleAudience::PerFile);
+  } else {
+    if (!g_post_cmd.empty()) run_post_cmd_args(g_post_cmd, ev.argv);
+    dispatch_hook_rules(ev.argv);
+  }
+  if (hook_server_configured()) {
+    if (!ev.size && !ev.path.empty()) {
+      std::error_code ec;
+      auto bytes = std::filesystem::file_size(ev.path, ec);
+      if (!ec) ev.size = bytes;
     }
-
+    hook_server_enqueue(ev);
   }
+}
 
-  void OnNotifyContentsTransfer(CrInt32u, SDK::CrContentHandle, CrChar *) override {}
+static void run_post_cmd(const std::string &file,
+                         const std::string &mode,
+                         const std::string &command,
+                         const std::string &old_value = {},
+                         const std::string &new_value = {},
+                         int slot = 0,
+                         std::optional<CrInt32u> content_id = std::nullopt) {
+  HookEvent ev;
+  ev.argv = {file, mode, command};
+  if (!old_value.empty() || !new_value.empty()) {
+    ev.argv.push_back(old_value);
+    if (!new_value.empty()) {
+      ev.argv.push_back(new_value);
+    }
+  }
+  ev.path = file;
+  ev.mode = mode;
+  ev.operation = command;
+  ev.new_value = new_value;
+  ev.old_value = old_value;
+  ev.slot = slot;
+  ev.content_id = content_id;
+  dispatch_hook_event(std::move(ev));
+}
 
-  void OnNotifyRemoteTransferResult(CrInt32u notify, CrInt32u per, CrChar *filename) override
+// ----------------------------
+// Metrics
+// ----------------------------
+static int log_metrics() {
+  const auto &pm = g_prop_refresh_metrics;
+  const std::uint64_t callbacks = pm.callbacks.load();
+  const std::uint64_t refreshes = pm.refreshes.load();
+  const int hz = g_prop_rate_hz.load();
+  LOGI("Property refresh:");
+  LOGI("  rate cap            " << (hz > 0 ? std::to_string(hz) + " Hz" : std::string("unlimited")));
+  LOGI("  callbacks           " << callbacks << " (coalesced into " << refreshes << " refreshes)");
+  if (refreshes) {
+    LOGI("  refresh time        avg " << std::fixed << std::setprecision(1)
+         << (pm.total_us.load() / 1000.0 / refreshes) << " ms, max "
+         << (pm.max_us.load() / 1000.0) << " ms" << std::defaultfloat);
+  }
   {
-    std::unique_lock<std::mutex> lk(dl_mtx);
+    std::lock_guard<std::mutex> lk(g_hook_mtx);
+    const auto &hs = g_hook_stats;
+    LOGI("Hooks:");
+    LOGI("  in flight           " << g_hook_running.size() << " (limit "
+         << g_hook_max_inflight.load() << ")");
+    LOGI("  queued              " << g_hook_pending.size() << " (peak " << hs.peak_pending << ")");
+    LOGI("  launched            " << hs.launched << ", " << hs.failed << " failed, "
+         << hs.spawn_failed << " could not start");
+    if (!hs.durations_ms.empty()) {
+      std::vector<double> sorted(hs.durations_ms);
+      std::sort(sorted.begin(), sorted.end());
+      auto pct = [&](double p) {
+        return sorted[std::min(sorted.size() - 1, static_cast<std::size_t>(p * sorted.size()))];
+      };
+      LOGI("  runtime             p50 " << std::fixed << std::setprecision(1) << pct(0.50)
+           << " ms, p95 " << pct(0.95) << " ms, max " << sorted.back() << " ms (last "
+           << sorted.size() << ")" << std::defaultfloat);
+    }
+  }
+  if (g_sync_batch_max.load()) {
+    auto &b = g_sync_batcher;
+    std::lock_guard<std::mutex> lk(b.mtx);
+    LOGI("Sync hook batching:");
+    LOGI("  batch size          " << g_sync_batch_max.load() << " files / "
+         << g_sync_batch_secs.load() << " s");
+    LOGI("  delivered           " << b.files - b.paths.size() << " file(s) in " << b.batches
+         << " batch(es), " << b.paths.size() << " collecting");
+  }
+  if (hook_server_configured()) {
+    auto &srv = g_hook_server;
+    std::lock_guard<std::mutex> lk(srv.mtx);
+    LOGI("Hook server:");
+    LOGI("  worker              " << (srv.alive ? "running (pid " + std::to_string(srv.pid) + ")"
+                                                : std::string("not running"))
+         << ", " << srv.restarts << " restart(s)");
+    LOGI("  events              " << srv.sent << " sent, " << srv.queue.size() << " queued, "
+         << srv.dropped << " dropped");
+    if (srv.ack_window) {
+      LOGI("  acks                " << srv.acked << " received, " << srv.unacked.size()
+           << " outstanding (window " << srv.ack_window << ")");
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lk(g_cmd_mtx);
+    LOGI("Commands:");
+    LOGI("  async               " << g_cmd_running << " running, " << g_cmd_queue.size()
+         << " queued, " << g_cmd_async_done << " done, " << g_cmd_async_dropped << " dropped");
+  }
+  {
+    std::lock_guard<std::mutex> lk(g_shutter_mtx);
+    const auto &st = g_shutter_stats;
+    LOGI("Shutter:");
+    LOGI("  shots               " << st.shots << " (fast capture "
+         << (g_fast_shutter.load() ? "on" : "off") << ")");
+    if (st.shots) {
+      LOGI("  release latency     avg " << std::fixed << std::setprecision(1)
+           << st.latency_total_ms / st.shots << " ms, max " << st.latency_max_ms << " ms");
+    }
+    if (st.af_waits || st.acks || st.ack_timeouts) {
+      LOGI("  af / ack timeouts   " << st.af_timeouts << "/" << st.af_waits << ", "
+           << st.ack_timeouts << "/" << st.acks + st.ack_timeouts);
+    }
+  }
+  LOGI("Log ring:");
+  LOGI("  dropped             " << g_log_dropped.load() << " (ring of " << kLogRingSlots
+       << "), " << g_log_truncated.load() << " truncated");
+  LOGI("  repeats suppressed  " << g_log_suppressed.load() << " (limit "
+       << g_log_repeat_burst.load() << " per " << kLogRepeatWindow.count() << " s)");
+  if (g_log_file_active.load()) {
+    LOGI("Log file:");
+    LOGI("  file                " << g_log_file.path << (g_log_file.json ? " (json)" : " (text)"));
+    LOGI("  records             " << g_log_file.records.load() << " written, "
+         << g_log_file_dropped.load() << " dropped, " << g_log_file.rotations.load()
+         << " rotation(s)");
+  }
+  if (g_prop_rec_active.load()) {
+    LOGI("Property recorder:");
+    LOGI("  file                " << g_prop_rec_path);
+    LOGI("  frames              " << g_prop_rec_frames.load() << " written, "
+         << g_prop_rec_dropped.load() << " dropped");
+  }
+  return 0;
+}
 
-    if (filename) last_downloaded_file = filename; else last_downloaded_file.clear();
-    dl_notify_code = notify; dl_progress = per;
+class QuietCallback : public SDK::IDeviceCallback {
+public:
+  SDK::CrDeviceHandle device_handle = 0;
+  bool verbose = false;
 
-    bool sync_aborted = g_sync_abort.load(std::memory_order_acquire);
+  // handshake
+  std::mutex mtx;
+  std::condition_variable conn_cv;
+  bool connected = false;
+  bool conn_finished = false;
+  CrInt32u last_error_code = 0;
 
-    // Choose a human label: prefer filename from SDK, else the precomputed label.
-    std::string label = last_downloaded_file.empty() ? dl_current_label : last_downloaded_file;
-    // For nicer logs, strip to a relative path if possible (optional).
-    if (!label.empty()) {
-      // leave label as-is; it already is relative (relDir/finalName) in our pre-label
+  // download sync
+  std::mutex dl_mtx;
+  std::condition_variable dl_cv;
+  bool dl_waiting = false;
+  CrInt32u dl_notify_code = 0;
+  CrInt32u dl_progress = 0;
+  std::string last_downloaded_file;
+  // inside class QuietCallback (near other dl_* fields)
+  CrInt32u dl_last_log_per = 101; // 0..100; 101 = "unset"
+  std::chrono::steady_clock::time_point dl_last_log_tp{};
+  std::string dl_current_label; // e.g., "PRIVATE/M4ROOT/CLIP/DSC01234.MP4"
+  std::chrono::steady_clock::time_point dl_start_tp{};
+  bool dl_any_progress = false;
+  std::string dl_current_mode;
+  std::string dl_current_operation;
+  int dl_current_slot = 0;
+  std::optional<CrInt32u> dl_current_content_id;
+  
+  void OnConnected(SDK::DeviceConnectionVersioin v) override {
+    if (g_shutting_down.load()) return;
+    if (verbose) LOGI( "[CB] OnConnected v=" << v );
+    {
+      std::lock_guard<std::mutex> lk(mtx); connected = true; conn_finished = true;
     }
+    conn_cv.notify_all();
+  }
 
-    if (notify == SDK::CrNotify_RemoteTransfer_InProgress) {
-      if (sync_aborted) {
-        // Suppress noise while waiting for the device to acknowledge cancellation.
-        return;
-      }
-      update_matching_sync_transfer(label, per);
-      // Throttle: log when +5% or +1s since last log (and always at 0%)
-      auto now = std::chrono::steady_clock::now();
-      bool time_ok = (dl_last_log_tp.time_since_epoch().count() == 0) ||
-	(now - dl_last_log_tp) >= std::chrono::seconds(1);
-      bool perc_ok = (dl_last_log_per == 101) || (per >= dl_last_log_per + 5);
-
-      if (time_ok || perc_ok) {
-	  if (verbose) LOGI("[DL] " << (label.empty() ? "(unknown file)" : label) << " — " << per << "%");
-	dl_last_log_per = per;
-	dl_last_log_tp = now;
-	dl_any_progress = true;
-      }
-      // stay waiting; do NOT signal cv yet
-      return;
+  void OnDisconnected(CrInt32u error) override {
+    if (g_shutting_down.load()) return;
+    if (verbose) {
+      LOGI( "[CB] OnDisconnected: 0x" << std::hex << error << std::dec << " (" << crsdk_err::error_to_name(error) << ")" );
     }
-
-    // Non-progress notifications: finish/abort/etc.
-    if (notify == SDK::CrNotify_RemoteTransfer_Result_OK) {
-      update_matching_sync_transfer(label, 100);
+    {
+      std::lock_guard<std::mutex> lk(mtx); last_error_code = error; conn_finished = true;
+    }
+    conn_cv.notify_all();
+    {
+      std::lock_guard<std::mutex> lk(dl_mtx); dl_waiting = false;
     }
-    dl_waiting = false;
     dl_cv.notify_all();
+    g_reconnect.store(true);
+  }
 
-    if (sync_aborted) {
-      if (notify == SDK::CrNotify_RemoteTransfer_Result_OK) {
-        LOGI("[DL] Completed before cancel request took effect: "
-             << (label.empty() ? "(unknown file)" : label));
-      } else {
-        LOGI("[DL] Canceled: " << (label.empty() ? "(unknown file)" : label)
-             << " (notify=0x" << std::hex << notify << std::dec << ")");
-      }
-      return;
+  void OnWarning(CrInt32u w) override {
+    if (g_shutting_down.load()) return;
+    if (verbose) {
+      LOG_EV(LogLevel::Info, LogFields().ev("sdk_warning").with_code(w),
+             "[CB] OnWarning: " << crsdk_err::warning_to_name(w) << " (0x" << std::hex << w << std::dec << ")");
     }
+  }
 
-    if (notify == SDK::CrNotify_RemoteTransfer_Result_OK) {
-      // No extra "100%" line; keep output compact.
-      std::string saved = last_downloaded_file;
-      std::string base = saved;
-      size_t pos = base.find_last_of("/\\"); if (pos != std::string::npos) base = base.substr(pos + 1);
-      long long sizeB = 0; struct stat st{}; if (::stat(saved.c_str(), &st) == 0) sizeB = (long long)st.st_size;
+  void OnWarningExt(CrInt32u warning, CrInt32 param1, CrInt32 param2, CrInt32 param3) override {
+    if (g_shutting_down.load()) return;
+    LOG_EV(LogLevel::Info, LogFields().ev("sdk_warning").with_code(warning),
+           "[CB] OnWarningExt: " << crsdk_err::warning_to_name(warning)
+           << " (0x" << std::hex << warning << std::dec << ")"
+           << " p1=0x" << std::hex << param1
+           << " p2=0x" << param2
+           << " p3=0x" << param3 << std::dec
+           << " | p1=" << param1 << ", p2=" << param2 << ", p3=" << param3);
+  }
 
-      // Optional: include elapsed time (kept simple; remove if you prefer)
-      auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-									      std::chrono::steady_clock::now() - dl_start_tp).count();
+  void OnError(CrInt32u e) override {
+    if (g_shutting_down.load()) return;
+    LOG_EV(LogLevel::Info, LogFields().ev("sdk_error").with_code(e),
+           "[CB] OnError: " << crsdk_err::error_to_name(e) << " (0x" << std::hex << e << std::dec << ")");
+    {
+      std::lock_guard<std::mutex> lk(mtx); last_error_code = e; conn_finished = true;
+    }
+    conn_cv.notify_all();
+  }
 
-      // For small files (no progress logs), this is the ONLY line.
-      LOGI("[FILE] " << base << " (" << sizeB << " bytes"
-           << ", " << elapsed_ms << " ms)");
+private:
+  // Ratings can only be edited on the body in playback, so list changes in
+  // record mode (new captures) do not trigger a rating diff.
+  bool in_playback_mode_() const {
+    static const int kSlot = crsdk_util::prop_code_to_slot(SDK::CrDeviceProperty_CameraOperatingMode);
+    return kSlot >= 0 && prop_seen_.test(static_cast<std::size_t>(kSlot)) &&
+           (prop_vals_[static_cast<std::size_t>(kSlot)] & 0xFFFF) == SDK::CrCameraOperatingMode_Playback;
+  }
 
-      if (!g_post_cmd.empty() && !saved.empty()) {
-        std::string mode_text = dl_current_mode.empty()
-                                  ? current_mode_string(device_handle)
-                                  : dl_current_mode;
-        std::string operation = dl_current_operation.empty() ? "new" : dl_current_operation;
-        std::string new_value = dl_current_label.empty() ? base : dl_current_label;
-        run_post_cmd(g_post_cmd, saved, mode_text, operation, "", new_value);
-      }
+  // Slot for position i of the property array. Bodies report the same codes
+  // in the same order on every pull, so this is normally one compare.
+  int slot_at_(std::size_t i, CrInt32u code) {
+    if (i >= prop_pos_codes_.size()) {
+      prop_pos_codes_.resize(i + 1, 0);
+      prop_pos_slots_.resize(i + 1, kSlotUnresolved);
+    } else if (prop_pos_codes_[i] == code && prop_pos_slots_[i] != kSlotUnresolved) {
+      return prop_pos_slots_[i];
+    }
+    prop_pos_codes_[i] = code;
+    prop_pos_slots_[i] = crsdk_util::prop_code_to_slot(code);
+    return prop_pos_slots_[i];
+  }
 
-      dl_current_mode.clear();
-      dl_current_operation.clear();
+  void mark_properties_dirty_(unsigned bit) {
+    if (g_shutting_down.load()) return;
+    g_prop_refresh_metrics.callbacks.fetch_add(1, std::memory_order_relaxed);
+    // Only the clean -> dirty edge needs a wake-up; later callbacks fold in.
+    if (prop_dirty_.fetch_or(bit, std::memory_order_acq_rel) == 0) {
+      std::lock_guard<std::mutex> lk(prop_wake_mtx_);
+      prop_wake_cv_.notify_one();
+    }
+  }
 
-    } else {
-      LOGE("[DL] Failed: " << (label.empty() ? "(unknown file)" : label)
-	   << " (notify=0x" << std::hex << notify << std::dec << ")");
-      dl_current_mode.clear();
-      dl_current_operation.clear();
+  void property_refresher_main_() {
+    auto next_allowed = std::chrono::steady_clock::now();
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lk(prop_wake_mtx_);
+        prop_wake_cv_.wait(lk, [this] {
+          return prop_refresher_stop_ || prop_dirty_.load(std::memory_order_acquire) != 0;
+        });
+        // Hold off until the rate cap allows another pull; callbacks that
+        // arrive meanwhile are served by the same refresh.
+        if (!prop_refresher_stop_ && g_prop_rate_hz.load(std::memory_order_relaxed) > 0) {
+          prop_wake_cv_.wait_until(lk, next_allowed, [this] { return prop_refresher_stop_; });
+        }
+        if (prop_refresher_stop_) return;
+      }
+      unsigned bits = prop_dirty_.exchange(0, std::memory_order_acq_rel);
+      if (!bits) continue;
+      auto started = std::chrono::steady_clock::now();
+      {
+        std::lock_guard<std::mutex> lk(prop_refresh_mtx_);
+        if (!prop_refresh_enabled_ || g_shutting_down.load()) continue;
+        log_changed_properties_((bits & kDirtyProp) ? "[CB] OnPropertyChanged"
+                                                    : "[CB] OnLvPropertyChanged");
+      }
+      auto finished = std::chrono::steady_clock::now();
+      auto us = static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::microseconds>(finished - started).count());
+      g_prop_refresh_metrics.refreshes.fetch_add(1, std::memory_order_relaxed);
+      g_prop_refresh_metrics.total_us.fetch_add(us, std::memory_order_relaxed);
+      if (us > g_prop_refresh_metrics.max_us.load(std::memory_order_relaxed)) {
+        g_prop_refresh_metrics.max_us.store(us, std::memory_order_relaxed);
+      }
+      int hz = g_prop_rate_hz.load(std::memory_order_relaxed);
+      next_allowed = started + (hz > 0 ? std::chrono::microseconds(1000000 / hz)
+                                       : std::chrono::microseconds(0));
     }
   }
 
+  void log_changed_properties_(const char *tag) {
+    if (!device_handle) return;
+    SDK::CrDeviceProperty *props = nullptr; CrInt32 nprop = 0;
+    auto er = SDK::GetDeviceProperties(device_handle, &props, &nprop);
+    if (er != SDK::CrError_None || nprop <= 0 || !props) return;
+    struct Change { CrInt32u code; CrInt64u val; CrInt64u prev; bool had_prev; };
+    std::vector<Change> moved;
+    PropertyBits changed;
+    for (int i = 0; i < nprop; ++i) {
+      CrInt32u code = props[i].GetCode();
+      CrInt64u val = props[i].GetCurrentValue();
+      int slot = slot_at_(static_cast<std::size_t>(i), code);
+      bool had_prev;
+      CrInt64u prev = 0;
+      if (slot >= 0) {
+        const std::size_t s = static_cast<std::size_t>(slot);
+        had_prev = prop_seen_.test(s);
+        prev = prop_vals_[s];
+        if (had_prev && prev == val) continue;
+        prop_vals_[s] = val;
+        prop_seen_.set(s);
+        changed.set(s);
+      } else {
+        auto it = extra_prop_vals_.find(code);
+        had_prev = (it != extra_prop_vals_.end());
+        if (had_prev) prev = it->second;
+        if (had_prev && prev == val) continue;
+        extra_prop_vals_[code] = val;
+      }
+      moved.push_back({code, val, prev, had_prev});
+    }
+    // Publish before acting on the changes: jobs scheduled below read it.
+    publish_property_snapshot(props, nprop, changed);
+    SDK::ReleaseDeviceProperties(device_handle, props);
+    if (g_prop_rec_active.load(std::memory_order_relaxed)) {
+      PropFrame frame;
+      frame.epoch_ms = epoch_now_ms();
+      frame.changes.reserve(moved.size());
+      for (const Change &c : moved) frame.changes.emplace_back(c.code, c.val);
+      prop_recorder_push(std::move(frame));
+    }
 
-  void OnNotifyRemoteTransferResult(CrInt32u, CrInt32u, CrInt8u *, CrInt64u) override {}
-  void OnNotifyFTPTransferResult(CrInt32u, CrInt32u, CrInt32u) override {}
-  void OnNotifyRemoteFirmwareUpdateResult(CrInt32u, const void *) override {}
-  void OnReceivePlaybackTimeCode(CrInt32u) override {}
-  void OnNotifyMonitorUpdated(CrInt32u, CrInt32u) override {}
+    for (const Change &c : moved) {
+      const CrInt32u code = c.code;
+      const CrInt64u val = c.val;
+      if (verbose) {
+        const char *name = crsdk_util::prop_code_to_name(code);
+        std::ostringstream msg;
+        msg << tag << ": " << name << " (0x" << std::hex << code << std::dec << ") -> "
+            << (long long)val;
+        if (c.had_prev) {
+          msg << " (prev=" << (long long)c.prev << ')';
+        }
+        LOGI(msg.str());
+      }
+      if (code == SDK::CrDeviceProperty_CameraButtonFunctionStatus) {
+        auto status = static_cast<CrInt16u>(val & 0xFFFF);
+        if (status == SDK::CrCameraButtonFunctionStatus_AnyKeyOn) {
+          schedule_playback_button_job();
+        }
+      } else if (code == SDK::CrDeviceProperty_CameraOperatingMode) {
+        // Snapshot the list on entering playback so the first edit has a baseline.
+        if ((val & 0xFFFF) == SDK::CrCameraOperatingMode_Playback) {
+          schedule_playback_button_job();
+        }
+      } else if (c.had_prev && in_playback_mode_() &&
+                 code == SDK::CrDeviceProperty_MediaSLOT1_ContentsInfoListUpdateTime) {
+        schedule_rating_diff(SDK::CrSlotNumber_Slot1);
+      } else if (c.had_prev && in_playback_mode_() &&
+                 code == SDK::CrDeviceProperty_MediaSLOT2_ContentsInfoListUpdateTime) {
+        schedule_rating_diff(SDK::CrSlotNumber_Slot2);
+      }
+    }
+  }
 
-private:
-  std::unordered_map<CrInt32u, CrInt64u> last_prop_vals;
-};
+public:
+  
+  ~QuietCallback() { stop_property_refresher(); }
 
-// Attempt a single connect (by direct IP or enumeration). Returns true on success.
-static bool try_connect_once(const std::string &explicit_host,
-                             const std::string &explicit_mac,
-                             const std::string &explicit_model,
-                             const std::string &download_dir,
-                             bool verbose,
-                             const std::string &auth_user,
-                             const std::string &auth_pass,
-                             QuietCallback &cb,
-                             SDK::CrDeviceHandle &handle,
-                             const SDK::ICrCameraObjectInfo *&selected,
-                             SDK::ICrEnumCameraObjectInfo *&enum_list,
-                             SDK::ICrCameraObjectInfo *&created)
-{
-  cb.verbose = verbose;
-  SDK::CrError err = SDK::CrError_None;
-  selected = nullptr; enum_list = nullptr; created = nullptr; handle = 0;
-  auto model_choice = resolve_camera_model_choice(explicit_model);
-  bool have_canonical = !model_choice.canonical.empty();
+  // SDK callback threads return immediately; the refresher does the pull.
+  void OnPropertyChanged() override { mark_properties_dirty_(kDirtyProp); }
 
-  SDK::CrCameraDeviceModelList direct_ip_model = model_choice.direct_value.value_or(SDK::CrCameraDeviceModel_ILCE_6700);
-  bool direct_model_is_guess = have_canonical && !model_choice.direct_value.has_value();
+  void OnLvPropertyChanged() override { mark_properties_dirty_(kDirtyLv); }
 
-  // Used by the direct-IP path and (maybe) a retry:
-  unsigned char direct_ip_mac[6] = {0,0,0,0,0,0};
-  
-  // Parse explicit_host ("x.y.z.w") into CrInt32u as required by the SDK
-  CrInt32u direct_ip_addr_num = 0;
-  if (!explicit_host.empty()) {
-    struct in_addr ina{};
-    if (inet_pton(AF_INET, explicit_host.c_str(), &ina) == 1) {
-      // Keep network byte order (big-endian) as CrInt32u
-      direct_ip_addr_num = static_cast<CrInt32u>(ina.s_addr);
-    } else {
-      LOGE("Invalid IPv4 address: " << explicit_host);
-      return false;
+  void start_property_refresher() {
+    if (prop_refresher_.joinable()) return;
+    prop_refresher_stop_ = false;
+    prop_refresher_ = std::thread([this]() { this->property_refresher_main_(); });
+  }
+
+  void stop_property_refresher() {
+    if (!prop_refresher_.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lk(prop_wake_mtx_);
+      prop_refresher_stop_ = true;
     }
+    prop_wake_cv_.notify_all();
+    prop_refresher_.join();
   }
-  
-  // -------- Discover or create camera object --------
-  const bool using_direct_ip = !explicit_host.empty();
-  if (!using_direct_ip) {
-    if (verbose) LOGI("Searching for cameras...");
-    err = SDK::EnumCameraObjects(&enum_list, 1);
-    if (err != SDK::CrError_None || !enum_list || enum_list->GetCount() == 0) {
-      LOGE("No cameras found (EnumCameraObjects)");
-      return false;
+
+  // Gate around the device handle: disabling waits for an in-flight pull, so
+  // the handle can be released right after.
+  void set_property_refresh_enabled(bool enabled) {
+    std::lock_guard<std::mutex> lk(prop_refresh_mtx_);
+    prop_refresh_enabled_ = enabled;
+    if (!enabled) prop_dirty_.store(0, std::memory_order_relaxed);
+  }
+
+  void schedule_playback_button_job() {
+    if (g_shutting_down.load()) return;
+    spawn_download_thread([this]() {
+      this->process_playback_button_job();
+    });
+  }
+
+  bool download_single_content_file(const ContentsIndex &index,
+                                    std::size_t item,
+                                    std::size_t file,
+                                    std::string &local_path,
+                                    bool skip_existing,
+                                    const char *operation = nullptr) {
+    const SDK::CrSlotNumber slot = index.slot;
+    const CrInt32u contentId = index.content_ids[item];
+    const CrInt32u fileId = index.file_ids[file];
+    const std::string remotePath = index.file_path(file);
+    std::string orig = basename_from_path(remotePath.c_str());
+    if (orig.empty()) {
+      std::ostringstream o;
+      o << "content_" << static_cast<unsigned long long>(contentId)
+        << "_file_" << fileId;
+      orig = o.str();
     }
-    selected = enum_list->GetCameraObjectInfo(0);
-    if (!selected) {
-      LOGE("Enumeration returned an empty camera list");
-      return false;
+
+    std::string relDir = dirname_from_path(remotePath.c_str());
+    std::string destDir = g_download_dir;
+    if (!relDir.empty()) {
+      destDir = destDir.empty() ? relDir : join_path(destDir, relDir);
     }
-    if (have_canonical && !model_name_matches(selected, model_choice.canonical)) {
-      const char *model_ptr = reinterpret_cast<const char*>(selected->GetModel());
-      LOGW("--model='" << model_choice.canonical
-           << "' ignored; proceeding with first enumerated camera"
-           << (model_ptr ? std::string(" ('") + model_ptr + "')" : std::string("")));
+
+    std::error_code ec;
+    if (!destDir.empty()) {
+      std::filesystem::create_directories(destDir, ec);
     }
-  } else {
-    // --- Direct IP path ---
-    bool mac_filter_set = false;
-    if (!explicit_mac.empty()) {
-      if (!parse_mac(explicit_mac, direct_ip_mac)) {
-        LOGE("WARN bad MAC, ignoring: " << explicit_mac);
+
+    std::string finalName = orig;
+    std::string candidatePath = join_path(destDir, finalName);
+    local_path = candidatePath;
+
+    if (skip_existing) {
+      std::error_code exists_ec;
+      if (std::filesystem::exists(candidatePath, exists_ec) && !exists_ec) {
+        return true;
+      }
+    }
+
+    std::unique_lock<std::mutex> transfer_lk(g_transfer_mtx);
+    dl_waiting = true;
+    dl_current_label = join_path(relDir, finalName);
+    if (operation) {
+      dl_current_operation = operation;
+      dl_current_mode = capture_mode_string(device_handle, index.file_is_movie(file));
+    }
+    dl_current_slot = static_cast<int>(slot);
+    dl_current_content_id = contentId;
+    dl_last_log_per = 101;
+    dl_last_log_tp = std::chrono::steady_clock::now();
+    dl_start_tp = dl_last_log_tp;
+    dl_any_progress = false;
+
+    CrChar *saveDir = destDir.empty()
+                        ? nullptr
+                        : const_cast<CrChar *>(reinterpret_cast<const CrChar *>(destDir.c_str()));
+    CrChar *fileName = const_cast<CrChar *>(reinterpret_cast<const CrChar *>(finalName.c_str()));
+
+    SDK::CrError err = SDK::GetRemoteTransferContentsDataFile(
+        device_handle, slot, contentId, fileId, 0x1000000,
+        saveDir, fileName);
+    if (err != SDK::CrError_None) {
+      dl_waiting = false;
+      LOGE("GetRemoteTransferContentsDataFile failed: "
+           << crsdk_err::error_to_name(err) << " (0x" << std::hex << err << std::dec << ")");
+      return false;
+    }
+
+    {
+      std::unique_lock<std::mutex> lk(dl_mtx);
+      dl_cv.wait(lk, [&] { return !dl_waiting || g_stop.load(); });
+    }
+
+    if (g_stop.load(std::memory_order_relaxed)) return false;
+
+    if (!last_downloaded_file.empty()) {
+      local_path = last_downloaded_file;
+    }
+    return true;
+  }
+
+  void process_playback_button_job() {
+    if (g_shutting_down.load()) return;
+    if (!device_handle) return;
+
+    auto playback_media = cached_property(device_handle, SDK::CrDeviceProperty_PlaybackMedia);
+    SDK::CrSlotNumber slot = SDK::CrSlotNumber_Slot1;
+    if (playback_media.supported &&
+        playback_media.value == SDK::CrPlaybackMedia_Slot2) {
+      slot = SDK::CrSlotNumber_Slot2;
+    }
+    process_rating_diff(slot);
+  }
+
+  // Coalesces rating checks: at most one queued job per slot; a job that is
+  // already running re-reads the update time, so later changes are not lost.
+  void schedule_rating_diff(SDK::CrSlotNumber slot) {
+    if (g_shutting_down.load()) return;
+    auto &pending = rating_diff_pending_[slot == SDK::CrSlotNumber_Slot2 ? 1 : 0];
+    if (pending.exchange(true, std::memory_order_acq_rel)) return;
+    spawn_download_thread([this, slot, &pending]() {
+      pending.store(false, std::memory_order_release);
+      this->process_rating_diff(slot);
+    });
+  }
+
+  // Detects star-rating edits by diffing the previous contents snapshot with a
+  // fresh one whenever ContentsInfoListUpdateTime moves: one list fetch per
+  // change instead of polling the camera.
+  void process_rating_diff(SDK::CrSlotNumber slot) {
+    if (g_shutting_down.load()) return;
+    SDK::CrDeviceHandle handle = device_handle;
+    if (!handle) return;
+    std::lock_guard<std::mutex> diff_lk(rating_diff_mtx_);
+
+    auto &snapshot = rating_snapshots_[slot == SDK::CrSlotNumber_Slot2 ? 1 : 0];
+    auto update_prop = fetch_property(handle, contents_update_property_code(slot));
+    if (!update_prop.supported || update_prop.value == 0) return;
+    const std::uint64_t update_time = static_cast<std::uint64_t>(update_prop.value);
+    if (snapshot.index && snapshot.update_time == update_time) return;
+
+    if (!snapshot.index) {
+      // Seed from a listing another worker already made, if there is one.
+      snapshot.reset(cached_contents_index(slot), 0);
+    }
+    auto fresh = fetch_contents_index(handle, slot);
+    if (!fresh) return;
+    RatingSnapshot previous = std::move(snapshot);
+    snapshot.reset(fresh, update_time);
+    last_contents_update_marker(slot).store(update_time, std::memory_order_relaxed);
+
+    // (item, previous rating). Without an earlier snapshot this session, the
+    // persistent ledger supplies the previous values instead.
+    std::vector<std::pair<std::size_t, int>> changes;
+    std::vector<std::pair<std::uint64_t, LedgerRating>> ledger_updates;
+    ledger_updates.reserve(fresh->size());
+    for (std::size_t i = 0; i < fresh->size(); ++i) {
+      const std::uint64_t key = rating_key(slot, fresh->content_ids[i]);
+      const int rating_value = fresh->ratings[i];
+      std::optional<int> prev;
+      if (previous.index) {
+        auto old_it = previous.by_content.find(fresh->content_ids[i]);
+        if (old_it != previous.by_content.end()) prev = previous.index->ratings[old_it->second];
       } else {
-        mac_filter_set = true;
+        prev = ledger_rating(key, fresh->dates[i]);
       }
+      if (prev && *prev != rating_value) changes.emplace_back(i, *prev);
+      ledger_updates.emplace_back(key, LedgerRating{rating_value, fresh->dates[i]});
+    }
+    record_ratings(ledger_updates);
+    if (!previous.index && verbose) {
+      LOGI("[RATING] slot " << (int)slot << ": snapshot of " << fresh->size() << " item(s) recorded.");
+    }
+    if (!previous.index && changes.size() > kRatingLedgerMaxChanges) {
+      // Nobody re-rates that many shots between sessions; more likely the
+      // ledger describes another card that happens to share capture dates.
+      LOGW("[RATING] slot " << (int)slot << ": ledger disagrees on " << changes.size()
+           << " item(s); not treating them as rating edits");
+      return;
     }
 
-    // Attempt to reuse an enumerated object so we avoid guessing the model enum.
-    SDK::ICrEnumCameraObjectInfo *direct_enum = nullptr;
-    err = SDK::EnumCameraObjects(&direct_enum, 1);
-    if (err == SDK::CrError_None && direct_enum && direct_enum->GetCount() > 0) {
-      for (CrInt32u i = 0; i < direct_enum->GetCount(); ++i) {
-        auto info = direct_enum->GetCameraObjectInfo(i);
-        if (!info) continue;
+    std::string playback_path;
+    std::string mode_text;
+    for (const auto &change : changes) {
+      const std::size_t i = change.first;
+      const CrInt32u content_id = fresh->content_ids[i];
+      const int rating_value = fresh->ratings[i];
+      const int prev_rating = change.second;
+
+      if (mode_text.empty()) {
+        auto playback_name = cached_property(handle, SDK::CrDeviceProperty_PlaybackContentsName);
+        playback_path = playback_name.text;
+        auto playback_mode = cached_property(handle, SDK::CrDeviceProperty_CameraOperatingMode);
+        int mode_value = playback_mode.supported ? static_cast<int>(playback_mode.value & 0xFFFF) : -1;
+        mode_text = camera_mode_to_string(mode_value);
+      }
 
-        bool ip_match = false;
-        const char *ip_char = reinterpret_cast<const char*>(info->GetIPAddressChar());
-        if (ip_char && *ip_char) {
-          ip_match = (explicit_host == std::string(ip_char));
-        }
-        if (!ip_match && direct_ip_addr_num != 0) {
-          ip_match = (info->GetIPAddress() == direct_ip_addr_num);
-        }
-        if (!ip_match) continue;
+      // Prefer the file shown in playback, then the first still, then any file.
+      std::size_t file = fresh->files_end(i);
+      auto path_it = snapshot.by_path.find(playback_path);
+      if (path_it != snapshot.by_path.end() && path_it->second.content_id == content_id) {
+        file = path_it->second.file;
+      }
+      for (std::size_t f = fresh->files_begin(i); f < fresh->files_end(i) && file == fresh->files_end(i); ++f) {
+        if (fresh->file_has_image_params(f)) file = f;
+      }
+      if (file == fresh->files_end(i)) file = fresh->files_begin(i);
+      if (file == fresh->files_end(i)) continue;
 
-        bool mac_match = true;
-        if (mac_filter_set) {
-          auto cam_mac = info->GetMACAddress();
-          auto cam_mac_len = info->GetMACAddressSize();
-          mac_match = (cam_mac && cam_mac_len >= 6 && std::memcmp(cam_mac, direct_ip_mac, 6) == 0);
-        }
-        if (!mac_match) continue;
+      if (verbose) {
+        LOGI("[RATING] slot " << (int)slot << ": " << fresh->file_basename(file)
+             << " " << prev_rating << " -> " << rating_value);
+      }
 
-        selected = info;
-        enum_list = direct_enum;
-        direct_enum = nullptr;
-        if (verbose) {
-          LOGI("Using enumerated camera object for IP " << explicit_host);
+      std::string local_path;
+      bool have_local = download_single_content_file(*fresh, i, file,
+                                                     local_path, /*skip_existing=*/true);
+      if (!have_local) {
+        std::error_code exists_ec;
+        if (!local_path.empty() && std::filesystem::exists(local_path, exists_ec) && !exists_ec) {
+          have_local = true;
         }
-        break;
+      }
+      if (!have_local) continue;
+
+      if (hooks_configured() && !local_path.empty()) {
+        HookEvent ev;
+        ev.path = local_path;
+        ev.mode = mode_text;
+        ev.operation = "rating";
+        ev.new_value = std::to_string(rating_value);
+        ev.old_value = std::to_string(prev_rating);
+        ev.argv = {ev.path, ev.mode, ev.operation, ev.new_value, ev.old_value};
+        ev.slot = static_cast<int>(slot);
+        ev.content_id = fresh->content_ids[i];
+        dispatch_hook_event(std::move(ev));
       }
     }
-    if (direct_enum) {
-      direct_enum->Release();
-      direct_enum = nullptr;
-    }
+  }
 
-    if (!selected) {
-      if (direct_model_is_guess) {
-        LOGI("Model enum for '" << model_choice.canonical << "' unavailable; attempting direct connect with default enum.");
+  // Remember where each slot's contents list stands so a later reconnect can
+  // fetch only what was captured while the camera was unreachable.
+  void schedule_reconcile_baseline() {
+    if (g_shutting_down.load()) return;
+    spawn_download_thread([this]() {
+      for (auto slot : {SDK::CrSlotNumber_Slot1, SDK::CrSlotNumber_Slot2}) {
+        auto &state = reconcile_state(slot);
+        state.newest_capture.store(0, std::memory_order_relaxed);
+        state.update_time.store(0, std::memory_order_relaxed);
+        reconcile_slot(slot, 0, 0);
+      }
+    });
+  }
+
+  // Contents-list notifications are lost while disconnected; after keepalive
+  // reconnects, download everything newer than the marks taken before the gap.
+  void schedule_reconnect_reconciliation() {
+    if (g_shutting_down.load()) return;
+    struct Mark {
+      SDK::CrSlotNumber slot;
+      std::uint64_t newest;
+      std::uint64_t update_time;
+    };
+    std::array<Mark, 2> marks{};
+    std::size_t i = 0;
+    for (auto slot : {SDK::CrSlotNumber_Slot1, SDK::CrSlotNumber_Slot2}) {
+      auto &state = reconcile_state(slot);
+      marks[i++] = Mark{slot, state.newest_capture.load(std::memory_order_relaxed),
+                        state.update_time.load(std::memory_order_relaxed)};
+    }
+    spawn_download_thread([this, marks]() {
+      for (const auto &m : marks) {
+        reconcile_slot(m.slot, m.newest, m.update_time);
       }
+    });
+  }
 
-      // If the user provided credentials, default to SSH ON for first attempt.
-      CrInt32u sshSupportFlag = (!auth_user.empty() || !auth_pass.empty())
-        ? SDK::CrSSHsupport_ON
-        : SDK::CrSSHsupport_OFF;
+  void reconcile_slot(SDK::CrSlotNumber slot, std::uint64_t newest, std::uint64_t last_update) {
+    SDK::CrDeviceHandle handle = device_handle;
+    if (!handle) return;
+    auto aborted = [] {
+      return g_stop.load(std::memory_order_relaxed) ||
+             g_reconnect.load(std::memory_order_relaxed) || g_shutting_down.load();
+    };
+    if (aborted()) return;
+
+    auto &state = reconcile_state(slot);
+    auto update_prop = fetch_property(handle, contents_update_property_code(slot));
+    if (!update_prop.supported) return;
+    const std::uint64_t update_time = static_cast<std::uint64_t>(update_prop.value);
+    if (newest != 0 && update_time == last_update) {
+      if (verbose) LOGI("[RECONCILE] slot " << (int)slot << ": contents unchanged.");
+      return;
+    }
 
-      // Initial direct-IP object
-      err = SDK::CreateCameraObjectInfoEthernetConnection(&created, direct_ip_model, direct_ip_addr_num, direct_ip_mac, sshSupportFlag);
-      if (err != SDK::CrError_None || !created) {
-        LOGE("CreateCameraObjectInfoEthernetConnection failed");
-        return false;
+    // Newest days first: the baseline only needs the newest day, and the sweep
+    // stops at the first day that reaches back past the high-water mark.
+    struct Missed {
+      std::uint64_t date;
+      std::shared_ptr<const ContentsIndex> index;
+      std::size_t item;
+    };
+    std::vector<Missed> missed;
+    std::uint64_t list_newest = 0;
+    bool listed = false;
+    const bool walked = for_each_contents_day(handle, slot, /*newest_first=*/true, [&](const auto &day) {
+      listed = true;
+      std::uint64_t day_oldest = std::numeric_limits<std::uint64_t>::max();
+      for (std::size_t i = 0; i < day->size(); ++i) {
+        std::uint64_t packed = day->dates[i];
+        list_newest = std::max(list_newest, packed);
+        day_oldest = std::min(day_oldest, packed);
+        if (newest != 0 && packed > newest && day->content_ids[i] != 0) {
+          missed.push_back(Missed{packed, day, i});
+        }
       }
-      selected = created;
+      return newest != 0 && day_oldest > newest && !aborted();
+    });
+    if (!walked) {
+      // Marks stay put so the next reconnect looks at the same range again.
+      LOGW("Reconcile: slot " << (int)slot << ": contents listing incomplete; will retry on the next reconnect.");
+      return;
+    }
+    if (!listed) {
+      if (verbose) LOGI("[RECONCILE] slot " << (int)slot << ": no contents list.");
+      return;
     }
-  }
 
-  // -------- Credentials --------
-  const CrChar* user_ptr = auth_user.empty() ? nullptr : (const CrChar*)auth_user.c_str();
-  const CrChar* pass_ptr = auth_pass.empty() ? nullptr : (const CrChar*)auth_pass.c_str();
+    if (newest == 0) {
+      note_newest_capture(slot, list_newest);
+      state.update_time.store(update_time, std::memory_order_relaxed);
+      if (verbose) LOGI("[RECONCILE] slot " << (int)slot << ": baseline recorded.");
+      return;
+    }
 
-  // -------- Fingerprint (cache) --------
-  std::string fp_path = get_cache_dir() + "/fp_enumerated.bin";
-  {
-    std::error_code ec;
-    std::filesystem::create_directories(get_cache_dir(), ec);
-    if (ec) {
-      LOGE("[FP] failed to create cache dir: " << get_cache_dir() << " (" << ec.message() << ")");
+    std::sort(missed.begin(), missed.end(),
+              [](const Missed &a, const Missed &b) { return a.date < b.date; });
+    if (missed.size() > kReconcileMaxItems) {
+      LOGW("Reconcile: slot " << (int)slot << ": " << missed.size()
+           << " missed captures; fetching the newest " << kReconcileMaxItems
+           << " (use `sync all` for the rest).");
+      missed.erase(missed.begin(), missed.end() - kReconcileMaxItems);
+    }
+    if (!missed.empty()) {
+      LOGI("Reconcile: slot " << (int)slot << ": " << missed.size()
+           << " capture(s) made while disconnected; downloading...");
     }
-  }
-  std::vector<char> fp_cache;                // cached fp buffer
-  if (load_fingerprint(fp_path, fp_cache)) {
-    // ok if empty; we’ll decide below
-  }
 
-  // -------- Fingerprint (from discovered object) --------
-  // Per SDK sample, obtain a fingerprint from the *discovered* object and prefer it.
-  char fp_from_obj[512] = {0};
-  CrInt32u fp_from_obj_len = 0;
-  SDK::GetFingerprint(const_cast<SDK::ICrCameraObjectInfo *>(selected), fp_from_obj, &fp_from_obj_len);
+    std::size_t done = 0;
+    bool contiguous = true;
+    for (const auto &m : missed) {
+      // Live captures take precedence; only start the next file once they drain.
+      while (g_live_transfers.load(std::memory_order_relaxed) > 0 && !aborted()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+      if (aborted()) break;
+
+      bool ok = true;
+      for (std::size_t fi = m.index->files_begin(m.item);
+           fi < m.index->files_end(m.item) && !aborted(); ++fi) {
+        std::string local_path;
+        if (!download_single_content_file(*m.index, m.item, fi, local_path,
+                                          /*skip_existing=*/true, "new")) {
+          ok = false;
+        }
+      }
+      if (aborted()) break;
+      if (ok) ++done;
+      contiguous = contiguous && ok;
+      if (contiguous) note_newest_capture(slot, m.date);
+    }
 
-  const CrChar* fp_ptr = nullptr;
-  CrInt32u      fp_len = 0;
-  if (fp_from_obj_len > 0 && fp_from_obj_len <= sizeof(fp_from_obj)) {
-    fp_ptr = fp_from_obj;
-    fp_len = fp_from_obj_len;
-    if (verbose) LOGI("[FP] using fingerprint from discovered camera (" << fp_len << " bytes)");
-  } else if (!fp_cache.empty()) {
-    fp_ptr = (CrChar*)fp_cache.data();
-    fp_len = (CrInt32u)fp_cache.size();
-    if (verbose) LOGI("[FP] using cached fingerprint (" << fp_len << " bytes)");
-  } else {
-    if (verbose) LOGI("[FP] no fingerprint available for initial connect");
+    if (done == missed.size()) {
+      state.update_time.store(update_time, std::memory_order_relaxed);
+    }
+    if (!missed.empty()) {
+      LOGI("Reconcile: slot " << (int)slot << ": fetched " << done << "/" << missed.size()
+           << " missed capture(s).");
+    }
   }
 
-  // -------- SSH/Access-Auth support & reconnecting flag --------
-  bool ssh_on = (selected && selected->GetSSHsupport() == SDK::CrSSHsupport_ON);
-  if (verbose) LOGI(std::string("[AUTH] Authenticating (ssh support is ") + (ssh_on ? "on" : "off") + ")");
-  if (user_ptr && verbose) LOGI("[AUTH] Using username to connect");
-
-  bool is_direct_ip = using_direct_ip;
-  
-  auto reconnecting = SDK::CrReconnecting_ON;
-  // First contact over direct IP should not be "reconnecting".
-  if (is_direct_ip) {
-    reconnecting = SDK::CrReconnecting_OFF;
+  void schedule_background_sync() {
+    if (g_shutting_down.load()) return;
+    bool expected = false;
+    if (!g_bg_sync_running.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+      return;
+    }
+    spawn_download_thread([this]() {
+      struct RunningReset {
+        ~RunningReset() { g_bg_sync_running.store(false, std::memory_order_release); }
+      } running_reset;
+      background_sync_main();
+    });
   }
-  // Also, if SSH is ON and there's no fingerprint, force a full handshake.
-  if (ssh_on && fp_len == 0) {
-    reconnecting = SDK::CrReconnecting_OFF;
+
+  // Trickle-mirrors both slots one file at a time, yielding whenever the
+  // foreground is busy and sleeping after each transfer to honor the duty cap.
+  void background_sync_main() {
+    auto aborted = [] {
+      return !g_bg_sync_enabled.load(std::memory_order_acquire) ||
+             g_stop.load(std::memory_order_relaxed) ||
+             g_reconnect.load(std::memory_order_relaxed) || g_shutting_down.load();
+    };
+    auto pause_for = [&](std::chrono::milliseconds d) {
+      auto until = std::chrono::steady_clock::now() + d;
+      while (!aborted() && std::chrono::steady_clock::now() < until) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+    };
+    auto wait_until_idle = [&]() -> bool {
+      bool paused = false;
+      while (!aborted()) {
+        if (background_sync_idle()) {
+          if (paused && verbose) LOGI("[BGSYNC] resuming.");
+          return true;
+        }
+        if (!paused && verbose) LOGI("[BGSYNC] paused (foreground activity).");
+        paused = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+      }
+      return false;
+    };
+
+    std::uint64_t mirrored_update[2] = {0, 0};
+    while (!aborted()) {
+      bool walked = false;
+      for (int si = 0; si < 2 && !aborted(); ++si) {
+        SDK::CrSlotNumber slot = si == 0 ? SDK::CrSlotNumber_Slot1 : SDK::CrSlotNumber_Slot2;
+        if (!wait_until_idle()) return;
+        SDK::CrDeviceHandle handle = device_handle;
+        if (!handle) return;
+
+        auto update_prop = cached_property(handle, contents_update_property_code(slot));
+        if (!update_prop.supported) continue;
+        const std::uint64_t update_time = static_cast<std::uint64_t>(update_prop.value);
+        if (update_time != 0 && update_time == mirrored_update[si]) continue;
+
+        const bool newest_first = g_bg_sync_newest_first.load(std::memory_order_relaxed);
+        bool complete = true;
+        walked = true;
+        const bool listed = for_each_contents_day(handle, slot, newest_first, [&](const auto &day) {
+          const ContentsIndex &index = *day;
+          std::vector<std::pair<std::uint64_t, std::size_t>> order;
+          order.reserve(index.size());
+          for (std::size_t i = 0; i < index.size(); ++i) {
+            if (index.content_ids[i] == 0) continue;
+            order.emplace_back(index.dates[i], i);
+          }
+          if (newest_first) {
+            std::sort(order.rbegin(), order.rend());
+          } else {
+            std::sort(order.begin(), order.end());
+          }
+          if (verbose) LOGI("[BGSYNC] slot " << (int)slot << ": walking " << order.size() << " item(s).");
+
+          for (const auto &entry : order) {
+            for (std::size_t fi = index.files_begin(entry.second);
+                 fi < index.files_end(entry.second); ++fi) {
+              if (!wait_until_idle()) return false;
+              auto started = std::chrono::steady_clock::now();
+              std::string local_path;
+              if (!download_single_content_file(index, entry.second, fi, local_path,
+                                                /*skip_existing=*/true, "sync")) {
+                complete = false;
+              }
+              // Existing files return immediately, so only real transfers earn a pause.
+              int duty = std::clamp(g_bg_sync_duty.load(std::memory_order_relaxed), 1, 100);
+              auto busy = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::steady_clock::now() - started);
+              if (duty < 100) pause_for(busy * (100 - duty) / duty);
+            }
+            if (aborted()) return false;
+          }
+          return true;
+        });
+        if (aborted()) return;
+        if (complete && listed) mirrored_update[si] = update_time;
+      }
+      if (walked && !aborted()) {
+        LOGI("Background sync: library mirrored; watching for new contents.");
+      }
+      pause_for(std::chrono::seconds(5));
+    }
   }
-  
- // -------- Connect --------
-  std::string target_desc = explicit_host.empty() ? "camera" : ("camera at " + explicit_host);
-  LOGI("Connecting to " << target_desc << "...");
-  err = SDK::Connect(const_cast<SDK::ICrCameraObjectInfo *>(selected), &cb, &handle,
-                     SDK::CrSdkControlMode_RemoteTransfer, reconnecting,
-                     const_cast<CrChar*>(user_ptr),
-                     const_cast<CrChar*>(pass_ptr),
-                     const_cast<CrChar*>(fp_ptr), fp_len);
-  
-  if (err != SDK::CrError_None && is_direct_ip && (unsigned)err == 0x8202) {
-    // Transport refused the path we chose. Retry once with the opposite SSH flag.
-    if (verbose) LOGE("Connect failed 0x8202; retrying once with opposite SSH support flag...");
+
+  void OnNotifyRemoteTransferContentsListChanged(CrInt32u notify, CrInt32u slotNumber, CrInt32u addSize) override {
+    if (g_shutting_down.load()) return;
+    if (g_stop.load(std::memory_order_relaxed)) return;
     
-    // Recreate the IP object with flipped SSH support.
-    CrInt32u flipped = (selected->GetSSHsupport() == SDK::CrSSHsupport_ON)
-      ? SDK::CrSSHsupport_OFF : SDK::CrSSHsupport_ON;
+    if (verbose) {
+      LOGI( "[CB] ContentsListChanged: notify=0x" << std::hex << notify << std::dec << " slot=" << slotNumber << " add=" << addSize );
+    }
+    if (notify != SDK::CrNotify_RemoteTransfer_Changed_Add) return;
+    note_capture_activity();
+
+    // Was this invocation triggered by a manual sync?
+    bool is_sync = false;
+    for (int tok = g_sync_tokens.load(std::memory_order_relaxed); tok > 0; ) {
+      if (g_sync_tokens.compare_exchange_weak(tok, tok - 1, std::memory_order_relaxed)) {
+	is_sync = true;
+	break;
+      }
+    }
+
+    bool sync_all = is_sync && g_sync_all.load(std::memory_order_relaxed);
+    bool sync_star = is_sync && g_sync_star.load(std::memory_order_relaxed);
+
+    // A running burst collects its frames and downloads them in one batch.
+    if (!is_sync && burst_note_contents(slotNumber, addSize)) return;
+
+    if (!is_sync && !g_auto_sync_enabled.load(std::memory_order_acquire)) {
+      if (verbose) {
+        LOGI("[CB] Auto-sync disabled; ignoring contents update (slot=" << slotNumber << ")");
+      }
+      return;
+    }
+
+    try {
+      spawn_download_thread([this, slotNumber, addSize, is_sync, sync_all, sync_star]() {
+	struct SyncActiveGuard {
+	  bool armed = false;
+	  ~SyncActiveGuard() {
+	    if (armed) g_sync_active.fetch_sub(1, std::memory_order_relaxed);
+	  }
+	} sync_active_guard;
+	if (is_sync) {
+	  g_sync_active.fetch_add(1, std::memory_order_relaxed);
+	  sync_active_guard.armed = true;
+	}
+	struct LiveTransferGuard {
+	  bool armed = false;
+	  ~LiveTransferGuard() {
+	    if (armed) g_live_transfers.fetch_sub(1, std::memory_order_relaxed);
+	  }
+	} live_transfer_guard;
+	if (!is_sync) {
+	  g_live_transfers.fetch_add(1, std::memory_order_relaxed);
+	  live_transfer_guard.armed = true;
+	}
+	SDK::CrDeviceHandle handle = this->device_handle;
+	if (!handle) return;
+	SDK::CrSlotNumber slot = (slotNumber == SDK::CrSlotNumber_Slot2) ? SDK::CrSlotNumber_Slot2 : SDK::CrSlotNumber_Slot1;
+
+	// Returns how many items were planned so "latest N" can continue into older days.
+	auto process_list = [&](const ContentsIndex &index, CrInt32u want_hint) -> CrInt32u {
+	  const CrInt32u count = static_cast<CrInt32u>(index.size());
+	  if (count == 0) return 0;
+
+	  if (is_sync && g_sync_abort.load(std::memory_order_acquire)) {
+	    if (verbose) LOGI("Sync: stopped (slot " << (int)slot << ").");
+	    return 0; // bail out before planning/logging
+	  }
+	  
+	  std::vector<CrInt32u> idx;
+	  idx.reserve(count);
+	  for (CrInt32u i = 0; i < count; ++i) {
+	    if (sync_star) {
+	      if (index.ratings[i] < 1) continue;
+	      if (!index.has_still_image(i)) continue;
+	    }
+	    idx.push_back(i);
+	  }
+
+	  if (verbose) LOGI("[SYNC] slot " << (int)slot << ": planning " << idx.size() << " matched item(s)"
+	       << (sync_star ? " (starred stills)" : (sync_all ? " (all contents)" : "")));
+	  
+	  // For full-library sync modes, we want everything; otherwise keep newest-first N logic.
+	  CrInt32u want = ((sync_all || sync_star) ? static_cast<CrInt32u>(idx.size())
+	                                           : (want_hint > 0 ? want_hint : 1));
+
+	  if (!sync_all) {
+	    std::sort(idx.begin(), idx.end(), [&](CrInt32u a, CrInt32u b) {
+	      return index.dates[a] > index.dates[b];
+	    });
+	    if (want > idx.size()) want = static_cast<CrInt32u>(idx.size());
+	    idx.resize(want);
+	  } else {
+	    // "all": process in natural order
+	    idx.resize(count);
+	  }
+
+	  for (CrInt32u k = 0; k < idx.size(); ++k) {
+
+	    if (is_sync && g_sync_abort.load(std::memory_order_acquire)) {
+	      break;
+	    }
+	    
+	    if (g_stop.load(std::memory_order_relaxed)) break;
+	    const CrInt32u item = idx[k];
+	    const CrInt32u contentId = index.content_ids[item];
+	    if (contentId == 0) continue;
+
+	    for (std::size_t fi = index.files_begin(item); fi < index.files_end(item); ++fi) {
+	      if (sync_star && !index.file_has_image_params(fi)) continue;
+
+	      if (is_sync && g_sync_abort.load(std::memory_order_acquire)) {
+		break;
+	      }
+	      
+	      if (g_stop.load(std::memory_order_relaxed)) break;
+      CrInt32u fileId = index.file_ids[fi];
+      const std::string remotePath = index.file_path(fi);
+
+      // determine original filename
+      std::string orig = basename_from_path(remotePath.c_str());
+	      if (orig.empty()) {
+		std::ostringstream o; o << "content_" << (unsigned long long)contentId << "_file_" << fileId;
+		orig = o.str();
+	      }
+
+	      // derive relative directory from remote file path (e.g. "PRIVATE/M4ROOT/CLIP")
+	      std::string relDir = dirname_from_path(remotePath.c_str());
+
+	      // compute full local directory and ensure it exists
+	      std::string destDir = g_download_dir;
+	      if (!relDir.empty()) destDir = join_path(destDir, relDir);
+	      std::error_code ec;
+	      std::filesystem::create_directories(destDir, ec);
+
+	      // choose final filename (sync/boot: keep name & skip existing; else: uniquify)
+	      std::string finalName;
+	      std::string candidatePath = join_path(destDir, orig);
+	      if (is_sync) {
+		if (std::filesystem::exists(candidatePath)) {
+		  if (verbose) LOGI("[SKIP] already present: " << join_path(relDir, orig));
+		  continue;
+		}
+		finalName = orig;
+	      } else {
+		finalName = unique_name(destDir, orig);
+	      }
+
+	      CrChar *saveDir = destDir.empty() ? nullptr
+		: const_cast<CrChar *>(reinterpret_cast<const CrChar *>(destDir.c_str()));
+	      if (g_stop.load(std::memory_order_relaxed)) break;
+
+	      std::unique_lock<std::mutex> transfer_lk(g_transfer_mtx);
+	      dl_waiting = true;
+	      
+	      // progress label before SDK gives us the final path
+	      dl_current_label = join_path(relDir, finalName);
+      dl_last_log_per = 101; // reset throttling so we log 0% immediately
+      dl_last_log_tp = std::chrono::steady_clock::now();
+      dl_start_tp = dl_last_log_tp;
+      dl_any_progress = false;
+      dl_current_operation = is_sync ? "sync" : "new";
+      dl_current_mode = capture_mode_string(device_handle, index.file_is_movie(fi));
+      dl_current_slot = static_cast<int>(slot);
+      dl_current_content_id = contentId;
+      std::uint64_t sync_transfer_id = 0;
+      if (is_sync) {
+        sync_transfer_id = register_sync_transfer(dl_current_label, slot);
+      }
+
+      // kick off download
+      SDK::CrError dres = SDK::GetRemoteTransferContentsDataFile(
+								 handle, slot, contentId, fileId, 0x1000000,
+								 saveDir, const_cast<CrChar *>(finalName.c_str()));
+	      if (dres != SDK::CrError_None) {
+		dl_waiting = false;
+		if (sync_transfer_id != 0) unregister_sync_transfer(sync_transfer_id);
+		LOGE("GetRemoteTransferContentsDataFile failed: "
+		     << crsdk_err::error_to_name(dres) << " (0x" << std::hex << dres << std::dec << ")");
+		continue;
+	      }
+
+	      {
+		std::unique_lock<std::mutex> lk(dl_mtx);
+		dl_cv.wait(lk, [&] { return !dl_waiting || g_stop.load(); });
+
+	      }
+	      if (sync_transfer_id != 0) unregister_sync_transfer(sync_transfer_id);
+	      if (!is_sync) note_newest_capture(slot, index.dates[item]);
+
+	if (is_sync && g_sync_abort.load(std::memory_order_acquire)) {
+	  // We just finished a file; exit early.
+	  break;
+	}
+
+	      if (g_stop.load(std::memory_order_relaxed)) break;
+	    }
+	  }
+	  return static_cast<CrInt32u>(idx.size());
+	};
+
+	// -------- fetch & process --------
+	std::uint64_t observed_update_time = 0;
+	if (sync_star) {
+	  observed_update_time = wait_for_contents_list_refresh(handle, slot, verbose);
+	}
+
+	// Walk the card one capture day at a time: oldest first for "all", newest
+	// first otherwise, stopping once "latest N" has planned enough items.
+	const bool full_library = sync_all || sync_star;
+	CrInt32u remaining = full_library ? 0 : (addSize > 0 ? addSize : 1);
+	bool any_contents = false;
+	if (verbose) LOGI("[SYNC] slot " << (int)slot << ": processing contents list...");
+	const bool listed = for_each_contents_day(handle, slot, /*newest_first=*/!sync_all, [&](const auto &day) {
+	  const ContentsIndex &index = *day;
+	  if (!any_contents && sync_star && observed_update_time != 0) {
+	    last_contents_update_marker(slot).store(observed_update_time, std::memory_order_relaxed);
+	  }
+	  any_contents = true;
+	  CrInt32u planned = process_list(index, remaining);
+	  if (g_stop.load(std::memory_order_relaxed)) return false;
+	  if (is_sync && g_sync_abort.load(std::memory_order_acquire)) return false;
+	  if (full_library) return true;
+	  remaining = (planned >= remaining) ? 0 : remaining - planned;
+	  return remaining > 0;
+	});
+	if (!listed) {
+	  if (is_sync) g_sync_listing_failed.store(true, std::memory_order_relaxed);
+	  LOGW("[SYNC] slot " << (int)slot << ": contents listing failed; some files were not fetched.");
+	} else if (!any_contents && verbose) {
+	  LOGI("[INFO] No " << (sync_star ? "starred " : "")
+	       << "contents found (slot=" << (int)slot << ")");
+	}
+	if (verbose) LOGI("[SYNC] slot " << (int)slot << ": worker complete.");
+      });
+    } catch (...) {
+      LOGE("[ERROR] Failed to create download thread");
+    }
+
+  }
+
+  void OnNotifyContentsTransfer(CrInt32u, SDK::CrContentHandle, CrChar *) override {}
+
+  void OnNotifyRemoteTransferResult(CrInt32u notify, CrInt32u per, CrChar *filename) override
+  {
+    std::unique_lock<std::mutex> lk(dl_mtx);
+
+    if (filename) last_downloaded_file = filename; else last_downloaded_file.clear();
+    dl_notify_code = notify; dl_progress = per;
+
+    bool sync_aborted = g_sync_abort.load(std::memory_order_acquire);
+
+    // Choose a human label: prefer filename from SDK, else the precomputed label.
+    std::string label = last_downloaded_file.empty() ? dl_current_label : last_downloaded_file;
+    // For nicer logs, strip to a relative path if possible (optional).
+    if (!label.empty()) {
+      // leave label as-is; it already is relative (relDir/finalName) in our pre-label
+    }
+
+    if (notify == SDK::CrNotify_RemoteTransfer_InProgress) {
+      if (sync_aborted) {
+        // Suppress noise while waiting for the device to acknowledge cancellation.
+        return;
+      }
+      update_matching_sync_transfer(label, per);
+      // Throttle: log when +5% or +1s since last log (and always at 0%)
+      auto now = std::chrono::steady_clock::now();
+      bool time_ok = (dl_last_log_tp.time_since_epoch().count() == 0) ||
+	(now - dl_last_log_tp) >= std::chrono::seconds(1);
+      bool perc_ok = (dl_last_log_per == 101) || (per >= dl_last_log_per + 5);
+
+      if (time_ok || perc_ok) {
+	  if (verbose) LOGI("[DL] " << (label.empty() ? "(unknown file)" : label) << " — " << per << "%");
+	dl_last_log_per = per;
+	dl_last_log_tp = now;
+	dl_any_progress = true;
+      }
+      // stay waiting; do NOT signal cv yet
+      return;
+    }
+
+    // Non-progress notifications: finish/abort/etc.
+    if (notify == SDK::CrNotify_RemoteTransfer_Result_OK) {
+      update_matching_sync_transfer(label, 100);
+    }
+    dl_waiting = false;
+    dl_cv.notify_all();
+
+    if (sync_aborted) {
+      if (notify == SDK::CrNotify_RemoteTransfer_Result_OK) {
+        LOGI("[DL] Completed before cancel request took effect: "
+             << (label.empty() ? "(unknown file)" : label));
+      } else {
+        LOGI("[DL] Canceled: " << (label.empty() ? "(unknown file)" : label)
+             << " (notify=0x" << std::hex << notify << std::dec << ")");
+      }
+      return;
+    }
+
+    if (notify == SDK::CrNotify_RemoteTransfer_Result_OK) {
+      // No extra "100%" line; keep output compact.
+      std::string saved = last_downloaded_file;
+      std::string base = saved;
+      size_t pos = base.find_last_of("/\\"); if (pos != std::string::npos) base = base.substr(pos + 1);
+      long long sizeB = 0; struct stat st{}; if (::stat(saved.c_str(), &st) == 0) sizeB = (long long)st.st_size;
+
+      // Optional: include elapsed time (kept simple; remove if you prefer)
+      auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+									      std::chrono::steady_clock::now() - dl_start_tp).count();
+
+      // For small files (no progress logs), this is the ONLY line.
+      LOG_EV(LogLevel::Info,
+             LogFields().ev("download").with_file(saved).with_bytes(sizeB).with_ms(elapsed_ms),
+             "[FILE] " << base << " (" << sizeB << " bytes" << ", " << elapsed_ms << " ms)");
+
+      if (hooks_configured() && !saved.empty()) {
+        std::string mode_text = dl_current_mode.empty()
+                                  ? current_mode_string(device_handle)
+                                  : dl_current_mode;
+        std::string operation = dl_current_operation.empty() ? "new" : dl_current_operation;
+        std::string new_value = dl_current_label.empty() ? base : dl_current_label;
+        run_post_cmd(saved, mode_text, operation, "", new_value,
+                     dl_current_slot, dl_current_content_id);
+      }
+
+      dl_current_mode.clear();
+      dl_current_operation.clear();
+      dl_current_slot = 0;
+      dl_current_content_id.reset();
+
+    } else {
+      LOG_EV(LogLevel::Error, LogFields().ev("download_failed").with_file(label).with_code(notify),
+             "[DL] Failed: " << (label.empty() ? "(unknown file)" : label)
+             << " (notify=0x" << std::hex << notify << std::dec << ")");
+      dl_current_mode.clear();
+      dl_current_operation.clear();
+      dl_current_slot = 0;
+      dl_current_content_id.reset();
+    }
+  }
+
+
+  void OnNotifyRemoteTransferResult(CrInt32u, CrInt32u, CrInt8u *, CrInt64u) override {}
+  void OnNotifyFTPTransferResult(CrInt32u, CrInt32u, CrInt32u) override {}
+  void OnNotifyRemoteFirmwareUpdateResult(CrInt32u, const void *) override {}
+  void OnReceivePlaybackTimeCode(CrInt32u) override {}
+  void OnNotifyMonitorUpdated(CrInt32u, CrInt32u) override {}
+
+private:
+  struct ContentsFileRef {
+    CrInt32u content_id = 0;
+    CrInt32u file_id = 0;
+    std::size_t file = 0; // position in the snapshot's index
+  };
+
+  // Contents list as of update_time, plus hash lookups for diffing.
+  struct RatingSnapshot {
+    std::shared_ptr<const ContentsIndex> index;
+    std::uint64_t update_time = 0;
+    std::unordered_map<CrInt32u, std::size_t> by_content;   // contentId -> item
+    std::unordered_map<std::string, ContentsFileRef> by_path; // remote path -> file
+
+    void reset(std::shared_ptr<const ContentsIndex> next, std::uint64_t when) {
+      index = std::move(next);
+      update_time = when;
+      by_content.clear();
+      by_path.clear();
+      if (!index) return;
+      by_content.reserve(index->size());
+      by_path.reserve(index->file_ids.size());
+      for (std::size_t i = 0; i < index->size(); ++i) {
+        by_content.emplace(index->content_ids[i], i);
+        for (std::size_t f = index->files_begin(i); f < index->files_end(i); ++f) {
+          by_path.emplace(index->file_path(f),
+                          ContentsFileRef{index->content_ids[i], index->file_ids[f], f});
+        }
+      }
+    }
+  };
+
+  // Last raw value per generated property slot; prop_seen_ marks the slots
+  // the body has reported at least once.
+  std::array<CrInt64u, PROP_SLOT_COUNT> prop_vals_{};
+  PropertyBits prop_seen_;
+  std::unordered_map<CrInt32u, CrInt64u> extra_prop_vals_;
+  std::vector<CrInt32u> prop_pos_codes_;
+  std::vector<int> prop_pos_slots_;
+  static constexpr int kSlotUnresolved = -2;
+  static constexpr unsigned kDirtyProp = 1;
+  static constexpr unsigned kDirtyLv = 2;
+  std::atomic<unsigned> prop_dirty_{0};
+  std::mutex prop_wake_mtx_;
+  std::condition_variable prop_wake_cv_;
+  bool prop_refresher_stop_ = false;
+  std::mutex prop_refresh_mtx_;
+  bool prop_refresh_enabled_ = false;
+  std::thread prop_refresher_;
+  std::mutex rating_diff_mtx_;
+  std::array<RatingSnapshot, 2> rating_snapshots_;
+  std::array<std::atomic<bool>, 2> rating_diff_pending_{};
+};
+
+// Attempt a single connect (by direct IP or enumeration). Returns true on success.
+static bool try_connect_once(const std::string &explicit_host,
+                             const std::string &explicit_mac,
+                             const std::string &explicit_model,
+                             const std::string &download_dir,
+                             bool verbose,
+                             const std::string &auth_user,
+                             const std::string &auth_pass,
+                             QuietCallback &cb,
+                             SDK::CrDeviceHandle &handle,
+                             const SDK::ICrCameraObjectInfo *&selected,
+                             SDK::ICrEnumCameraObjectInfo *&enum_list,
+                             SDK::ICrCameraObjectInfo *&created)
+{
+  cb.verbose = verbose;
+  SDK::CrError err = SDK::CrError_None;
+  selected = nullptr; enum_list = nullptr; created = nullptr; handle = 0;
+  auto model_choice = resolve_camera_model_choice(explicit_model);
+  bool have_canonical = !model_choice.canonical.empty();
+
+  SDK::CrCameraDeviceModelList direct_ip_model = model_choice.direct_value.value_or(SDK::CrCameraDeviceModel_ILCE_6700);
+  bool direct_model_is_guess = have_canonical && !model_choice.direct_value.has_value();
+
+  // Used by the direct-IP path and (maybe) a retry:
+  unsigned char direct_ip_mac[6] = {0,0,0,0,0,0};
+  
+  // Parse explicit_host ("x.y.z.w") into CrInt32u as required by the SDK
+  CrInt32u direct_ip_addr_num = 0;
+  if (!explicit_host.empty()) {
+    struct in_addr ina{};
+    if (inet_pton(AF_INET, explicit_host.c_str(), &ina) == 1) {
+      // Keep network byte order (big-endian) as CrInt32u
+      direct_ip_addr_num = static_cast<CrInt32u>(ina.s_addr);
+    } else {
+      LOGE("Invalid IPv4 address: " << explicit_host);
+      return false;
+    }
+  }
+  
+  // -------- Discover or create camera object --------
+  const bool using_direct_ip = !explicit_host.empty();
+  if (!using_direct_ip) {
+    if (verbose) LOGI("Searching for cameras...");
+    err = SDK::EnumCameraObjects(&enum_list, 1);
+    if (err != SDK::CrError_None || !enum_list || enum_list->GetCount() == 0) {
+      LOGE("No cameras found (EnumCameraObjects)");
+      return false;
+    }
+    selected = enum_list->GetCameraObjectInfo(0);
+    if (!selected) {
+      LOGE("Enumeration returned an empty camera list");
+      return false;
+    }
+    if (have_canonical && !model_name_matches(selected, model_choice.canonical)) {
+      const char *model_ptr = reinterpret_cast<const char*>(selected->GetModel());
+      LOGW("--model='" << model_choice.canonical
+           << "' ignored; proceeding with first enumerated camera"
+           << (model_ptr ? std::string(" ('") + model_ptr + "')" : std::string("")));
+    }
+  } else {
+    // --- Direct IP path ---
+    bool mac_filter_set = false;
+    if (!explicit_mac.empty()) {
+      if (!parse_mac(explicit_mac, direct_ip_mac)) {
+        LOGE("WARN bad MAC, ignoring: " << explicit_mac);
+      } else {
+        mac_filter_set = true;
+      }
+    }
+
+    // Attempt to reuse an enumerated object so we avoid guessing the model enum.
+    SDK::ICrEnumCameraObjectInfo *direct_enum = nullptr;
+    err = SDK::EnumCameraObjects(&direct_enum, 1);
+    if (err == SDK::CrError_None && direct_enum && direct_enum->GetCount() > 0) {
+      for (CrInt32u i = 0; i < direct_enum->GetCount(); ++i) {
+        auto info = direct_enum->GetCameraObjectInfo(i);
+        if (!info) continue;
+
+        bool ip_match = false;
+        const char *ip_char = reinterpret_cast<const char*>(info->GetIPAddressChar());
+        if (ip_char && *ip_char) {
+          ip_match = (explicit_host == std::string(ip_char));
+        }
+        if (!ip_match && direct_ip_addr_num != 0) {
+          ip_match = (info->GetIPAddress() == direct_ip_addr_num);
+        }
+        if (!ip_match) continue;
+
+        bool mac_match = true;
+        if (mac_filter_set) {
+          auto cam_mac = info->GetMACAddress();
+          auto cam_mac_len = info->GetMACAddressSize();
+          mac_match = (cam_mac && cam_mac_len >= 6 && std::memcmp(cam_mac, direct_ip_mac, 6) == 0);
+        }
+        if (!mac_match) continue;
+
+        selected = info;
+        enum_list = direct_enum;
+        direct_enum = nullptr;
+        if (verbose) {
+          LOGI("Using enumerated camera object for IP " << explicit_host);
+        }
+        break;
+      }
+    }
+    if (direct_enum) {
+      direct_enum->Release();
+      direct_enum = nullptr;
+    }
+
+    if (!selected) {
+      if (direct_model_is_guess) {
+        LOGI("Model enum for '" << model_choice.canonical << "' unavailable; attempting direct connect with default enum.");
+      }
+
+      // If the user provided credentials, default to SSH ON for first attempt.
+      CrInt32u sshSupportFlag = (!auth_user.empty() || !auth_pass.empty())
+        ? SDK::CrSSHsupport_ON
+        : SDK::CrSSHsupport_OFF;
+
+      // Initial direct-IP object
+      err = SDK::CreateCameraObjectInfoEthernetConnection(&created, direct_ip_model, direct_ip_addr_num, direct_ip_mac, sshSupportFlag);
+      if (err != SDK::CrError_None || !created) {
+        LOGE("CreateCameraObjectInfoEthernetConnection failed");
+        return false;
+      }
+      selected = created;
+    }
+  }
+
+  // -------- Credentials --------
+  const CrChar* user_ptr = auth_user.empty() ? nullptr : (const CrChar*)auth_user.c_str();
+  const CrChar* pass_ptr = auth_pass.empty() ? nullptr : (const CrChar*)auth_pass.c_str();
+
+  // -------- Fingerprint (cache) --------
+  std::string fp_path = get_cache_dir() + "/fp_enumerated.bin";
+  {
+    std::error_code ec;
+    std::filesystem::create_directories(get_cache_dir(), ec);
+    if (ec) {
+      LOGE("[FP] failed to create cache dir: " << get_cache_dir() << " (" << ec.message() << ")");
+    }
+  }
+  std::vector<char> fp_cache;                // cached fp buffer
+  if (load_fingerprint(fp_path, fp_cache)) {
+    // ok if empty; we’ll decide below
+  }
+
+  // -------- Fingerprint (from discovered object) --------
+  // Per SDK sample, obtain a fingerprint from the *discovered* object and prefer it.
+  char fp_from_obj[512] = {0};
+  CrInt32u fp_from_obj_len = 0;
+  SDK::GetFingerprint(const_cast<SDK::ICrCameraObjectInfo *>(selected), fp_from_obj, &fp_from_obj_len);
+
+  const CrChar* fp_ptr = nullptr;
+  CrInt32u      fp_len = 0;
+  if (fp_from_obj_len > 0 && fp_from_obj_len <= sizeof(fp_from_obj)) {
+    fp_ptr = fp_from_obj;
+    fp_len = fp_from_obj_len;
+    if (verbose) LOGI("[FP] using fingerprint from discovered camera (" << fp_len << " bytes)");
+  } else if (!fp_cache.empty()) {
+    fp_ptr = (CrChar*)fp_cache.data();
+    fp_len = (CrInt32u)fp_cache.size();
+    if (verbose) LOGI("[FP] using cached fingerprint (" << fp_len << " bytes)");
+  } else {
+    if (verbose) LOGI("[FP] no fingerprint available for initial connect");
+  }
+
+  // -------- SSH/Access-Auth support & reconnecting flag --------
+  bool ssh_on = (selected && selected->GetSSHsupport() == SDK::CrSSHsupport_ON);
+  if (verbose) LOGI(std::string("[AUTH] Authenticating (ssh support is ") + (ssh_on ? "on" : "off") + ")");
+  if (user_ptr && verbose) LOGI("[AUTH] Using username to connect");
+
+  bool is_direct_ip = using_direct_ip;
+  
+  auto reconnecting = SDK::CrReconnecting_ON;
+  // First contact over direct IP should not be "reconnecting".
+  if (is_direct_ip) {
+    reconnecting = SDK::CrReconnecting_OFF;
+  }
+  // Also, if SSH is ON and there's no fingerprint, force a full handshake.
+  if (ssh_on && fp_len == 0) {
+    reconnecting = SDK::CrReconnecting_OFF;
+  }
+  
+ // -------- Connect --------
+  std::string target_desc = explicit_host.empty() ? "camera" : ("camera at " + explicit_host);
+  LOGI("Connecting to " << target_desc << "...");
+  err = SDK::Connect(const_cast<SDK::ICrCameraObjectInfo *>(selected), &cb, &handle,
+                     SDK::CrSdkControlMode_RemoteTransfer, reconnecting,
+                     const_cast<CrChar*>(user_ptr),
+                     const_cast<CrChar*>(pass_ptr),
+                     const_cast<CrChar*>(fp_ptr), fp_len);
+  
+  if (err != SDK::CrError_None && is_direct_ip && (unsigned)err == 0x8202) {
+    // Transport refused the path we chose. Retry once with the opposite SSH flag.
+    if (verbose) LOGE("Connect failed 0x8202; retrying once with opposite SSH support flag...");
+    
+    // Recreate the IP object with flipped SSH support.
+    CrInt32u flipped = (selected->GetSSHsupport() == SDK::CrSSHsupport_ON)
+      ? SDK::CrSSHsupport_OFF : SDK::CrSSHsupport_ON;
 
     SDK::ICrCameraObjectInfo* retry_obj = nullptr;
     SDK::CreateCameraObjectInfoEthernetConnection(&retry_obj, direct_ip_model, direct_ip_addr_num, direct_ip_mac, flipped);
@@ -3670,476 +7416,1530 @@ static bool try_connect_once(const std::string &explicit_host,
 	if (created) { created->Release(); created = nullptr; }
 	selected = retry_obj;
       } else {
-	retry_obj->Release();
+	retry_obj->Release();
+      }
+    }
+  }
+
+  if (err != SDK::CrError_None) {
+    unsigned u = (unsigned)err;
+    const char* name = crsdk_err::error_to_name(err);
+    
+    // Only log if we didn’t already explain above
+    if (u != 0x8213) {
+      LOGE("Connect failed: 0x" << std::hex << u << std::dec << " (" << name << ")");
+    }
+    return false;
+  }
+
+  // -------- Wait for handshake completion --------
+  {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(12);
+    std::unique_lock<std::mutex> lk(cb.mtx);
+    while (!cb.connected && !cb.conn_finished && !g_stop.load(std::memory_order_relaxed)) {
+      if (cb.conn_cv.wait_for(lk, std::chrono::milliseconds(100)) == std::cv_status::timeout) {
+        if (std::chrono::steady_clock::now() >= deadline) break;
+      }
+    }
+  }
+  if (!cb.connected) {
+    std::ostringstream _m;
+    _m << "Camera not available";
+    if (cb.last_error_code) _m << " error=0x" << std::hex << cb.last_error_code << std::dec;
+    LOGE(_m.str());
+    return false;
+  }
+
+  cb.device_handle = handle;
+  cb.set_property_refresh_enabled(true);
+    if (verbose) {
+      LOGI("Connected. Ctrl+D to stop.");
+    } else {
+      LOGI("Connected. Ctrl+D to stop.");
+    }
+
+  // -------- Persist (updated) fingerprint for next run --------
+  {
+    char newfp[512] = {0}; CrInt32u nlen = 0;
+    SDK::GetFingerprint(const_cast<SDK::ICrCameraObjectInfo *>(selected), newfp, &nlen);
+    if (verbose) LOGI("[FP] GetFingerprint(ICrCameraObjectInfo*): " << nlen << " bytes");
+
+    if (nlen > 0 && nlen <= sizeof(newfp)) {
+      if (save_fingerprint(fp_path, newfp, nlen)) {
+        if (verbose) LOGI("[FP] saved " << nlen << " bytes to " << fp_path);
+      } else {
+        LOGE("[FP] failed to save fingerprint to " << fp_path);
+      }
+    } else {
+      if (verbose) LOGI("[FP] no fingerprint to save (nlen=0)");
+    }
+  }
+
+  (void)download_dir; // already assigned globally elsewhere
+  return true;
+}
+
+static void disconnect_and_release(SDK::CrDeviceHandle &handle,
+				   SDK::ICrCameraObjectInfo *&created,
+				   SDK::ICrEnumCameraObjectInfo *&enum_list) {
+  if (handle) { SDK::Disconnect(handle); SDK::ReleaseDevice(handle); handle = 0; }
+  if (created) { created->Release(); created = nullptr; }
+  if (enum_list) { enum_list->Release(); enum_list = nullptr; }
+}
+
+// simple word list
+static const std::vector<std::string> commands = {
+  "shoot", "trigger", "focus", "sync", "monitor", "record", "button", "status", "exposure", "ratings", "props", "metrics", "shutter", "burst", "bracket", "interval", "wait", "repeat", "power", "quit", "exit"
+};
+
+char* prompt(EditLine*) {
+  return const_cast<char*>("sonshell> ");
+}
+
+// completion callback
+unsigned char complete(EditLine* el, int ch) {
+  const LineInfo* li = el_line(el);
+  std::string buf(li->buffer, li->lastchar - li->buffer);
+
+  // very simple: complete whole line against commands
+  for (auto& cmd : commands) {
+    if (cmd.rfind(buf, 0) == 0) {
+      el_insertstr(el, cmd.c_str() + buf.size());
+      return CC_REFRESH;
+    }
+  }
+  return CC_REFRESH;
+}
+
+// tiny tokenizer: splits on spaces, respects "quotes"
+static std::vector<std::string> tokenize(std::string const& s) {
+  std::vector<std::string> out; std::string cur; bool q=false;
+  for (size_t i=0;i<s.size();++i) {
+    char c=s[i];
+    if (c=='"') { q=!q; continue; }
+    if (!q && std::isspace(static_cast<unsigned char>(c))) {
+      if (!cur.empty()) { out.push_back(cur); cur.clear(); }
+    } else {
+      cur.push_back(c);
+    }
+  }
+  if (!cur.empty()) out.push_back(cur);
+  return out;
+}
+
+static std::string join_tokens(const std::vector<std::string>& tokens) {
+  if (tokens.empty()) return {};
+  return join_args(tokens, 0);
+}
+
+static bool split_key_value_line(const std::string& line,
+                                 std::string& key,
+                                 std::string& value) {
+  auto pos = line.find(':');
+  if (pos == std::string::npos) return false;
+  key = trim_copy(line.substr(0, pos));
+  value = trim_copy(line.substr(pos + 1));
+  if (!value.empty() && value.front() == '"' && value.back() == '"' && value.size() >= 2) {
+    value = value.substr(1, value.size() - 2);
+  }
+  return !key.empty();
+}
+
+static bool parse_key_code_token(const std::string& raw, int& code_out) {
+  if (raw.empty()) return false;
+  bool numeric = std::isdigit(static_cast<unsigned char>(raw.front()));
+  if (!numeric && raw.size() > 1 && raw[0] == '0' && (raw[1] == 'x' || raw[1] == 'X')) {
+    numeric = true;
+  }
+  if (numeric) {
+    try {
+      code_out = std::stoi(raw, nullptr, 0);
+      return true;
+    } catch (...) {
+      return false;
+    }
+  }
+
+  std::string key = raw;
+  std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) {
+    return static_cast<char>(std::toupper(c));
+  });
+
+#define KEY_ENTRY(name) {#name, name}
+  static const std::unordered_map<std::string, int> kKeyCodeMap = {
+    KEY_ENTRY(KEY_LEFT), KEY_ENTRY(KEY_RIGHT), KEY_ENTRY(KEY_UP), KEY_ENTRY(KEY_DOWN),
+    KEY_ENTRY(KEY_ENTER), KEY_ENTRY(KEY_OK), KEY_ENTRY(KEY_ESC), KEY_ENTRY(KEY_BACKSPACE),
+    KEY_ENTRY(KEY_SPACE), KEY_ENTRY(KEY_TAB), KEY_ENTRY(KEY_HOME), KEY_ENTRY(KEY_END),
+    KEY_ENTRY(KEY_PAGEUP), KEY_ENTRY(KEY_PAGEDOWN), KEY_ENTRY(KEY_MENU), KEY_ENTRY(KEY_INFO),
+    KEY_ENTRY(KEY_CAMERA), KEY_ENTRY(KEY_RECORD), KEY_ENTRY(KEY_PLAYPAUSE),
+    KEY_ENTRY(KEY_STOP), KEY_ENTRY(KEY_VOLUMEUP), KEY_ENTRY(KEY_VOLUMEDOWN),
+    KEY_ENTRY(KEY_MUTE), KEY_ENTRY(KEY_MEDIA), KEY_ENTRY(KEY_F1), KEY_ENTRY(KEY_F2),
+    KEY_ENTRY(KEY_F3), KEY_ENTRY(KEY_F4), KEY_ENTRY(KEY_F5), KEY_ENTRY(KEY_F6),
+    KEY_ENTRY(KEY_F7), KEY_ENTRY(KEY_F8), KEY_ENTRY(KEY_F9), KEY_ENTRY(KEY_F10),
+    KEY_ENTRY(KEY_F11), KEY_ENTRY(KEY_F12), KEY_ENTRY(KEY_1), KEY_ENTRY(KEY_2),
+    KEY_ENTRY(KEY_3), KEY_ENTRY(KEY_4), KEY_ENTRY(KEY_5), KEY_ENTRY(KEY_6),
+    KEY_ENTRY(KEY_7), KEY_ENTRY(KEY_8), KEY_ENTRY(KEY_9), KEY_ENTRY(KEY_0),
+    KEY_ENTRY(KEY_A), KEY_ENTRY(KEY_B), KEY_ENTRY(KEY_C), KEY_ENTRY(KEY_D),
+    KEY_ENTRY(KEY_E), KEY_ENTRY(KEY_F), KEY_ENTRY(KEY_G), KEY_ENTRY(KEY_H),
+    KEY_ENTRY(KEY_I), KEY_ENTRY(KEY_J), KEY_ENTRY(KEY_K), KEY_ENTRY(KEY_L),
+    KEY_ENTRY(KEY_M), KEY_ENTRY(KEY_N), KEY_ENTRY(KEY_O), KEY_ENTRY(KEY_P),
+    KEY_ENTRY(KEY_Q), KEY_ENTRY(KEY_R), KEY_ENTRY(KEY_S), KEY_ENTRY(KEY_T),
+    KEY_ENTRY(KEY_U), KEY_ENTRY(KEY_V), KEY_ENTRY(KEY_W), KEY_ENTRY(KEY_X),
+    KEY_ENTRY(KEY_Y), KEY_ENTRY(KEY_Z),
+    KEY_ENTRY(BTN_LEFT), KEY_ENTRY(BTN_RIGHT), KEY_ENTRY(BTN_MIDDLE),
+    KEY_ENTRY(BTN_SOUTH), KEY_ENTRY(BTN_EAST), KEY_ENTRY(BTN_NORTH),
+    KEY_ENTRY(BTN_WEST)
+  };
+#undef KEY_ENTRY
+
+  auto it = kKeyCodeMap.find(key);
+  if (it == kKeyCodeMap.end()) return false;
+  code_out = it->second;
+  return true;
+}
+
+static bool parse_input_map_config(const std::string& path,
+                                   std::vector<InputMapDevice>& devices_out,
+                                   std::vector<std::vector<std::string>>& init_cmds_out,
+                                   std::string& error) {
+  std::ifstream in(path);
+  if (!in) {
+    error = "input-map: unable to open " + path;
+    return false;
+  }
+
+  InputMapDevice current;
+  bool device_active = false;
+  bool in_bindings = false;
+  bool in_init_commands = false;
+  bool in_input_section = false;
+  bool in_init_section = false;
+  int line_no = 0;
+
+  auto finalize_device = [&]() -> bool {
+    if (!device_active) return true;
+    if (current.path.empty()) {
+      error = "input-map: device missing 'path:' entry";
+      return false;
+    }
+    devices_out.push_back(current);
+    current = InputMapDevice{};
+    device_active = false;
+    in_bindings = false;
+    return true;
+  };
+
+  while (in.good()) {
+    std::string raw_line;
+    std::getline(in, raw_line);
+    if (!in && raw_line.empty()) break;
+    ++line_no;
+    std::string line = raw_line;
+    auto comment = line.find('#');
+    if (comment != std::string::npos) line.erase(comment);
+
+    int indent = 0;
+    while (indent < static_cast<int>(line.size()) && line[indent] == ' ') ++indent;
+
+    bool list_item = false;
+    int content_start = indent;
+    if (content_start < static_cast<int>(line.size()) && line[content_start] == '-') {
+      list_item = true;
+      ++content_start;
+      if (content_start < static_cast<int>(line.size()) && line[content_start] == ' ') ++content_start;
+    }
+
+    std::string content = trim_copy(line.substr(content_start));
+    if (content.empty()) continue;
+
+    if (indent == 0 && content == "input:") {
+      in_input_section = true;
+      in_init_section = false;
+      in_init_commands = false;
+      continue;
+    }
+    if (indent == 0 && content == "init:") {
+      in_init_section = true;
+      in_input_section = false;
+      in_bindings = false;
+      if (!finalize_device()) return false;
+      continue;
+    }
+    if (indent == 2 && in_input_section && content == "devices:") {
+      continue;
+    }
+    if (indent == 2 && in_init_section && content == "commands:") {
+      in_init_commands = true;
+      continue;
+    }
+    if (indent == 4 && list_item && in_input_section) {
+      if (!finalize_device()) return false;
+      device_active = true;
+      in_bindings = false;
+      if (!content.empty()) {
+        std::string key, value;
+        if (!split_key_value_line(content, key, value)) {
+          error = "input-map: expected 'path: ...' after '-' on line " + std::to_string(line_no);
+          return false;
+        }
+        if (key != "path") {
+          error = "input-map: only 'path' may follow '-' directly (line " + std::to_string(line_no) + ")";
+          return false;
+        }
+        current.path = expand_user_path(value);
+      }
+      continue;
+    }
+    if (in_init_commands) {
+      if (!list_item && indent < 4) {
+        error = "input-map: expected list item under init.commands (line " + std::to_string(line_no) + ")";
+        return false;
+      }
+      std::string cmd = content;
+      if (cmd.empty()) {
+        error = "input-map: empty init command on line " + std::to_string(line_no);
+        return false;
+      }
+      // strip quotes if present
+      if (cmd.front() == '"' && cmd.back() == '"' && cmd.size() >= 2) {
+        cmd = cmd.substr(1, cmd.size() - 2);
+      }
+      auto tokens = tokenize(cmd);
+      if (tokens.empty()) {
+        error = "input-map: init command parses to zero tokens (line " + std::to_string(line_no) + ")";
+        return false;
       }
+      init_cmds_out.push_back(tokens);
+      continue;
     }
-  }
 
-  if (err != SDK::CrError_None) {
-    unsigned u = (unsigned)err;
-    const char* name = crsdk_err::error_to_name(err);
-    
-    // Only log if we didn’t already explain above
-    if (u != 0x8213) {
-      LOGE("Connect failed: 0x" << std::hex << u << std::dec << " (" << name << ")");
+    if (!device_active) {
+      error = "input-map: device attributes appeared before '- path:' (line " + std::to_string(line_no) + ")";
+      return false;
     }
-    return false;
-  }
 
-  // -------- Wait for handshake completion --------
-  {
-    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(12);
-    std::unique_lock<std::mutex> lk(cb.mtx);
-    while (!cb.connected && !cb.conn_finished && !g_stop.load(std::memory_order_relaxed)) {
-      if (cb.conn_cv.wait_for(lk, std::chrono::milliseconds(100)) == std::cv_status::timeout) {
-        if (std::chrono::steady_clock::now() >= deadline) break;
+    if (indent >= 6 && indent < 8) {
+      if (!in_input_section) {
+        error = "input-map: unexpected key outside 'input' section (line " + std::to_string(line_no) + ")";
+        return false;
+      }
+      std::string key, value;
+      if (!split_key_value_line(content, key, value)) {
+        error = "input-map: expected 'key: value' on line " + std::to_string(line_no);
+        return false;
+      }
+      if (key == "path") {
+        current.path = expand_user_path(value);
+      } else if (key == "bindings") {
+        if (!value.empty()) {
+          error = "input-map: 'bindings' must not have an inline value (line " + std::to_string(line_no) + ")";
+          return false;
+        }
+        in_bindings = true;
+      } else {
+        error = "input-map: unknown device key '" + key + "' (line " + std::to_string(line_no) + ")";
+        return false;
+      }
+      continue;
+    }
+
+    if (indent >= 8 && in_bindings) {
+      std::string key, value;
+      if (!split_key_value_line(content, key, value)) {
+        error = "input-map: expected 'KEY_NAME: command' (line " + std::to_string(line_no) + ")";
+        return false;
+      }
+      if (value.empty()) {
+        error = "input-map: command for '" + key + "' is empty (line " + std::to_string(line_no) + ")";
+        return false;
+      }
+      int key_code = 0;
+      if (!parse_key_code_token(key, key_code)) {
+        error = "input-map: unknown key '" + key + "' (line " + std::to_string(line_no) + ")";
+        return false;
+      }
+      auto tokens = tokenize(value);
+      if (tokens.empty()) {
+        error = "input-map: command for '" + key + "' parses to zero tokens (line " + std::to_string(line_no) + ")";
+        return false;
       }
+      current.key_to_command[key_code] = tokens;
+      continue;
     }
+
+    error = "input-map: unsupported indentation on line " + std::to_string(line_no);
+    return false;
   }
-  if (!cb.connected) {
-    std::ostringstream _m;
-    _m << "Camera not available";
-    if (cb.last_error_code) _m << " error=0x" << std::hex << cb.last_error_code << std::dec;
-    LOGE(_m.str());
+
+  if (!finalize_device()) return false;
+  if (devices_out.empty() && init_cmds_out.empty()) {
+    error = "input-map: no devices or init commands defined in " + path;
     return false;
   }
+  return true;
+}
 
-  cb.device_handle = handle;
-    if (verbose) {
-      LOGI("Connected. Ctrl+D to stop.");
-    } else {
-      LOGI("Connected. Ctrl+D to stop.");
-    }
+// ----------------------------
+// Command executor
+// ----------------------------
+// Commands declare the camera resources they touch; two commands only wait
+// for each other when their sets overlap, so a pedal `shoot` doesn't queue
+// behind `exposure show`. Resources are taken all at once, which rules out
+// lock-order deadlocks. Typed commands run on the input thread; input-map
+// presses are handed to a small worker pool and never block the device thread.
+enum CommandResource : unsigned {
+  kResShutter    = 1u << 0,  // S1/S2, movie record, body buttons
+  kResProperties = 1u << 1,  // reading/writing device properties
+  kResTransfer   = 1u << 2,  // contents listing and downloads
+  kResMonitor    = 1u << 3,  // live-view window
+  kResAll        = ~0u,
+};
 
-  // -------- Persist (updated) fingerprint for next run --------
-  {
-    char newfp[512] = {0}; CrInt32u nlen = 0;
-    SDK::GetFingerprint(const_cast<SDK::ICrCameraObjectInfo *>(selected), newfp, &nlen);
-    if (verbose) LOGI("[FP] GetFingerprint(ICrCameraObjectInfo*): " << nlen << " bytes");
+struct CommandResourceEntry {
+  const char *name;
+  unsigned resources;
+};
 
-    if (nlen > 0 && nlen <= sizeof(newfp)) {
-      if (save_fingerprint(fp_path, newfp, nlen)) {
-        if (verbose) LOGI("[FP] saved " << nlen << " bytes to " << fp_path);
-      } else {
-        LOGE("[FP] failed to save fingerprint to " << fp_path);
-      }
-    } else {
-      if (verbose) LOGI("[FP] no fingerprint to save (nlen=0)");
+static const CommandResourceEntry kCommandResources[] = {
+  {"help", 0},
+  {"?", 0},
+  {"metrics", 0},
+  {"wait", 0},
+  {"shutter", 0},   // timing settings only; shots take kResShutter
+  {"interval", 0},  // the scheduler takes the shutter per shot
+  {"props", 0},
+  {"shoot", kResShutter},
+  {"burst", kResShutter},
+  {"bracket", kResProperties | kResShutter},
+  {"trigger", kResShutter},
+  {"focus", kResShutter},
+  {"record", kResShutter},
+  {"button", kResShutter},
+  {"status", kResProperties},
+  {"exposure", kResProperties | kResShutter},
+  {"sync", kResTransfer},
+  {"ratings", kResTransfer},
+  {"monitor", kResMonitor},
+};
+
+// Commands missing from the table (power, quit, …) run exclusively.
+static unsigned command_resources(const std::vector<std::string> &args) {
+  if (args.empty()) return 0;
+  if (args[0] == "exposure" && args.size() > 1) {
+    const std::string sub = to_lower_ascii(args[1]);
+    if (sub == "show" || sub == "list") return kResProperties;  // read-only
+  }
+  for (const auto &e : kCommandResources) {
+    if (args[0] == e.name) return e.resources;
+  }
+  return kResAll;
+}
+
+constexpr std::size_t kCommandWorkers = 3;
+constexpr std::size_t kCommandQueueMax = 32;
+
+class CommandResourceLock {
+ public:
+  explicit CommandResourceLock(unsigned resources) : resources_(resources) {
+    if (!resources_) return;
+    std::unique_lock<std::mutex> lk(g_cmd_mtx);
+    g_cmd_cv.wait(lk, [&] { return (g_cmd_held & resources_) == 0; });
+    g_cmd_held |= resources_;
+  }
+  // Waits until `deadline` at most; check owns() before using the resources.
+  CommandResourceLock(unsigned resources, std::chrono::steady_clock::time_point deadline)
+      : resources_(resources) {
+    if (!resources_) return;
+    std::unique_lock<std::mutex> lk(g_cmd_mtx);
+    if (!g_cmd_cv.wait_until(lk, deadline, [&] { return (g_cmd_held & resources_) == 0; })) {
+      resources_ = 0;
+      owned_ = false;
+      return;
     }
+    g_cmd_held |= resources_;
   }
+  ~CommandResourceLock() {
+    if (!resources_) return;
+    {
+      std::lock_guard<std::mutex> lk(g_cmd_mtx);
+      g_cmd_held &= ~resources_;
+    }
+    g_cmd_cv.notify_all();
+  }
+  CommandResourceLock(const CommandResourceLock &) = delete;
+  CommandResourceLock &operator=(const CommandResourceLock &) = delete;
 
-  (void)download_dir; // already assigned globally elsewhere
-  return true;
-}
-
-static void disconnect_and_release(SDK::CrDeviceHandle &handle,
-				   SDK::ICrCameraObjectInfo *&created,
-				   SDK::ICrEnumCameraObjectInfo *&enum_list) {
-  if (handle) { SDK::Disconnect(handle); SDK::ReleaseDevice(handle); handle = 0; }
-  if (created) { created->Release(); created = nullptr; }
-  if (enum_list) { enum_list->Release(); enum_list = nullptr; }
-}
+  bool owns() const { return owned_; }
 
-// simple word list
-static const std::vector<std::string> commands = {
-  "shoot", "trigger", "focus", "sync", "monitor", "record", "button", "status", "exposure", "power", "quit", "exit"
+ private:
+  unsigned resources_;
+  bool owned_ = true;
 };
 
-char* prompt(EditLine*) {
-  return const_cast<char*>("sonshell> ");
+// First queued job that can start now. A job may overtake earlier ones only
+// if it shares no resource with them, so conflicting commands keep their order.
+static std::deque<CommandJob>::iterator next_runnable_command_locked() {
+  unsigned ahead = 0;
+  for (auto it = g_cmd_queue.begin(); it != g_cmd_queue.end(); ++it) {
+    if ((it->resources & (g_cmd_held | ahead)) == 0) return it;
+    ahead |= it->resources;
+  }
+  return g_cmd_queue.end();
 }
 
-// completion callback
-unsigned char complete(EditLine* el, int ch) {
-  const LineInfo* li = el_line(el);
-  std::string buf(li->buffer, li->lastchar - li->buffer);
+static void command_worker_main() {
+  t_log_unfiltered = true;  // explicitly requested commands, like typed ones
+  std::unique_lock<std::mutex> lk(g_cmd_mtx);
+  for (;;) {
+    std::deque<CommandJob>::iterator it;
+    g_cmd_cv.wait(lk, [&] {
+      if (g_cmd_stop) return true;
+      it = next_runnable_command_locked();
+      return it != g_cmd_queue.end();
+    });
+    if (g_cmd_stop) return;
+    CommandJob job = std::move(*it);
+    g_cmd_queue.erase(it);
+    g_cmd_held |= job.resources;
+    ++g_cmd_running;
+    lk.unlock();
+
+    std::function<int(const std::vector<std::string>&)> runner;
+    {
+      std::lock_guard<std::mutex> rlk(g_command_runner_mutex);
+      runner = g_command_runner;
+    }
+    if (!runner) {
+      LOGW(job.origin << ": not connected; ignoring '" << join_tokens(job.args) << "'");
+    } else {
+      int rc = runner(job.args);
+      if (rc != 0 && rc != 99) {
+        LOGW(job.origin << ": command '" << join_tokens(job.args) << "' returned " << rc);
+      }
+    }
 
-  // very simple: complete whole line against commands
-  for (auto& cmd : commands) {
-    if (cmd.rfind(buf, 0) == 0) {
-      el_insertstr(el, cmd.c_str() + buf.size());
-      return CC_REFRESH;
+    lk.lock();
+    g_cmd_held &= ~job.resources;
+    --g_cmd_running;
+    ++g_cmd_async_done;
+    g_cmd_cv.notify_all();
+  }
+}
+
+static void submit_command(std::vector<std::string> args, std::string origin) {
+  if (args.empty()) return;
+  const unsigned resources = command_resources(args);
+  {
+    std::lock_guard<std::mutex> lk(g_cmd_mtx);
+    if (g_cmd_stop) return;
+    if (g_cmd_queue.size() >= kCommandQueueMax) {
+      ++g_cmd_async_dropped;
+      LOGW(origin << ": " << g_cmd_queue.size() << " commands already queued; dropping '"
+           << join_tokens(args) << "'");
+      return;
     }
+    g_cmd_queue.push_back({std::move(args), resources, std::move(origin)});
+    while (g_cmd_workers.size() < kCommandWorkers) g_cmd_workers.emplace_back(command_worker_main);
   }
-  return CC_REFRESH;
+  g_cmd_cv.notify_all();
 }
 
-// tiny tokenizer: splits on spaces, respects "quotes"
-static std::vector<std::string> tokenize(std::string const& s) {
-  std::vector<std::string> out; std::string cur; bool q=false;
-  for (size_t i=0;i<s.size();++i) {
-    char c=s[i];
-    if (c=='"') { q=!q; continue; }
-    if (!q && std::isspace(static_cast<unsigned char>(c))) {
-      if (!cur.empty()) { out.push_back(cur); cur.clear(); }
+// Called when the REPL's command table is about to go away: queued commands
+// are discarded and running ones are waited for, since they reference it.
+static void quiesce_command_executor() {
+  std::unique_lock<std::mutex> lk(g_cmd_mtx);
+  if (!g_cmd_queue.empty()) {
+    LOGW("commands: discarding " << g_cmd_queue.size() << " queued command(s)");
+    g_cmd_async_dropped += g_cmd_queue.size();
+    g_cmd_queue.clear();
+  }
+  g_cmd_cv.wait(lk, [] { return g_cmd_running == 0; });
+}
+
+static void stop_command_executor() {
+  {
+    std::lock_guard<std::mutex> lk(g_cmd_mtx);
+    g_cmd_stop = true;
+    g_cmd_queue.clear();
+  }
+  g_cmd_cv.notify_all();
+  for (auto &t : g_cmd_workers) {
+    if (!t.joinable()) continue;
+    if (g_force_close_requested.load(std::memory_order_relaxed)) {
+      t.detach();
     } else {
-      cur.push_back(c);
+      t.join();
     }
   }
-  if (!cur.empty()) out.push_back(cur);
-  return out;
+  g_cmd_workers.clear();
 }
 
-static std::string join_tokens(const std::vector<std::string>& tokens) {
-  if (tokens.empty()) return {};
-  return join_args(tokens, 0);
+static void run_init_commands_once(const std::function<int(const std::vector<std::string>&)>& exec_fn) {
+  if (!exec_fn) return;
+  bool already = g_init_commands_ran.exchange(true, std::memory_order_acq_rel);
+  if (already) return;
+  for (const auto& cmd : g_init_commands) {
+    if (cmd.empty()) continue;
+    int rc = exec_fn(cmd);
+    if (rc != 0) {
+      LOGW("init: command '" << join_tokens(cmd) << "' returned " << rc);
+    }
+  }
 }
 
-static bool split_key_value_line(const std::string& line,
-                                 std::string& key,
-                                 std::string& value) {
-  auto pos = line.find(':');
-  if (pos == std::string::npos) return false;
-  key = trim_copy(line.substr(0, pos));
-  value = trim_copy(line.substr(pos + 1));
-  if (!value.empty() && value.front() == '"' && value.back() == '"' && value.size() >= 2) {
-    value = value.substr(1, value.size() - 2);
+static void input_device_thread_main(InputMapDevice device) {
+  const std::string label = device.path.empty() ? "<unknown>" : device.path;
+  constexpr std::chrono::milliseconds kRetryDelay{1000};
+  bool missing_logged = false;
+
+  while (!g_stop.load(std::memory_order_relaxed)) {
+    int fd = open(device.path.c_str(), O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+      int err = errno;
+      if (!missing_logged) {
+        LOGW("input-map: waiting for " << label << " (" << std::strerror(err) << ")");
+        missing_logged = true;
+      }
+      std::this_thread::sleep_for(kRetryDelay);
+      continue;
+    }
+    missing_logged = false;
+
+    LOGI("input-map: listening on " << label << " (" << device.key_to_command.size() << " bindings)");
+
+    while (!g_stop.load(std::memory_order_relaxed)) {
+      struct pollfd pfd { fd, POLLIN, 0 };
+      int pr = poll(&pfd, 1, 250);
+      if (pr < 0) {
+        if (errno == EINTR) continue;
+        LOGE("input-map: poll failed on " << label << ": " << std::strerror(errno));
+        break;
+      }
+      if (pr == 0) continue;
+      if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        LOGW("input-map: device " << label << " disappeared (poll flags " << std::hex << pfd.revents << std::dec << ")");
+        break;
+      }
+      if (!(pfd.revents & POLLIN)) continue;
+
+      struct input_event ev {};
+      ssize_t n = read(fd, &ev, sizeof(ev));
+      if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN) continue;
+        LOGE("input-map: read failed on " << label << ": " << std::strerror(errno));
+        break;
+      }
+      if (n == 0) {
+        LOGW("input-map: device " << label << " disconnected (EOF)");
+        break;
+      }
+      if (n != sizeof(ev)) continue;
+      if (ev.type != EV_KEY) continue;
+      if (ev.value != 1) continue;
+
+      auto it = device.key_to_command.find(ev.code);
+      if (it == device.key_to_command.end()) continue;
+
+      submit_command(it->second, "input-map");
+    }
+
+    close(fd);
+    if (g_stop.load(std::memory_order_relaxed)) break;
+    LOGW("input-map: device " << label << " disconnected; retrying in " << kRetryDelay.count() << " ms");
+    std::this_thread::sleep_for(kRetryDelay);
   }
-  return !key.empty();
 }
 
-static bool parse_key_code_token(const std::string& raw, int& code_out) {
-  if (raw.empty()) return false;
-  bool numeric = std::isdigit(static_cast<unsigned char>(raw.front()));
-  if (!numeric && raw.size() > 1 && raw[0] == '0' && (raw[1] == 'x' || raw[1] == 'X')) {
-    numeric = true;
+static void start_input_map_threads(const std::vector<InputMapDevice>& devices,
+                                    const std::string& source_path) {
+  if (devices.empty()) return;
+  if (!source_path.empty()) {
+    LOGI("input-map: loaded " << devices.size() << " device(s) from " << source_path);
   }
-  if (numeric) {
-    try {
-      code_out = std::stoi(raw, nullptr, 0);
-      return true;
-    } catch (...) {
-      return false;
+  for (const auto& dev : devices) {
+    if (dev.path.empty() || dev.key_to_command.empty()) {
+      LOGW("input-map: skipped device with no path or bindings");
+      continue;
     }
+    g_input_device_threads.emplace_back(input_device_thread_main, dev);
   }
+}
 
-  std::string key = raw;
-  std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) {
-    return static_cast<char>(std::toupper(c));
-  });
+// ----------------------------
+// Scripts
+// ----------------------------
+// One grammar for typed lines, --script files and --batch input:
+//   cmd args ; cmd args          commands separated by ';' or newlines
+//   repeat N { ... }             run the block N times (may span lines, nest)
+//   # comment                    to end of line
+// A step that returns 2 or more stops the run; `quit`/`exit` end it early.
+struct ScriptStep {
+  std::vector<std::string> args;  // empty for a repeat block
+  int repeat = 0;
+  std::vector<ScriptStep> body;
+  int line = 0;
+};
 
-#define KEY_ENTRY(name) {#name, name}
-  static const std::unordered_map<std::string, int> kKeyCodeMap = {
-    KEY_ENTRY(KEY_LEFT), KEY_ENTRY(KEY_RIGHT), KEY_ENTRY(KEY_UP), KEY_ENTRY(KEY_DOWN),
-    KEY_ENTRY(KEY_ENTER), KEY_ENTRY(KEY_OK), KEY_ENTRY(KEY_ESC), KEY_ENTRY(KEY_BACKSPACE),
-    KEY_ENTRY(KEY_SPACE), KEY_ENTRY(KEY_TAB), KEY_ENTRY(KEY_HOME), KEY_ENTRY(KEY_END),
-    KEY_ENTRY(KEY_PAGEUP), KEY_ENTRY(KEY_PAGEDOWN), KEY_ENTRY(KEY_MENU), KEY_ENTRY(KEY_INFO),
-    KEY_ENTRY(KEY_CAMERA), KEY_ENTRY(KEY_RECORD), KEY_ENTRY(KEY_PLAYPAUSE),
-    KEY_ENTRY(KEY_STOP), KEY_ENTRY(KEY_VOLUMEUP), KEY_ENTRY(KEY_VOLUMEDOWN),
-    KEY_ENTRY(KEY_MUTE), KEY_ENTRY(KEY_MEDIA), KEY_ENTRY(KEY_F1), KEY_ENTRY(KEY_F2),
-    KEY_ENTRY(KEY_F3), KEY_ENTRY(KEY_F4), KEY_ENTRY(KEY_F5), KEY_ENTRY(KEY_F6),
-    KEY_ENTRY(KEY_F7), KEY_ENTRY(KEY_F8), KEY_ENTRY(KEY_F9), KEY_ENTRY(KEY_F10),
-    KEY_ENTRY(KEY_F11), KEY_ENTRY(KEY_F12), KEY_ENTRY(KEY_1), KEY_ENTRY(KEY_2),
-    KEY_ENTRY(KEY_3), KEY_ENTRY(KEY_4), KEY_ENTRY(KEY_5), KEY_ENTRY(KEY_6),
-    KEY_ENTRY(KEY_7), KEY_ENTRY(KEY_8), KEY_ENTRY(KEY_9), KEY_ENTRY(KEY_0),
-    KEY_ENTRY(KEY_A), KEY_ENTRY(KEY_B), KEY_ENTRY(KEY_C), KEY_ENTRY(KEY_D),
-    KEY_ENTRY(KEY_E), KEY_ENTRY(KEY_F), KEY_ENTRY(KEY_G), KEY_ENTRY(KEY_H),
-    KEY_ENTRY(KEY_I), KEY_ENTRY(KEY_J), KEY_ENTRY(KEY_K), KEY_ENTRY(KEY_L),
-    KEY_ENTRY(KEY_M), KEY_ENTRY(KEY_N), KEY_ENTRY(KEY_O), KEY_ENTRY(KEY_P),
-    KEY_ENTRY(KEY_Q), KEY_ENTRY(KEY_R), KEY_ENTRY(KEY_S), KEY_ENTRY(KEY_T),
-    KEY_ENTRY(KEY_U), KEY_ENTRY(KEY_V), KEY_ENTRY(KEY_W), KEY_ENTRY(KEY_X),
-    KEY_ENTRY(KEY_Y), KEY_ENTRY(KEY_Z),
-    KEY_ENTRY(BTN_LEFT), KEY_ENTRY(BTN_RIGHT), KEY_ENTRY(BTN_MIDDLE),
-    KEY_ENTRY(BTN_SOUTH), KEY_ENTRY(BTN_EAST), KEY_ENTRY(BTN_NORTH),
-    KEY_ENTRY(BTN_WEST)
-  };
-#undef KEY_ENTRY
+struct ScriptToken {
+  std::string text;
+  char sep = 0;  // ';', '{' or '}' for separators, 0 for words
+};
 
-  auto it = kKeyCodeMap.find(key);
-  if (it == kKeyCodeMap.end()) return false;
-  code_out = it->second;
+static bool lex_script_line(const std::string &line, std::vector<ScriptToken> &out, std::string &err) {
+  std::string cur;
+  bool have = false, quoted = false;
+  auto flush = [&] {
+    if (have) out.push_back({cur, 0});
+    cur.clear();
+    have = false;
+  };
+  for (char c : line) {
+    if (quoted) {
+      if (c == '"') quoted = false;
+      else cur.push_back(c);
+      continue;
+    }
+    if (c == '"') { quoted = true; have = true; continue; }
+    if (c == '#' && !have) break;
+    if (std::isspace(static_cast<unsigned char>(c))) { flush(); continue; }
+    if (c == ';' || c == '{' || c == '}') {
+      flush();
+      out.push_back({std::string(), c});
+      continue;
+    }
+    cur.push_back(c);
+    have = true;
+  }
+  if (quoted) {
+    err = "unterminated quote";
+    return false;
+  }
+  flush();
   return true;
 }
 
-static bool parse_input_map_config(const std::string& path,
-                                   std::vector<InputMapDevice>& devices_out,
-                                   std::vector<std::vector<std::string>>& init_cmds_out,
-                                   std::string& error) {
-  std::ifstream in(path);
-  if (!in) {
-    error = "input-map: unable to open " + path;
-    return false;
+class ScriptParser {
+ public:
+  // Parses one line. Statements completed at top level move to `ready`;
+  // a block that is still open keeps collecting until its '}' arrives.
+  bool feed(const std::string &line, int line_no, std::vector<ScriptStep> &ready, std::string &err) {
+    std::vector<ScriptToken> toks;
+    if (!lex_script_line(line, toks, err)) return fail_(line_no);
+    for (auto &t : toks) {
+      if (!t.sep) {
+        if (cur_.empty()) cur_line_ = line_no;
+        cur_.push_back(std::move(t.text));
+      } else if (t.sep == ';') {
+        if (!flush_(err)) return fail_(line_no);
+      } else if (t.sep == '{') {
+        long n = 0;
+        if (cur_.size() != 2 || cur_[0] != "repeat" || !parse_count_(cur_[1], n)) {
+          err = "'{' must follow 'repeat <count>'";
+          return fail_(line_no);
+        }
+        stack_.push_back({static_cast<int>(n), line_no, {}});
+        cur_.clear();
+      } else {
+        if (!flush_(err)) return fail_(line_no);
+        if (stack_.size() == 1) {
+          err = "unmatched '}'";
+          return fail_(line_no);
+        }
+        Frame f = std::move(stack_.back());
+        stack_.pop_back();
+        ScriptStep step;
+        step.repeat = f.count;
+        step.body = std::move(f.steps);
+        step.line = f.line;
+        stack_.back().steps.push_back(std::move(step));
+      }
+    }
+    if (!flush_(err)) return fail_(line_no);
+    if (stack_.size() == 1) {
+      for (auto &st : stack_[0].steps) ready.push_back(std::move(st));
+      stack_[0].steps.clear();
+    }
+    return true;
   }
 
-  InputMapDevice current;
-  bool device_active = false;
-  bool in_bindings = false;
-  bool in_init_commands = false;
-  bool in_input_section = false;
-  bool in_init_section = false;
-  int line_no = 0;
+  bool finish(std::string &err) {
+    if (stack_.size() == 1) return true;
+    err = "missing '}'";
+    return fail_(stack_.back().line);
+  }
 
-  auto finalize_device = [&]() -> bool {
-    if (!device_active) return true;
-    if (current.path.empty()) {
-      error = "input-map: device missing 'path:' entry";
+  // Line of the last error reported by feed()/finish().
+  int error_line() const { return error_line_; }
+
+ private:
+  struct Frame {
+    int count;
+    int line;
+    std::vector<ScriptStep> steps;
+  };
+
+  static bool parse_count_(const std::string &s, long &n) {
+    char *end = nullptr;
+    n = std::strtol(s.c_str(), &end, 10);
+    return !s.empty() && end && *end == '\0' && n >= 0 && n <= 1000000;
+  }
+  bool flush_(std::string &err) {
+    if (cur_.empty()) return true;
+    if (cur_[0] == "repeat") {
+      err = "usage: repeat <count> { commands }";
       return false;
     }
-    devices_out.push_back(current);
-    current = InputMapDevice{};
-    device_active = false;
-    in_bindings = false;
+    ScriptStep step;
+    step.args = std::move(cur_);
+    step.line = cur_line_;
+    stack_.back().steps.push_back(std::move(step));
+    cur_.clear();
     return true;
-  };
+  }
+  bool fail_(int line_no) {
+    error_line_ = line_no;
+    return false;
+  }
 
-  while (in.good()) {
-    std::string raw_line;
-    std::getline(in, raw_line);
-    if (!in && raw_line.empty()) break;
-    ++line_no;
-    std::string line = raw_line;
-    auto comment = line.find('#');
-    if (comment != std::string::npos) line.erase(comment);
+  std::vector<Frame> stack_{Frame{0, 0, {}}};
+  std::vector<std::string> cur_;
+  int cur_line_ = 0;
+  int error_line_ = 0;
+};
 
-    int indent = 0;
-    while (indent < static_cast<int>(line.size()) && line[indent] == ' ') ++indent;
+using CommandFn = std::function<int(const std::vector<std::string>&)>;
 
-    bool list_item = false;
-    int content_start = indent;
-    if (content_start < static_cast<int>(line.size()) && line[content_start] == '-') {
-      list_item = true;
-      ++content_start;
-      if (content_start < static_cast<int>(line.size()) && line[content_start] == ' ') ++content_start;
-    }
+enum class ScriptResult { Ok, Failed, Quit, Interrupted };
 
-    std::string content = trim_copy(line.substr(content_start));
-    if (content.empty()) continue;
+struct ScriptRun {
+  int worst = 0;                       // highest return code seen
+  const ScriptStep *failed = nullptr;  // step that stopped the run
+  int failed_rc = 0;
+};
 
-    if (indent == 0 && content == "input:") {
-      in_input_section = true;
-      in_init_section = false;
-      in_init_commands = false;
-      continue;
-    }
-    if (indent == 0 && content == "init:") {
-      in_init_section = true;
-      in_input_section = false;
-      in_bindings = false;
-      if (!finalize_device()) return false;
-      continue;
-    }
-    if (indent == 2 && in_input_section && content == "devices:") {
+static ScriptResult run_script_steps(const std::vector<ScriptStep> &steps, const CommandFn &run,
+                                     ScriptRun &st) {
+  for (const auto &step : steps) {
+    if (g_stop.load(std::memory_order_relaxed) || g_reconnect.load(std::memory_order_relaxed)) {
+      return ScriptResult::Interrupted;
+    }
+    flush_log_repeats(false);
+    if (step.args.empty()) {
+      for (int i = 0; i < step.repeat; ++i) {
+        ScriptResult r = run_script_steps(step.body, run, st);
+        if (r != ScriptResult::Ok) return r;
+      }
       continue;
     }
-    if (indent == 2 && in_init_section && content == "commands:") {
-      in_init_commands = true;
-      continue;
+    int rc = run(step.args);
+    if (rc == 99) return ScriptResult::Quit;
+    st.worst = std::max(st.worst, rc);
+    if (rc >= 2) {
+      st.failed = &step;
+      st.failed_rc = rc;
+      return ScriptResult::Failed;
     }
-    if (indent == 4 && list_item && in_input_section) {
-      if (!finalize_device()) return false;
-      device_active = true;
-      in_bindings = false;
-      if (!content.empty()) {
-        std::string key, value;
-        if (!split_key_value_line(content, key, value)) {
-          error = "input-map: expected 'path: ...' after '-' on line " + std::to_string(line_no);
-          return false;
-        }
-        if (key != "path") {
-          error = "input-map: only 'path' may follow '-' directly (line " + std::to_string(line_no) + ")";
-          return false;
-        }
-        current.path = expand_user_path(value);
-      }
+  }
+  return ScriptResult::Ok;
+}
+
+// Sleeps for `ms` unless the session ends first; used by the `wait` command.
+static bool script_sleep(std::chrono::milliseconds ms) {
+  const auto deadline = std::chrono::steady_clock::now() + ms;
+  while (!g_stop.load(std::memory_order_relaxed) && !g_reconnect.load(std::memory_order_relaxed)) {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) return true;
+    flush_log_repeats(false);
+    std::this_thread::sleep_for(std::min(std::chrono::milliseconds(50),
+        std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now)));
+  }
+  return false;
+}
+
+// A typed REPL line: same grammar as scripts, but on a single line.
+// Returns 99 when the line asked to quit, otherwise the worst return code.
+static int run_command_line(const std::string &line, const CommandFn &run) {
+  ScriptParser parser;
+  std::vector<ScriptStep> steps;
+  std::string err;
+  if (!parser.feed(line, 1, steps, err) || !parser.finish(err)) {
+    LOGE(err);
+    return 2;
+  }
+  ScriptRun st;
+  switch (run_script_steps(steps, run, st)) {
+    case ScriptResult::Quit: return 99;
+    case ScriptResult::Failed: return st.failed_rc;
+    default: return st.worst;
+  }
+}
+
+// --script <file> is parsed up front so syntax errors surface before
+// connecting; --batch streams stdin and runs each statement as it completes.
+static bool g_script_mode = false;
+static bool g_script_from_stdin = false;
+static std::string g_script_path;
+static std::vector<ScriptStep> g_script_program;
+static std::atomic<int> g_exit_code{0};
+
+static bool load_script_file(const std::string &path) {
+  std::ifstream in(expand_user_path(path));
+  if (!in) {
+    LOGE("script: cannot open " << path);
+    return false;
+  }
+  ScriptParser parser;
+  std::string line, err;
+  int line_no = 0;
+  while (std::getline(in, line)) {
+    if (!parser.feed(line, ++line_no, g_script_program, err)) break;
+  }
+  if (!err.empty() || !parser.finish(err)) {
+    LOGE("script: " << path << ":" << parser.error_line() << ": " << err);
+    return false;
+  }
+  g_script_path = path;
+  return true;
+}
+
+static ScriptResult run_batch_stdin(const CommandFn &run, ScriptRun &st) {
+  ScriptParser parser;
+  std::vector<ScriptStep> ready;
+  std::string buf, err;
+  int line_no = 0;
+  bool eof = false;
+  while (!eof) {
+    if (g_stop.load(std::memory_order_relaxed) || g_reconnect.load(std::memory_order_relaxed)) {
+      return ScriptResult::Interrupted;
+    }
+    struct pollfd pfd{STDIN_FILENO, POLLIN, 0};
+    int pr = poll(&pfd, 1, 200);
+    if (pr < 0 && errno != EINTR) break;
+    if (pr <= 0) {
+      flush_log_repeats(false);
       continue;
     }
-    if (in_init_commands) {
-      if (!list_item && indent < 4) {
-        error = "input-map: expected list item under init.commands (line " + std::to_string(line_no) + ")";
-        return false;
+    char chunk[4096];
+    ssize_t n = read(STDIN_FILENO, chunk, sizeof(chunk));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+    if (n <= 0) {
+      eof = true;
+      if (!buf.empty()) buf.push_back('\n');  // last line without newline
+    } else {
+      buf.append(chunk, static_cast<std::size_t>(n));
+    }
+    std::size_t start = 0, nl;
+    while ((nl = buf.find('\n', start)) != std::string::npos) {
+      std::string line = buf.substr(start, nl - start);
+      start = nl + 1;
+      if (!parser.feed(line, ++line_no, ready, err)) {
+        LOGE("batch: line " << parser.error_line() << ": " << err);
+        st.failed_rc = 2;
+        return ScriptResult::Failed;
       }
-      std::string cmd = content;
-      if (cmd.empty()) {
-        error = "input-map: empty init command on line " + std::to_string(line_no);
-        return false;
+      if (ready.empty()) continue;
+      std::vector<ScriptStep> steps;
+      steps.swap(ready);
+      ScriptResult r = run_script_steps(steps, run, st);
+      if (r == ScriptResult::Failed) {
+        // `steps` dies here; report while the failed step is still alive.
+        LOGE("batch: line " << st.failed->line << ": '" << join_tokens(st.failed->args)
+             << "' failed (" << st.failed_rc << ")");
+        st.failed = nullptr;
       }
-      // strip quotes if present
-      if (cmd.front() == '"' && cmd.back() == '"' && cmd.size() >= 2) {
-        cmd = cmd.substr(1, cmd.size() - 2);
+      if (r != ScriptResult::Ok) return r;
+    }
+    buf.erase(0, start);
+  }
+  if (!parser.finish(err)) {
+    LOGE("batch: line " << parser.error_line() << ": " << err);
+    st.failed_rc = 2;
+    return ScriptResult::Failed;
+  }
+  return ScriptResult::Ok;
+}
+
+// Runs the script once, records the process exit code and ends the session:
+// 0 ok, 1 ok with warnings, 2 command or syntax error, 3 connection lost,
+// 130 interrupted.
+static void run_script_session(const CommandFn &run) {
+  ScriptRun st;
+  const char *label = g_script_from_stdin ? "batch" : "script";
+  ScriptResult r = g_script_from_stdin ? run_batch_stdin(run, st)
+                                       : run_script_steps(g_script_program, run, st);
+  int code = st.worst;
+  switch (r) {
+    case ScriptResult::Ok:
+    case ScriptResult::Quit:
+      break;
+    case ScriptResult::Failed:
+      if (st.failed) {
+        LOGE(label << ": line " << st.failed->line << ": '" << join_tokens(st.failed->args)
+             << "' failed (" << st.failed_rc << ")");
       }
-      auto tokens = tokenize(cmd);
-      if (tokens.empty()) {
-        error = "input-map: init command parses to zero tokens (line " + std::to_string(line_no) + ")";
-        return false;
+      code = st.failed_rc;
+      break;
+    case ScriptResult::Interrupted:
+      if (g_stop.load(std::memory_order_relaxed)) {
+        code = 130;
+      } else {
+        LOGE(label << ": connection lost; not resuming");
+        code = 3;
       }
-      init_cmds_out.push_back(tokens);
-      continue;
-    }
+      break;
+  }
+  LOGI(label << ": finished with exit code " << code);
+  g_exit_code.store(code, std::memory_order_relaxed);
+  g_stop.store(true, std::memory_order_relaxed);
+}
 
-    if (!device_active) {
-      error = "input-map: device attributes appeared before '- path:' (line " + std::to_string(line_no) + ")";
-      return false;
-    }
+// ----------------------------
+// Intervalometer
+// ----------------------------
+// Shot k is due at start + k * period on the steady clock, so the time a shot
+// takes (S1, release, camera latency) never accumulates into drift. A shot
+// whose deadline arrives while the shutter is busy (another command, or the
+// previous shot overrunning) is skipped or fired late, depending on policy.
+enum class IntervalPolicy { Skip, Queue };
 
-    if (indent >= 6 && indent < 8) {
-      if (!in_input_section) {
-        error = "input-map: unexpected key outside 'input' section (line " + std::to_string(line_no) + ")";
-        return false;
-      }
-      std::string key, value;
-      if (!split_key_value_line(content, key, value)) {
-        error = "input-map: expected 'key: value' on line " + std::to_string(line_no);
-        return false;
-      }
-      if (key == "path") {
-        current.path = expand_user_path(value);
-      } else if (key == "bindings") {
-        if (!value.empty()) {
-          error = "input-map: 'bindings' must not have an inline value (line " + std::to_string(line_no) + ")";
-          return false;
-        }
-        in_bindings = true;
-      } else {
-        error = "input-map: unknown device key '" + key + "' (line " + std::to_string(line_no) + ")";
-        return false;
-      }
-      continue;
+struct Intervalometer {
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::thread thread;
+  bool stop = false;
+  bool running = false;
+  std::chrono::milliseconds period{0};
+  std::uint64_t count = 0;  // 0 = until stopped
+  IntervalPolicy policy = IntervalPolicy::Skip;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::time_point next_due;
+  // Statistics (lag = fire time - deadline), Welford running mean/variance.
+  std::uint64_t fired = 0, skipped = 0, failed = 0;
+  double lag_mean_ms = 0, lag_m2 = 0, lag_max_ms = 0;
+};
+static Intervalometer g_interval;
+
+// "10s", "2.5s", "500ms", "1m", "1h"; a bare number means seconds.
+static bool parse_duration_token(const std::string &raw, std::chrono::milliseconds &out) {
+  std::string s = to_lower_ascii(raw);
+  double scale = 1000.0;
+  auto strip = [&](const char *suffix, double mult) {
+    std::size_t n = std::strlen(suffix);
+    if (s.size() > n && s.compare(s.size() - n, n, suffix) == 0) {
+      s.resize(s.size() - n);
+      scale = mult;
+      return true;
     }
-
-    if (indent >= 8 && in_bindings) {
-      std::string key, value;
-      if (!split_key_value_line(content, key, value)) {
-        error = "input-map: expected 'KEY_NAME: command' (line " + std::to_string(line_no) + ")";
-        return false;
+    return false;
+  };
+  if (!strip("ms", 1.0) && !strip("s", 1000.0) && !strip("m", 60000.0)) strip("h", 3600000.0);
+  char *end = nullptr;
+  double v = std::strtod(s.c_str(), &end);
+  if (s.empty() || !end || *end != '\0' || !(v > 0)) return false;
+  out = std::chrono::milliseconds(static_cast<long long>(std::llround(v * scale)));
+  return out.count() > 0;
+}
+
+static void log_interval_stats_locked(const Intervalometer &iv, const char *prefix) {
+  const double jitter = iv.fired > 1 ? std::sqrt(iv.lag_m2 / (iv.fired - 1)) : 0.0;
+  LOGI(prefix << iv.fired << " shot(s), " << iv.skipped << " skipped, " << iv.failed
+       << " failed; lag avg " << std::fixed << std::setprecision(1) << iv.lag_mean_ms
+       << " ms, jitter " << jitter << " ms (stddev), max " << iv.lag_max_ms << " ms");
+}
+
+static void interval_main(SDK::CrDeviceHandle handle, bool verbose) {
+  auto &iv = g_interval;
+  std::unique_lock<std::mutex> lk(iv.mtx);
+  const auto period = iv.period;
+  const auto start = iv.start;
+  // Without queueing, a busy shutter gets a little slack before the shot is dropped.
+  const auto grace = std::min(std::chrono::milliseconds(500), period / 4);
+  std::uint64_t k = 0;
+  while (!iv.stop && (iv.count == 0 || k < iv.count)) {
+    const auto deadline = start + k * period;
+    iv.next_due = deadline;
+    if (iv.cv.wait_until(lk, deadline, [&] { return iv.stop; })) break;
+    const IntervalPolicy policy = iv.policy;
+    lk.unlock();
+
+    bool fired = false, ok = false;
+    double lag_ms = 0;
+    {
+      std::unique_ptr<CommandResourceLock> res;
+      if (policy == IntervalPolicy::Skip) {
+        res = std::make_unique<CommandResourceLock>(kResShutter, deadline + grace);
+      } else {
+        // Queue: wait for the shutter, but keep noticing `interval stop`.
+        for (;;) {
+          res = std::make_unique<CommandResourceLock>(
+              kResShutter, std::chrono::steady_clock::now() + std::chrono::milliseconds(200));
+          if (res->owns()) break;
+          std::lock_guard<std::mutex> slk(iv.mtx);
+          if (iv.stop) break;
+        }
       }
-      if (value.empty()) {
-        error = "input-map: command for '" + key + "' is empty (line " + std::to_string(line_no) + ")";
-        return false;
+      if (res->owns()) {
+        const auto now = std::chrono::steady_clock::now();
+        lag_ms = std::chrono::duration<double, std::milli>(now - deadline).count();
+        fired = true;
+        ok = trigger_full_shutter_press(handle, verbose, "interval");
       }
-      int key_code = 0;
-      if (!parse_key_code_token(key, key_code)) {
-        error = "input-map: unknown key '" + key + "' (line " + std::to_string(line_no) + ")";
-        return false;
+    }
+
+    lk.lock();
+    if (fired) {
+      ++iv.fired;
+      if (!ok) ++iv.failed;
+      const double delta = lag_ms - iv.lag_mean_ms;
+      iv.lag_mean_ms += delta / static_cast<double>(iv.fired);
+      iv.lag_m2 += delta * (lag_ms - iv.lag_mean_ms);
+      iv.lag_max_ms = std::max(iv.lag_max_ms, lag_ms);
+      if (verbose) {
+        LOGI("interval: shot " << k + 1 << (iv.count ? "/" + std::to_string(iv.count) : std::string())
+             << " lag " << std::fixed << std::setprecision(1) << lag_ms << " ms");
       }
-      auto tokens = tokenize(value);
-      if (tokens.empty()) {
-        error = "input-map: command for '" + key + "' parses to zero tokens (line " + std::to_string(line_no) + ")";
-        return false;
+    } else if (!iv.stop) {
+      ++iv.skipped;
+      LOGW("interval: shutter busy; skipped shot " << k + 1);
+    }
+    ++k;
+    if (policy == IntervalPolicy::Skip) {
+      // Deadlines that passed (beyond the grace) while this shot ran are
+      // dropped, not fired late.
+      const auto now = std::chrono::steady_clock::now() - grace;
+      if (now > start + k * period) {
+        std::uint64_t next = static_cast<std::uint64_t>((now - start) / period) + 1;
+        if (iv.count) next = std::min<std::uint64_t>(next, iv.count);
+        if (next > k) {
+          iv.skipped += next - k;
+          LOGW("interval: shot overran the period; skipped " << next - k << " shot(s)");
+          k = next;
+        }
       }
-      current.key_to_command[key_code] = tokens;
-      continue;
     }
+  }
+  log_interval_stats_locked(iv, iv.stop ? "interval: stopped after " : "interval: finished: ");
+  iv.running = false;
+  iv.cv.notify_all();
+}
 
-    error = "input-map: unsupported indentation on line " + std::to_string(line_no);
-    return false;
+static void interval_stop() {
+  auto &iv = g_interval;
+  {
+    std::lock_guard<std::mutex> lk(iv.mtx);
+    iv.stop = true;
   }
+  iv.cv.notify_all();
+  g_cmd_cv.notify_all();
+  if (iv.thread.joinable()) iv.thread.join();
+}
 
-  if (!finalize_device()) return false;
-  if (devices_out.empty() && init_cmds_out.empty()) {
-    error = "input-map: no devices or init commands defined in " + path;
-    return false;
+static bool interval_start(SDK::CrDeviceHandle handle, bool verbose, std::chrono::milliseconds period,
+                           std::uint64_t count, IntervalPolicy policy) {
+  auto &iv = g_interval;
+  {
+    std::lock_guard<std::mutex> lk(iv.mtx);
+    if (iv.running) {
+      LOGE("interval: already running; use 'interval stop' first");
+      return false;
+    }
   }
+  if (iv.thread.joinable()) iv.thread.join();  // previous run finished on its own
+  std::lock_guard<std::mutex> lk(iv.mtx);
+  iv.stop = false;
+  iv.running = true;
+  iv.period = period;
+  iv.count = count;
+  iv.policy = policy;
+  iv.start = std::chrono::steady_clock::now();
+  iv.fired = iv.skipped = iv.failed = 0;
+  iv.lag_mean_ms = iv.lag_m2 = iv.lag_max_ms = 0;
+  iv.thread = std::thread(interval_main, handle, verbose);
+  LOGI("interval: " << (count ? std::to_string(count) : std::string("unlimited")) << " shot(s) every "
+       << period.count() << " ms (" << (policy == IntervalPolicy::Skip ? "skip" : "queue")
+       << " when busy)");
   return true;
 }
 
-static std::function<int(const std::vector<std::string>&)> wait_for_command_runner() {
-  std::unique_lock<std::mutex> lk(g_command_runner_mutex);
-  g_command_runner_cv.wait(lk, [] {
-    return g_command_runner || g_stop.load(std::memory_order_relaxed);
-  });
-  if (!g_command_runner) return {};
-  return g_command_runner;
-}
+static int interval_command(SDK::CrDeviceHandle handle, bool verbose, const std::vector<std::string> &args) {
+  auto &iv = g_interval;
+  const std::string sub = args.size() > 1 ? to_lower_ascii(args[1]) : std::string();
+  if (args.size() == 1) {
+    std::lock_guard<std::mutex> lk(iv.mtx);
+    if (!iv.running) {
+      LOGI("interval: not running");
+      return 0;
+    }
+    const auto due = std::chrono::duration<double>(iv.next_due - std::chrono::steady_clock::now()).count();
+    LOGI("interval: every " << iv.period.count() << " ms, "
+         << iv.fired + iv.skipped << (iv.count ? "/" + std::to_string(iv.count) : std::string())
+         << " done, next in " << std::fixed << std::setprecision(1) << std::max(0.0, due) << " s");
+    log_interval_stats_locked(iv, "interval: so far ");
+    return 0;
+  }
+  if (sub == "stop" && args.size() == 2) {
+    bool was_running;
+    {
+      std::lock_guard<std::mutex> lk(iv.mtx);
+      was_running = iv.running;
+    }
+    if (!was_running) {
+      LOGW("interval: not running");
+      return 1;
+    }
+    interval_stop();
+    return 0;
+  }
+  if (sub == "wait" && args.size() == 2) {
+    std::unique_lock<std::mutex> lk(iv.mtx);
+    while (iv.running) {
+      iv.cv.wait_for(lk, std::chrono::milliseconds(200));
+      if (g_stop.load(std::memory_order_relaxed) || g_reconnect.load(std::memory_order_relaxed)) return 1;
+      // Blocks the input thread (or a script) for the whole run; keep summaries coming.
+      lk.unlock();
+      flush_log_repeats(false);
+      lk.lock();
+    }
+    return 0;
+  }
+  std::chrono::milliseconds period{0};
+  char *end = nullptr;
+  long long count = args.size() > 2 ? std::strtoll(args[2].c_str(), &end, 10) : -1;
+  IntervalPolicy policy = IntervalPolicy::Skip;
+  bool ok = (args.size() == 3 || args.size() == 4) && parse_duration_token(args[1], period) &&
+            count >= 0 && end && *end == '\0';
+  if (ok && args.size() == 4) {
+    const std::string p = to_lower_ascii(args[3]);
+    if (p == "queue") policy = IntervalPolicy::Queue;
+    else if (p != "skip") ok = false;
+  }
+  if (!ok) {
+    LOGE("usage: interval <period> <count> [skip|queue] | interval stop | interval wait");
+    return 2;
+  }
+  return interval_start(handle, verbose, period, static_cast<std::uint64_t>(count), policy) ? 0 : 2;
+}
+
+// burst <count>|<duration>; `deliver` hands each slot's frame count to the download path.
+static int burst_command(SDK::CrDeviceHandle handle, bool verbose, const std::vector<std::string> &args,
+                         const std::function<void(CrInt32u slot, CrInt32u frames)> &deliver) {
+  using clock = std::chrono::steady_clock;
+  CrInt32u want = 0;
+  std::chrono::milliseconds hold{0};
+  bool ok = args.size() == 2;
+  if (ok && std::all_of(args[1].begin(), args[1].end(), [](unsigned char c) { return std::isdigit(c); })) {
+    long n = std::strtol(args[1].c_str(), nullptr, 10);
+    ok = n > 0 && n <= 9999;
+    want = static_cast<CrInt32u>(n);
+  } else if (ok) {
+    ok = parse_duration_token(args[1], hold) && hold <= std::chrono::minutes(10);
+  }
+  if (!ok) {
+    LOGE("usage: burst <frames> | burst <duration>  (e.g. 'burst 20', 'burst 1.5s')");
+    return 2;
+  }
+  if (!handle) {
+    LOGE("burst: camera handle unavailable");
+    return 2;
+  }
 
-static int run_input_mapped_command(const std::vector<std::string>& tokens) {
-  if (tokens.empty()) return 0;
-  auto runner = wait_for_command_runner();
-  if (!runner) return 1;
-  return runner(tokens);
-}
+  auto snap = property_snapshot();
+  const ShutterGroup group =
+      snap ? shutter_group_for_drive(snap->get(SDK::CrDeviceProperty_DriveMode)) : kShutterOther;
+  if (group != kShutterContinuous) {
+    LOGW("burst: drive mode is "
+         << (snap ? drive_mode_to_string(snap->get(SDK::CrDeviceProperty_DriveMode).value) : std::string("unknown"))
+         << "; the camera may take a single frame");
+  }
+  ShutterTiming timing;
+  {
+    std::lock_guard<std::mutex> lk(g_shutter_mtx);
+    timing = g_shutter_timing[kShutterContinuous];
+  }
+  {
+    std::lock_guard<std::mutex> lk(g_burst_mtx);
+    if (g_burst.active) {
+      LOGE("burst: already running");
+      return 2;
+    }
+    g_burst = BurstSession{};
+    g_burst.active = true;
+  }
+  note_capture_activity();
 
-static void run_init_commands_once(const std::function<int(const std::vector<std::string>&)>& exec_fn) {
-  if (!exec_fn) return;
-  bool already = g_init_commands_ran.exchange(true, std::memory_order_acq_rel);
-  if (already) return;
-  for (const auto& cmd : g_init_commands) {
-    if (cmd.empty()) continue;
-    int rc = exec_fn(cmd);
-    if (rc != 0) {
-      LOGW("init: command '" << join_tokens(cmd) << "' returned " << rc);
+  const auto before_s1 = property_snapshot();
+  if (!set_s1(handle, true, "burst", "half-press shutter")) {
+    std::lock_guard<std::mutex> lk(g_burst_mtx);
+    g_burst.active = false;
+    return 2;
+  }
+  const std::uint64_t s1_generation = property_generation();
+  if (!manual_focus_active(snap.get())) {
+    auto hit = wait_for_focus_result(before_s1, s1_generation, std::chrono::milliseconds(timing.af_ms));
+    if (hit && focus_result(*hit) == FocusResult::NotFocused) {
+      LOGW("burst: camera reports focus not achieved; firing anyway");
     }
   }
-}
+  if (burst_interrupted()) {
+    set_s1(handle, false, "burst", "release half-press");
+    std::lock_guard<std::mutex> lk(g_burst_mtx);
+    g_burst.active = false;
+    return 2;
+  }
 
-static void input_device_thread_main(InputMapDevice device) {
-  const std::string label = device.path.empty() ? "<unknown>" : device.path;
-  constexpr std::chrono::milliseconds kRetryDelay{1000};
-  bool missing_logged = false;
+  if (verbose) LOGI("burst: shutter down");
+  send_release(handle, SDK::CrCommandParam_Down, "burst");
+  const auto t_down = clock::now();
+  bool hit_limit = false, interrupted = false;
+  {
+    // Notifications trail the sensor, so a few extra frames are normal in count mode.
+    const auto limit = want ? t_down + std::max<clock::duration>(std::chrono::seconds(10), want * std::chrono::milliseconds(500))
+                            : t_down + hold;
+    std::unique_lock<std::mutex> lk(g_burst_mtx);
+    for (;;) {
+      if (want && g_burst.shots() >= want) break;
+      if (burst_interrupted()) { interrupted = true; break; }
+      const auto now = clock::now();
+      if (now >= limit) { hit_limit = want != 0; break; }
+      g_burst_cv.wait_until(lk, std::min(limit, now + kBurstPoll));
+    }
+  }
+  send_release(handle, SDK::CrCommandParam_Up, "burst");
+  const auto t_up = clock::now();
+  set_s1(handle, false, "burst", "release half-press");
+  if (verbose) LOGI("burst: shutter up; waiting for the camera to finish writing");
+
+  BurstSession done;
+  {
+    std::unique_lock<std::mutex> lk(g_burst_mtx);
+    const auto settle_limit = t_up + kBurstSettleMax;
+    while (!interrupted) {
+      const auto quiet_until = std::max(t_up, g_burst.last_frame) + kBurstSettle;
+      const auto now = clock::now();
+      if (now >= quiet_until || now >= settle_limit) break;
+      if (burst_interrupted()) { interrupted = true; break; }
+      g_burst_cv.wait_until(lk, std::min({quiet_until, settle_limit, now + kBurstPoll}));
+    }
+    done = g_burst;
+    g_burst.active = false;
+  }
+
+  const CrInt32u frames = done.shots();
+  const double held_s = std::chrono::duration<double>(t_up - t_down).count();
+  std::ostringstream rate;
+  rate << std::fixed << std::setprecision(1) << (held_s > 0 ? frames / held_s : 0.0) << " fps";
+  if (frames > 1 && done.last_frame > done.first_frame) {
+    rate << " (" << (frames - 1) / std::chrono::duration<double>(done.last_frame - done.first_frame).count()
+         << " fps between notifications)";
+  }
+  LOGI("burst: " << frames << " frame(s) in " << std::fixed << std::setprecision(2) << held_s << " s held, "
+       << rate.str() << "; slot1 " << done.frames[1] << ", slot2 " << done.frames[2]);
+  if (hit_limit) LOGW("burst: stopped waiting for " << want << " frame(s) after " << held_s << " s");
+  if (interrupted) {
+    LOGW("burst: interrupted; leaving " << frames << " frame(s) on the card");
+    return 2;
+  }
+  if (frames == 0) {
+    LOGW("burst: the camera reported no new contents");
+    return 1;
+  }
+  if (done.frames[1]) deliver(SDK::CrSlotNumber_Slot1, done.frames[1]);
+  if (done.frames[2]) deliver(SDK::CrSlotNumber_Slot2, done.frames[2]);
+  return hit_limit ? 1 : 0;
+}
 
-  while (!g_stop.load(std::memory_order_relaxed)) {
-    int fd = open(device.path.c_str(), O_RDONLY | O_NONBLOCK);
-    if (fd < 0) {
-      int err = errno;
-      if (!missing_logged) {
-        LOGW("input-map: waiting for " << label << " (" << std::strerror(err) << ")");
-        missing_logged = true;
-      }
-      std::this_thread::sleep_for(kRetryDelay);
-      continue;
-    }
-    missing_logged = false;
+// ----------------------------
+// Exposure bracketing
+// ----------------------------
+// `bracket <prop> v1,v2,...` parses every value up front, then for each
+// frame sets the property, waits for a property snapshot that shows it
+// (no fixed sleep), and fires. The original value is put back at the end.
+struct BracketProperty {
+  const char *name;
+  CrInt32u code;
+  SDK::CrDataType type;
+  CrInt64u mask;  // bits the camera reports back for comparison
+  bool (*parse)(const std::string &, CrInt64u &);
+  std::string (*format)(CrInt64u);
+};
 
-    LOGI("input-map: listening on " << label << " (" << device.key_to_command.size() << " bindings)");
+static const BracketProperty kBracketProperties[] = {
+  {"shutter", SDK::CrDevicePropertyCode::CrDeviceProperty_ShutterSpeed, SDK::CrDataType::CrDataType_UInt32,
+   0xFFFFFFFFull,
+   [](const std::string &t, CrInt64u &v) {
+     CrInt32u e = 0;
+     if (!parse_shutter_token(t, e)) return false;
+     v = e;
+     return true;
+   },
+   format_shutter_speed},
+  {"iso", SDK::CrDevicePropertyCode::CrDeviceProperty_IsoSensitivity, SDK::CrDataType::CrDataType_UInt32,
+   0xFFFFFFFFull,
+   [](const std::string &t, CrInt64u &v) {
+     CrInt32u e = 0;
+     if (!parse_iso_token(t, e)) return false;
+     v = e;
+     return true;
+   },
+   format_iso_value},
+  {"aperture", SDK::CrDevicePropertyCode::CrDeviceProperty_FNumber, SDK::CrDataType::CrDataType_UInt16,
+   0xFFFFull,
+   [](const std::string &t, CrInt64u &v) {
+     CrInt16u e = 0;
+     if (!parse_fnumber_token(t, e)) return false;
+     v = e;
+     return true;
+   },
+   format_f_number},
+  {"comp", SDK::CrDevicePropertyCode::CrDeviceProperty_ExposureBiasCompensation, SDK::CrDataType::CrDataType_Int16,
+   0xFFFFull,
+   [](const std::string &t, CrInt64u &v) {
+     CrInt16 e = 0;
+     if (!parse_exposure_comp_token(t, e)) return false;
+     v = static_cast<CrInt16u>(e);
+     return true;
+   },
+   format_exposure_compensation},
+};
 
-    while (!g_stop.load(std::memory_order_relaxed)) {
-      struct pollfd pfd { fd, POLLIN, 0 };
-      int pr = poll(&pfd, 1, 250);
-      if (pr < 0) {
-        if (errno == EINTR) continue;
-        LOGE("input-map: poll failed on " << label << ": " << std::strerror(errno));
-        break;
-      }
-      if (pr == 0) continue;
-      if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
-        LOGW("input-map: device " << label << " disappeared (poll flags " << std::hex << pfd.revents << std::dec << ")");
-        break;
-      }
-      if (!(pfd.revents & POLLIN)) continue;
+static const BracketProperty *find_bracket_property(const std::string &raw) {
+  const ExposureValueKind *kind = exposure_value_kind(raw);
+  for (auto const &p : kBracketProperties) {
+    if (kind && kind->code == p.code) return &p;
+  }
+  return nullptr;
+}
 
-      struct input_event ev {};
-      ssize_t n = read(fd, &ev, sizeof(ev));
-      if (n < 0) {
-        if (errno == EINTR || errno == EAGAIN) continue;
-        LOGE("input-map: read failed on " << label << ": " << std::strerror(errno));
-        break;
-      }
-      if (n == 0) {
-        LOGW("input-map: device " << label << " disconnected (EOF)");
-        break;
-      }
-      if (n != sizeof(ev)) continue;
-      if (ev.type != EV_KEY) continue;
-      if (ev.value != 1) continue;
+constexpr auto kBracketConfirmTimeout = std::chrono::milliseconds(2000);
 
-      auto it = device.key_to_command.find(ev.code);
-      if (it == device.key_to_command.end()) continue;
+// Sets `value` and waits for the camera to report it. Returns false if the set
+// was rejected; `confirmed` tells whether a snapshot showed the new value in time.
+static bool bracket_apply(SDK::CrDeviceHandle handle, const BracketProperty &bp, CrInt64u value,
+                          bool &confirmed) {
+  auto matches = [&](const PropertySnapshot &p) {
+    const PropertyValue &v = p.get(bp.code);
+    return v.supported && (v.value & bp.mask) == (value & bp.mask);
+  };
+  auto snap = property_snapshot();
+  if (snap && matches(*snap)) {
+    confirmed = true;
+    return true;
+  }
+  const std::uint64_t gen = snap ? snap->generation : 0;
+  SDK::CrDeviceProperty prop;
+  prop.SetCode(bp.code);
+  prop.SetValueType(bp.type);
+  if (bp.type == SDK::CrDataType::CrDataType_Int16) {
+    prop.SetCurrentValue(static_cast<CrInt32>(static_cast<CrInt16>(value)));
+  } else {
+    prop.SetCurrentValue(value);
+  }
+  auto err = SDK::SetDeviceProperty(handle, &prop);
+  if (err != SDK::CrError_None) {
+    unsigned code = static_cast<unsigned>(err);
+    LOGE("bracket: failed to set " << bp.name << " " << bp.format(value & bp.mask) << ": "
+         << crsdk_err::error_to_name(err) << " (0x" << std::hex << code << std::dec << ")");
+    return false;
+  }
+  confirmed = static_cast<bool>(
+      wait_for_property_snapshot(gen, std::chrono::steady_clock::now() + kBracketConfirmTimeout, matches));
+  return true;
+}
 
-      int rc = run_input_mapped_command(it->second);
-      if (rc != 0) {
-        LOGW("input-map: command '" << join_tokens(it->second) << "' returned " << rc);
+// bracket <shutter|iso|aperture|comp> <v1,v2,...>
+static int bracket_command(SDK::CrDeviceHandle handle, bool verbose, const std::vector<std::string> &args) {
+  using clock = std::chrono::steady_clock;
+  const BracketProperty *bp = args.size() >= 3 ? find_bracket_property(args[1]) : nullptr;
+  if (!bp) {
+    LOGE("usage: bracket <shutter|iso|aperture|comp> <v1,v2,...>  (e.g. 'bracket shutter 1/250,1/125,1/60')");
+    return 2;
+  }
+  std::vector<std::string> tokens;
+  {
+    std::string all;
+    for (std::size_t i = 2; i < args.size(); ++i) all += args[i] + ",";
+    std::string cur;
+    for (char c : all) {
+      if (c == ',') {
+        cur = trim_copy(cur);
+        if (!cur.empty()) tokens.push_back(cur);
+        cur.clear();
+      } else {
+        cur += c;
       }
     }
-
-    close(fd);
-    if (g_stop.load(std::memory_order_relaxed)) break;
-    LOGW("input-map: device " << label << " disconnected; retrying in " << kRetryDelay.count() << " ms");
-    std::this_thread::sleep_for(kRetryDelay);
   }
-}
+  std::vector<CrInt64u> values;
+  bool bad = false;
+  for (auto const &t : tokens) {
+    CrInt64u v = 0;
+    if (!bp->parse(t, v)) {
+      LOGE("bracket: invalid " << bp->name << " value '" << t << "'");
+      bad = true;
+    } else if (!snap_to_supported(bp->code, "bracket", v)) {
+      bad = true;
+    }
+    values.push_back(v);
+  }
+  if (bad) return 2;
+  if (values.size() < 2 || values.size() > 64) {
+    LOGE("bracket: give between 2 and 64 values");
+    return 2;
+  }
+  if (!handle) {
+    LOGE("bracket: camera handle unavailable");
+    return 2;
+  }
 
-static void start_input_map_threads(const std::vector<InputMapDevice>& devices,
-                                    const std::string& source_path) {
-  if (devices.empty()) return;
-  if (!source_path.empty()) {
-    LOGI("input-map: loaded " << devices.size() << " device(s) from " << source_path);
+  const PropertyValue original = cached_property(handle, bp->code);
+  if (!original.supported) {
+    LOGE("bracket: camera does not report " << bp->name << " right now; check the mode dial");
+    return 2;
   }
-  for (const auto& dev : devices) {
-    if (dev.path.empty() || dev.key_to_command.empty()) {
-      LOGW("input-map: skipped device with no path or bindings");
-      continue;
+
+  int rc = 0;
+  std::size_t shots = 0;
+  const auto t_start = clock::now();
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    if (g_stop.load(std::memory_order_relaxed)) {
+      rc = 2;
+      break;
     }
-    g_input_device_threads.emplace_back(input_device_thread_main, dev);
+    const auto t0 = clock::now();
+    bool confirmed = false;
+    if (!bracket_apply(handle, *bp, values[i], confirmed)) {
+      rc = 2;
+      break;
+    }
+    const auto t_set = clock::now();
+    if (!confirmed) {
+      LOGW("bracket: camera did not confirm " << bp->name << " " << bp->format(values[i] & bp->mask)
+           << " within " << kBracketConfirmTimeout.count() << " ms; firing anyway");
+      rc = std::max(rc, 1);
+    }
+    const bool fired = trigger_full_shutter_press(handle, verbose, "bracket");
+    const auto t_shot = clock::now();
+    if (!fired) {
+      rc = 2;
+      break;
+    }
+    ++shots;
+    LOGI("bracket: " << i + 1 << "/" << values.size() << " " << bp->name << " "
+         << bp->format(values[i] & bp->mask) << ": set "
+         << std::chrono::duration_cast<std::chrono::milliseconds>(t_set - t0).count() << " ms"
+         << (confirmed ? "" : " (unconfirmed)") << ", shot "
+         << std::chrono::duration_cast<std::chrono::milliseconds>(t_shot - t_set).count() << " ms");
+  }
+
+  bool restored = false;
+  if (bracket_apply(handle, *bp, original.value, restored) && !restored) {
+    LOGW("bracket: camera did not confirm restoring " << bp->name << " " << bp->format(original.value & bp->mask));
   }
+  const double total_ms = std::chrono::duration<double, std::milli>(clock::now() - t_start).count();
+  LOGI("bracket: " << shots << "/" << values.size() << " frame(s) in " << std::fixed << std::setprecision(0)
+       << total_ms << " ms (" << (shots ? total_ms / shots : 0.0) << " ms per frame); " << bp->name
+       << " back to " << bp->format(original.value & bp->mask));
+  return rc;
 }
 
 static void join_input_map_threads() {
@@ -4161,6 +8961,7 @@ struct Context {
 
 int main(int argc, char **argv) {
   std::setlocale(LC_CTYPE, "");
+  t_log_unfiltered = true;
 
   install_signal_handlers();
   block_sigint_in_this_thread();
@@ -4171,6 +8972,13 @@ int main(int argc, char **argv) {
   std::string input_map_path;
   bool input_map_explicit = false;
   bool silent_no_connect = false;
+  std::string hook_server_cmd;
+  std::size_t hook_server_ack = 0;
+  std::string script_path;
+  std::string log_file_path;
+  bool log_json = false;
+  long log_rotate_mb = 10;
+  long log_rotate_hours = 24;
 
   for (int i = 1; i < argc; ++i) {
     std::string a = argv[i];
@@ -4179,6 +8987,24 @@ int main(int argc, char **argv) {
     else if (a == "--sync-dir" && i + 1 < argc) download_dir = argv[++i];
     else if (a == "--verbose" || a == "-v") verbose = true;
     else if (a == "--cmd" && i + 1 < argc) g_post_cmd = argv[++i];
+    else if (a == "--rules" && i + 1 < argc) set_hook_rules_path(argv[++i]);
+    else if (a == "--hook-server" && i + 1 < argc) hook_server_cmd = argv[++i];
+    else if (a == "--hook-ack" && i + 1 < argc) {
+      long n = std::atol(argv[++i]);
+      hook_server_ack = n < 0 ? 0 : static_cast<std::size_t>(n);
+    }
+    else if (a == "--sync-batch" && i + 1 < argc) {
+      long n = std::atol(argv[++i]);
+      g_sync_batch_max.store(n < 0 ? 0 : static_cast<std::size_t>(n), std::memory_order_relaxed);
+    }
+    else if (a == "--sync-batch-secs" && i + 1 < argc) {
+      int secs = std::atoi(argv[++i]);
+      g_sync_batch_secs.store(secs < 1 ? 1 : secs, std::memory_order_relaxed);
+    }
+    else if (a == "--hook-jobs" && i + 1 < argc) {
+      int jobs = std::atoi(argv[++i]);
+      g_hook_max_inflight.store(jobs < 1 ? 1 : jobs, std::memory_order_relaxed);
+    }
     else if (a == "--model" && i + 1 < argc) explicit_model = argv[++i];
     else if (a == "--keepalive" && i + 1 < argc) {
       long long ms = std::atoll(argv[++i]);
@@ -4194,8 +9020,50 @@ int main(int argc, char **argv) {
     else if (a == "--silent") {
       silent_no_connect = true;
     }
+    else if (a == "--script" && i + 1 < argc) script_path = argv[++i];
+    else if (a == "--batch") g_script_from_stdin = true;
+    else if (a == "--log-file" && i + 1 < argc) log_file_path = argv[++i];
+    else if (a == "--log-format" && i + 1 < argc) {
+      if (!parse_log_format(argv[++i], log_json)) {
+        LOGW("Unknown --log-format '" << argv[i] << "' (use text or json)");
+      }
+    }
+    else if (a == "--log-repeats" && i + 1 < argc) {
+      long n = std::atol(argv[++i]);
+      g_log_repeat_burst.store(n < 0 ? 0 : static_cast<unsigned>(n), std::memory_order_relaxed);
+    }
+    else if (a == "--log-rotate-mb" && i + 1 < argc) log_rotate_mb = std::atol(argv[++i]);
+    else if (a == "--log-rotate-hours" && i + 1 < argc) log_rotate_hours = std::atol(argv[++i]);
+    else if (a == "--log-level" && i + 1 < argc) {
+      int lvl = 1;
+      if (!parse_log_level(argv[++i], lvl)) {
+        LOGW("Unknown --log-level '" << argv[i] << "' (use debug, info, warn or error)");
+      } else {
+        g_log_min_level.store(lvl, std::memory_order_relaxed);
+      }
+    }
+    else if (a == "--fast-shutter") g_fast_shutter.store(true, std::memory_order_relaxed);
+    else if (a == "--prop-rate" && i + 1 < argc) {
+      char *end = nullptr;
+      long hz = std::strtol(argv[++i], &end, 10);
+      if (end == argv[i] || *end != '\0' || hz < 0 || hz > 1000) {
+        LOGW("Invalid --prop-rate '" << argv[i] << "' (use a rate in Hz, 0 = no cap); keeping "
+             << g_prop_rate_hz.load(std::memory_order_relaxed));
+      } else {
+        g_prop_rate_hz.store(static_cast<int>(hz), std::memory_order_relaxed);
+      }
+    }
   }
   g_silent_no_connect.store(silent_no_connect, std::memory_order_relaxed);
+  if (!log_file_path.empty()) start_log_file(log_file_path, log_json, log_rotate_mb, log_rotate_hours);
+  if (!script_path.empty() && g_script_from_stdin) {
+    LOGE("--script and --batch cannot be combined");
+    return 2;
+  }
+  if (!script_path.empty() && !load_script_file(script_path)) return 2;
+  g_script_mode = !script_path.empty() || g_script_from_stdin;
+  if (hook_rules_configured()) current_hook_rules();  // report syntax errors up front
+  if (!hook_server_cmd.empty()) start_hook_server(hook_server_cmd, hook_server_ack);
 
   const bool sync_dir_configured = !download_dir.empty();
 
@@ -4238,14 +9106,21 @@ int main(int argc, char **argv) {
     return 1;
   }
   g_download_dir = download_dir;
+  load_rating_ledger();
   g_auto_sync_enabled.store(false, std::memory_order_relaxed);  // require explicit "sync on" even when --sync-dir is set
 
   auto cleanup_sdk = []() {
     g_shutting_down.store(true);
+    stop_command_executor();
+    stop_hook_server();
+    stop_sync_batcher();
+    stop_hook_runner();
     SDK::Release();
   };
 
   QuietCallback cb;
+  cb.start_property_refresher();
+  bool had_session = false;
 
   // Main connect loop (keepalive-aware)
   while (!g_stop.load()) {
@@ -4263,6 +9138,7 @@ int main(int argc, char **argv) {
     bool ok = try_connect_once(explicit_host, explicit_mac, explicit_model, download_dir, verbose, auth_user, auth_pass, cb, handle, selected, enum_list, created);
     
     if (!ok) {
+      cb.set_property_refresh_enabled(false);
       disconnect_and_release(handle, created, enum_list);
       if (g_keepalive.count() == 0) {
 	LOGE( "Exiting (no keepalive)" );
@@ -4284,6 +9160,15 @@ int main(int argc, char **argv) {
       continue;
     }
     g_connected_for_logs.store(true, std::memory_order_relaxed);
+    refresh_property_cache(handle);
+    prop_recorder_push_baseline();
+    if (had_session && g_auto_sync_enabled.load(std::memory_order_acquire)) {
+      cb.schedule_reconnect_reconciliation();
+    }
+    had_session = true;
+    if (g_bg_sync_enabled.load(std::memory_order_acquire)) {
+      cb.schedule_background_sync();
+    }
 
     // Create wake pipe once per connection (or do it once at program start)
     if (g_wake_pipe[0] == -1) {
@@ -4298,41 +9183,50 @@ int main(int argc, char **argv) {
     inputThread = std::thread([handle, &cb, verbose]() {
       
       unblock_sigint_in_this_thread();
+      t_log_unfiltered = true;  // typed commands are never rate-limited
       
-      // history setup
-      History* hist = history_init();
+      // --script/--batch run without libedit, history or terminal handling;
+      // logs are then written straight through instead of via the prompt.
+      const bool interactive = !g_script_mode;
+      History* hist = nullptr;
       HistEvent ev{};
-      history(hist, &ev, H_SETSIZE, 1000);
-      // Pick a history file path
-      std::filesystem::create_directories(get_cache_dir());
-      const std::string histfile = join_path(get_cache_dir(), "history");
-      // Load previous session history (ignore failure if file doesn't exist yet)
-      history(hist, &ev, H_LOAD, histfile.c_str());
-      // Optional niceties
-      history(hist, &ev, H_SETUNIQUE, 1);   // no duplicate consecutive entries
-
-      // line editor setup
-      EditLine* el = el_init("sonshell", stdin, stdout, stderr);
-      // Replace EL_SIGNAL with our getchar (signal handling is fine to keep too)
-      el_set(el, EL_GETCFN, my_getc);
-      el_set(el, EL_PROMPT, &prompt);
-      el_set(el, EL_EDITOR, "emacs");  // or "vi"
-      el_set(el, EL_HIST, history, hist);
-      el_set(el, EL_SIGNAL, 0); // our SIGINT handler controls shutdown
-
-      // bind tab to our completion function
-      el_set(el, EL_ADDFN, "my-complete", "Complete commands", &complete);
-      el_set(el, EL_BIND, "\t", "my-complete", NULL);
-
-      el_set(el, EL_ADDFN, "trigger-shoot", "Trigger shutter release", &repl_trigger_shoot);
-      el_set(el, EL_BIND, "\eOP", "trigger-shoot", NULL);    // xterm/VT100 F1
-      el_set(el, EL_BIND, "\e[11~", "trigger-shoot", NULL);  // linux console F1
-      el_set(el, EL_BIND, "\e[[A", "trigger-shoot", NULL);   // some terminals F1
-
-      g_repl_active.store(true, std::memory_order_relaxed);
-
-      // First flush of any queued messages that arrived between connect and REPL start (no refresh)
-      (void)drain_logs_and_refresh(nullptr);
+      EditLine* el = nullptr;
+      std::string histfile;
+      if (interactive) {
+        // history setup
+        hist = history_init();
+        history(hist, &ev, H_SETSIZE, 1000);
+        // Pick a history file path
+        std::filesystem::create_directories(get_cache_dir());
+        histfile = join_path(get_cache_dir(), "history");
+        // Load previous session history (ignore failure if file doesn't exist yet)
+        history(hist, &ev, H_LOAD, histfile.c_str());
+        // Optional niceties
+        history(hist, &ev, H_SETUNIQUE, 1);   // no duplicate consecutive entries
+
+        // line editor setup
+        el = el_init("sonshell", stdin, stdout, stderr);
+        // Replace EL_SIGNAL with our getchar (signal handling is fine to keep too)
+        el_set(el, EL_GETCFN, my_getc);
+        el_set(el, EL_PROMPT, &prompt);
+        el_set(el, EL_EDITOR, "emacs");  // or "vi"
+        el_set(el, EL_HIST, history, hist);
+        el_set(el, EL_SIGNAL, 0); // our SIGINT handler controls shutdown
+
+        // bind tab to our completion function
+        el_set(el, EL_ADDFN, "my-complete", "Complete commands", &complete);
+        el_set(el, EL_BIND, "\t", "my-complete", NULL);
+
+        el_set(el, EL_ADDFN, "trigger-shoot", "Trigger shutter release", &repl_trigger_shoot);
+        el_set(el, EL_BIND, "\eOP", "trigger-shoot", NULL);    // xterm/VT100 F1
+        el_set(el, EL_BIND, "\e[11~", "trigger-shoot", NULL);  // linux console F1
+        el_set(el, EL_BIND, "\e[[A", "trigger-shoot", NULL);   // some terminals F1
+
+        g_repl_active.store(true, std::memory_order_relaxed);
+
+        // First flush of any queued messages that arrived between connect and REPL start (no refresh)
+        (void)drain_logs_and_refresh(nullptr);
+      }
 
       // bind commands to code
       Context ctx;
@@ -4402,6 +9296,7 @@ int main(int argc, char **argv) {
 	    if (a == "on") {
 	      if (!ensure_sync_directory_configured("sync on")) return 2;
 	      bool was = g_auto_sync_enabled.exchange(true, std::memory_order_acq_rel);
+	      if (!was) cb.schedule_reconcile_baseline();
 	      LOGI((was ? "Auto-sync already enabled." : "Auto-sync enabled."));
 	      return 0;
 	    }
@@ -4410,6 +9305,54 @@ int main(int argc, char **argv) {
 	      LOGI((was ? "Auto-sync disabled." : "Auto-sync already disabled."));
 	      return 0;
 	    }
+	    else if (a == "background" || a == "bg") {
+	      std::string sub = args.size() >= 3 ? args[2] : "";
+	      std::transform(sub.begin(), sub.end(), sub.begin(), [](unsigned char c){ return std::tolower(c); });
+	      if (sub.empty()) {
+	        LOGI("Background sync: " << (g_bg_sync_enabled.load() ? "on" : "off")
+	             << " (" << (g_bg_sync_newest_first.load() ? "newest" : "oldest")
+	             << " first, duty " << g_bg_sync_duty.load() << "%)"
+	             << (g_bg_sync_enabled.load() && !background_sync_idle() ? ", paused" : ""));
+	        return 0;
+	      }
+	      if (sub == "off") {
+	        bool was = g_bg_sync_enabled.exchange(false, std::memory_order_acq_rel);
+	        LOGI((was ? "Background sync disabled." : "Background sync already disabled."));
+	        return 0;
+	      }
+	      if (sub != "on") {
+	        LOGE("usage: sync background [on [oldest|newest] [duty <1-100>] | off]");
+	        return 2;
+	      }
+	      bool newest_first = g_bg_sync_newest_first.load();
+	      int duty = g_bg_sync_duty.load();
+	      for (size_t i = 3; i < args.size(); ++i) {
+	        std::string opt = args[i];
+	        std::transform(opt.begin(), opt.end(), opt.begin(), [](unsigned char c){ return std::tolower(c); });
+	        if (opt == "oldest") newest_first = false;
+	        else if (opt == "newest") newest_first = true;
+	        else if (opt == "duty" && i + 1 < args.size()) {
+	          std::string v = args[++i];
+	          if (!v.empty() && v.back() == '%') v.pop_back();
+	          try { duty = std::stoi(v); } catch (...) { duty = 0; }
+	          if (duty < 1 || duty > 100) {
+	            LOGE("sync background: duty must be 1-100 (percent of time spent transferring)");
+	            return 2;
+	          }
+	        } else {
+	          LOGE("usage: sync background [on [oldest|newest] [duty <1-100>] | off]");
+	          return 2;
+	        }
+	      }
+	      if (!ensure_sync_directory_configured("sync background")) return 2;
+	      g_bg_sync_newest_first.store(newest_first, std::memory_order_relaxed);
+	      g_bg_sync_duty.store(duty, std::memory_order_relaxed);
+	      g_bg_sync_enabled.store(true, std::memory_order_release);
+	      cb.schedule_background_sync();
+	      LOGI("Background sync enabled (" << (newest_first ? "newest" : "oldest")
+	           << " first, duty " << duty << "%); runs while the camera is idle.");
+	      return 0;
+	    }
 	    else if (a == "all") {
 	      all = true;
 	    }
@@ -4463,7 +9406,7 @@ int main(int argc, char **argv) {
 	    }
 	    else {
 	      try { n = std::max(1, std::stoi(args[1])); }
-	      catch (...) { LOGE("usage: sync [count|all|star|on|off|stop]"); return 2; }
+	      catch (...) { LOGE("usage: sync [count|all|star|on|off|stop|background]"); return 2; }
 	    }
 	  }
 
@@ -4521,6 +9464,7 @@ int main(int argc, char **argv) {
 
 	    // Reset active counter before we spawn any workers.
 	    g_sync_active.store(0, std::memory_order_relaxed);
+	    g_sync_listing_failed.store(false, std::memory_order_relaxed);
 	    {
 	      std::lock_guard<std::mutex> lk(g_sync_transfer_mtx);
 	      g_sync_transfers.clear();
@@ -4564,13 +9508,16 @@ int main(int argc, char **argv) {
 	    bool aborted = g_sync_abort.load(std::memory_order_acquire);
 
 	    // at the end of the detached sync thread
+	    const bool incomplete = !aborted && g_sync_listing_failed.load(std::memory_order_relaxed);
 	    if (aborted) {
 	      LOGI("Sync: stopped.");
+	    } else if (incomplete) {
+	      LOGW("Sync: incomplete; a contents listing failed. Run the sync again to fetch the rest.");
 	    } else {
 	      LOGI("Sync: done.");
 	    }
 	    LOGI("Sync session ended after " << elapsed << "s"
-		 << " (" << (aborted ? "stopped" : "completed") << ").");
+		 << " (" << (aborted ? "stopped" : (incomplete ? "incomplete" : "completed")) << ").");
 	    
 	  }).detach();
 	  } catch (...) {
@@ -4812,6 +9759,36 @@ int main(int argc, char **argv) {
 	  return 2;
 	#endif
 	}},
+	{"ratings", [&](auto const& args)->int {
+	  if (args.size() < 2 || args[1] != "export") {
+	    LOGE("usage: ratings export");
+	    return 2;
+	  }
+	  return export_rating_sidecars(handle, verbose);
+	}},
+	{"props", [&](auto const& args)->int {
+	  std::string sub = args.size() > 1 ? args[1] : std::string();
+	  if (sub == "record" && args.size() == 3) {
+	    return prop_recorder_start(args[2]) ? 0 : 2;
+	  }
+	  if (sub == "stop" && args.size() == 2) {
+	    if (!g_prop_rec_active.load()) {
+	      LOGW("props: no recording in progress");
+	      return 1;
+	    }
+	    prop_recorder_stop();
+	    return 0;
+	  }
+	  if (sub == "decode" && (args.size() == 3 || args.size() == 4)) {
+	    return prop_recorder_decode(args[2], args.size() == 4 ? args[3] : args[2] + ".csv");
+	  }
+	  LOGE("usage: props record <file> | props stop | props decode <file> [out.csv]");
+	  return 2;
+	}},
+	{"metrics", [&](auto const& args)->int {
+	  (void)args;
+	  return log_metrics();
+	}},
 	{"power", [&](auto const& args)->int {
 	  if (args.size() < 2) {
 	    LOGE("usage: power off");
@@ -4864,6 +9841,29 @@ int main(int argc, char **argv) {
 	  LOGI("Power-off command sent; waiting for camera to disconnect...");
 	  return 0;
 	}},
+	{"shutter", [&](auto const& args)->int {
+	  return shutter_command(args);
+	}},
+	{"burst", [&](auto const& args)->int {
+	  return burst_command(handle, verbose, args, [&](CrInt32u slot, CrInt32u frames) {
+	    cb.OnNotifyRemoteTransferContentsListChanged(SDK::CrNotify_RemoteTransfer_Changed_Add, slot, frames);
+	  });
+	}},
+	{"bracket", [&](auto const& args)->int {
+	  return bracket_command(handle, verbose, args);
+	}},
+	{"interval", [&](auto const& args)->int {
+	  return interval_command(handle, verbose, args);
+	}},
+	{"wait", [&](auto const& args)->int {
+	  char* end = nullptr;
+	  long ms = args.size() == 2 ? std::strtol(args[1].c_str(), &end, 10) : -1;
+	  if (ms < 0 || !end || *end != '\0') {
+	    LOGE("usage: wait <ms>");
+	    return 2;
+	  }
+	  return script_sleep(std::chrono::milliseconds(ms)) ? 0 : 1;
+	}},
 	{"quit", [&](auto const&)->int {
 	  g_stop.store(true, std::memory_order_relaxed);   // <<< unify shutdown
 	  return 99;
@@ -4874,27 +9874,32 @@ int main(int argc, char **argv) {
 	}},
       };
 
-      auto run_cli_command = [&](const std::vector<std::string>& args) -> int {
+      // Executor workers take the resources themselves and call dispatch directly.
+      auto dispatch_cli_command = [&](const std::vector<std::string>& args) -> int {
 	if (args.empty()) return 0;
 	auto it = cmd.find(args[0]);
 	if (it == cmd.end()) {
 	  LOGE("Unknown command: " << args[0]);
 	  return 2;
 	}
-	std::lock_guard<std::mutex> exec_lk(g_command_exec_mutex);
 	return it->second(args);
       };
+      auto run_cli_command = [&](const std::vector<std::string>& args) -> int {
+	CommandResourceLock res_lk(command_resources(args));
+	return dispatch_cli_command(args);
+      };
 
       {
 	std::lock_guard<std::mutex> lk(g_command_runner_mutex);
-	g_command_runner = run_cli_command;
+	g_command_runner = dispatch_cli_command;
       }
-      g_command_runner_cv.notify_all();
 
       // Fire optional init commands once per program run (after first connect).
       run_init_commands_once(run_cli_command);
 
-      while (!g_stop.load(std::memory_order_relaxed) && !g_reconnect.load(std::memory_order_relaxed)) {
+      if (!interactive) run_script_session(run_cli_command);
+
+      while (interactive && !g_stop.load(std::memory_order_relaxed) && !g_reconnect.load(std::memory_order_relaxed)) {
 
         // Print logs that arrived just before we read; NO refresh here to avoid double prompt
         (void)drain_logs_and_refresh(nullptr);
@@ -4939,29 +9944,33 @@ int main(int argc, char **argv) {
 
 	history(hist, &ev, H_ENTER, line.c_str());
 
-	auto args = tokenize(line);
-	int rc = run_cli_command(args);
+	int rc = run_command_line(line, run_cli_command);
 	if (rc == 99) break;  // already set g_stop above
 	
 	// Print logs produced by the command; let el_gets() render the next prompt once.
 	drain_logs_and_refresh(nullptr);
       }
 
-      // save historry
-      history(hist, &ev, H_SAVE, histfile.c_str());
-      history_end(hist);
-      el_end(el);
+      if (interactive) {
+        // save historry
+        history(hist, &ev, H_SAVE, histfile.c_str());
+        history_end(hist);
+        el_end(el);
+      }
 
       g_repl_active.store(false, std::memory_order_relaxed);
       {
 	std::lock_guard<std::mutex> lk(g_command_runner_mutex);
 	g_command_runner = nullptr;
       }
-      g_command_runner_cv.notify_all();
+      quiesce_command_executor();
+      interval_stop();  // its shots use this session's handle
 
       // Ensure the prompt line is cleared so shutdown logs start cleanly
-      std::fputs("\r\033[K", stdout);
-      std::fflush(stdout);
+      if (interactive) {
+        std::fputs("\r\033[K", stdout);
+        std::fflush(stdout);
+      }
 
     });
 
@@ -4980,19 +9989,13 @@ int main(int argc, char **argv) {
     
     // 2) Now log and disconnect the camera; no prompt can appear anymore.
     if (verbose) LOGI( "Shutting down connection..." );
+    cb.set_property_refresh_enabled(false);
     disconnect_and_release(handle, created, enum_list);
     g_connected_for_logs.store(false, std::memory_order_relaxed);
+    clear_property_snapshot();
     
     // 3) Join any download workers.
-    for (auto &t : g_downloadThreads) {
-      if (!t.joinable()) continue;
-      if (g_force_close_requested.load(std::memory_order_relaxed)) {
-        t.detach();
-      } else {
-        t.join();
-      }
-    }
-    g_downloadThreads.clear();
+    join_download_threads();
     
     // 4) Close wake pipe at the very end.
     if (g_wake_pipe[0] != -1) { close(g_wake_pipe[0]); g_wake_pipe[0] = -1; }
@@ -5014,18 +10017,14 @@ int main(int argc, char **argv) {
   }
 
   maybe_log_force_close();
+  flush_log_repeats(true);
   LOGI( "Shutting down..." );
   monitor_stop();
-  for (auto &t : g_downloadThreads) {
-    if (!t.joinable()) continue;
-    if (g_force_close_requested.load(std::memory_order_relaxed)) {
-      t.detach();
-    } else {
-      t.join();
-    }
-  }
+  prop_recorder_stop();
+  cb.stop_property_refresher();
+  join_download_threads();
   g_stop.store(true, std::memory_order_relaxed);
   join_input_map_threads();
   cleanup_sdk();
-  return 0;
+  return g_exit_code.load();
 }
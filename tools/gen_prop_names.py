@@ -1,5 +1,6 @@
 #!/usr/bin/env python3
-# Generates prop_names_generated.h from a specific CrDeviceProperty.h.
+# Generates prop_names_generated.h from a specific CrDeviceProperty.h:
+# code -> name lookup plus a dense code -> slot table for flat value arrays.
 # Usage:
 #   python3 gen_prop_names.py --header /absolute/path/to/CrDeviceProperty.h -o <out.h>
 import argparse, re, sys
@@ -46,6 +47,23 @@ def parse_enum(text, enum_name):
             code_to_name[val] = name
     return code_to_name
 
+# Largest hole allowed inside one run before a new run starts; keeps the
+# lookup table small while the run list stays short enough to bisect.
+RUN_GAP = 16
+
+def build_slot_runs(codes):
+    runs = []
+    start = prev = codes[0]
+    offset = 0
+    for code in codes[1:]:
+        if code - prev > RUN_GAP:
+            runs.append((start, prev - start + 1, offset))
+            offset += prev - start + 1
+            start = code
+        prev = code
+    runs.append((start, prev - start + 1, offset))
+    return runs
+
 def main():
     ap = argparse.ArgumentParser()
     ap.add_argument("--header", required=True, help="Absolute path to CrDeviceProperty.h")
@@ -60,24 +78,63 @@ def main():
     mapping = parse_enum(text, "CrDevicePropertyCode")
     items = sorted(mapping.items())
 
+    if not items:
+        sys.exit("CrDevicePropertyCode has no entries")
+    if len(items) > 32767:
+        sys.exit("Too many property codes for int16 slots")
+    runs = build_slot_runs([code for code, _ in items])
+    lut_size = sum(length for _, length, _ in runs)
+    slot_of = {code: slot for slot, (code, _) in enumerate(items)}
+
     out = Path(args.out)
     out.parent.mkdir(parents=True, exist_ok=True)
     with out.open("w") as f:
         f.write("// Auto-generated from Sony CRSDK CrDeviceProperty.h. Do not edit.\n")
         f.write("#pragma once\n")
-        f.write("#include <unordered_map>\n")
+        f.write("#include <cstddef>\n")
+        f.write("#include <cstdint>\n")
         f.write("#include \"CRSDK/CrTypes.h\"\n\n")
         f.write(f"// SOURCE: {header}\n")
         f.write(f"#define PROP_NAMES_SOURCE \"{header}\"\n")
-        f.write(f"#define PROP_NAMES_COUNT {len(items)}\n\n")
+        f.write(f"#define PROP_NAMES_COUNT {len(items)}\n")
+        f.write(f"#define PROP_SLOT_COUNT {len(items)}\n\n")
         f.write("namespace crsdk_util {\n")
-        f.write("static const std::unordered_map<CrInt32u, const char*> kPropNames = {\n")
-        for code, name in items:
-            f.write(f"    {{ (CrInt32u)0x{code:04x}, \"{name}\" }},\n")
+        f.write("// Every known code owns a dense slot in [0, PROP_SLOT_COUNT), in code order.\n")
+        f.write("static const CrInt32u kPropSlotCodes[PROP_SLOT_COUNT] = {\n")
+        for code, _ in items:
+            f.write(f"    (CrInt32u)0x{code:04x},\n")
+        f.write("};\n\n")
+        f.write("static const char* const kPropSlotNames[PROP_SLOT_COUNT] = {\n")
+        for _, name in items:
+            f.write(f"    \"{name}\",\n")
+        f.write("};\n\n")
+        f.write("// Codes cluster in a few nearly contiguous ranges; each run indexes\n")
+        f.write("// straight into kPropSlotLut, where -1 marks the gaps inside a run.\n")
+        f.write("struct PropSlotRun { CrInt32u base; CrInt32u length; CrInt32u lut_offset; };\n")
+        f.write(f"static const PropSlotRun kPropSlotRuns[{len(runs)}] = {{\n")
+        for base, length, offset in runs:
+            f.write(f"    {{ (CrInt32u)0x{base:04x}, {length}u, {offset}u }},\n")
+        f.write("};\n\n")
+        f.write(f"static const std::int16_t kPropSlotLut[{lut_size}] = {{\n")
+        for base, length, _ in runs:
+            row = [str(slot_of.get(base + k, -1)) for k in range(length)]
+            for i in range(0, len(row), 16):
+                f.write("    " + ", ".join(row[i:i + 16]) + ",\n")
         f.write("};\n\n")
+        f.write("static inline int prop_code_to_slot(CrInt32u code) {\n")
+        f.write("    std::size_t lo = 0, hi = sizeof(kPropSlotRuns) / sizeof(kPropSlotRuns[0]);\n")
+        f.write("    while (lo < hi) {\n")
+        f.write("        std::size_t mid = (lo + hi) / 2;\n")
+        f.write("        const PropSlotRun &run = kPropSlotRuns[mid];\n")
+        f.write("        if (code < run.base) hi = mid;\n")
+        f.write("        else if (code - run.base >= run.length) lo = mid + 1;\n")
+        f.write("        else return kPropSlotLut[run.lut_offset + (code - run.base)];\n")
+        f.write("    }\n")
+        f.write("    return -1;\n")
+        f.write("}\n\n")
         f.write("static inline const char* prop_code_to_name(CrInt32u code) {\n")
-        f.write("    auto it = kPropNames.find(code);\n")
-        f.write("    return it == kPropNames.end() ? \"DeviceProperty\" : it->second;\n")
+        f.write("    int slot = prop_code_to_slot(code);\n")
+        f.write("    return slot < 0 ? \"DeviceProperty\" : kPropSlotNames[slot];\n")
         f.write("}\n")
         f.write("} // namespace crsdk_util\n")
     print(f"Wrote {out} with {len(items)} entries from {header}")